@@ -0,0 +1,126 @@
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include "affinity.h"
+#include "binding.h"
+
+namespace {
+
+#ifdef __linux__
+// From <numaif.h>, which is only available with libnuma installed.
+const int kMpolPreferred = 1;
+const unsigned kMpolMfMove = 1 << 1;
+
+const int kMaxNumaNodes = 64;
+
+thread_local int current_numa_node = -1;
+
+// Returns whether cpu is in the kernel cpulist file at path, which holds
+// ranges like "0-7,16-23".
+bool CpuListContains(const char* path, int cpu) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) return false;
+
+  bool found = false;
+  int lo, hi;
+  while (!found && fscanf(f, "%d", &lo) == 1) {
+    hi = lo;
+    int c = fgetc(f);
+    if (c == '-') {
+      if (fscanf(f, "%d", &hi) != 1) break;
+      c = fgetc(f);
+    }
+    found = cpu >= lo && cpu <= hi;
+    if (c != ',') break;
+  }
+  fclose(f);
+  return found;
+}
+
+long SetMemPolicy(int mode, int node) {
+  unsigned long mask = 1UL << node;
+  return syscall(SYS_set_mempolicy, mode, &mask, sizeof(mask) * 8);
+}
+#endif
+
+}  // namespace
+
+int CurrentThreadNumaNode() {
+#ifdef __linux__
+  return current_numa_node;
+#else
+  return -1;
+#endif
+}
+
+void NumaBindMemory(void* data, size_t length, int node) {
+#ifdef __linux__
+  if (node < 0 || node >= kMaxNumaNodes) return;
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = (reinterpret_cast<uintptr_t>(data) + page - 1) & ~(page - 1);
+  uintptr_t end = (reinterpret_cast<uintptr_t>(data) + length) & ~(page - 1);
+  if (end <= start) return;
+
+  unsigned long mask = 1UL << node;
+  syscall(SYS_mbind, start, end - start, kMpolPreferred, &mask,
+          sizeof(mask) * 8, kMpolMfMove);
+#endif
+}
+
+extern "C" {
+
+// Returns the number of NUMA nodes, 1 on machines without NUMA.
+int numa_node_count() {
+#ifdef __linux__
+  int n = 0;
+  char path[64];
+  while (n < kMaxNumaNodes) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n);
+    if (access(path, F_OK) != 0) break;
+    n++;
+  }
+  return n > 0 ? n : 1;
+#else
+  return 1;
+#endif
+}
+
+// Returns the NUMA node cpu belongs to.
+int numa_node_of_cpu(int cpu) {
+#ifdef __linux__
+  char path[64];
+  int nodes = numa_node_count();
+  for (int node = 0; node < nodes; node++) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (CpuListContains(path, cpu)) return node;
+  }
+#endif
+  return 0;
+}
+
+// Pins the calling thread to a single CPU. On NUMA machines the thread also
+// prefers memory from that CPU's node, and workers created on it allocate
+// their large array buffers there. returns nonzero on error or if the
+// platform does not support thread affinity.
+int pin_thread_to_cpu(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) return 1;
+
+  if (numa_node_count() > 1) {
+    int node = numa_node_of_cpu(cpu);
+    if (SetMemPolicy(kMpolPreferred, node) == 0) current_numa_node = node;
+  }
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+}
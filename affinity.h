@@ -0,0 +1,16 @@
+#ifndef V8WORKER_AFFINITY_H_
+#define V8WORKER_AFFINITY_H_
+
+#include <stddef.h>
+
+// Returns the NUMA node the calling thread was placed on by
+// pin_thread_to_cpu, or -1 if it was not placed.
+int CurrentThreadNumaNode();
+
+// Asks the kernel to back the whole pages of [data, data + length) with
+// memory from node. Pages that were already touched are migrated. The range
+// must be a mapping the caller owns: binding memory from malloc would change
+// the policy of whatever shares its pages and split the heap's mappings.
+void NumaBindMemory(void* data, size_t length, int node);
+
+#endif  // V8WORKER_AFFINITY_H_
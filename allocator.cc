@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#include "affinity.h"
+#include "allocator.h"
+
+namespace {
+
+// Buffers at least this large are bound to the worker's NUMA node. Smaller
+// ones come from malloc's arenas and would mostly share pages.
+const size_t kNumaBindThreshold = 1 << 20;
+
+const size_t kHugePageSize = 2 << 20;
+
+// Reads a "Key:   123 kB" line from /proc/self/smaps_rollup, in bytes.
+size_t SmapsRollupBytes(const char* key) {
+  FILE* f = fopen("/proc/self/smaps_rollup", "r");
+  if (f == NULL) return 0;
+
+  size_t key_len = strlen(key);
+  size_t bytes = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, key, key_len) == 0 && line[key_len] == ':') {
+      bytes = strtoull(line + key_len + 1, NULL, 10) * 1024;
+      break;
+    }
+  }
+  fclose(f);
+  return bytes;
+}
+
+}  // namespace
+
+ArrayBufferAllocator::ArrayBufferAllocator()
+    : numa_node(-1),
+      huge_pages(HUGE_PAGES_OFF),
+      explicit_bytes_(0),
+      transparent_bytes_(0) {}
+
+void* ArrayBufferAllocator::Allocate(size_t length) {
+  void* data = AllocateUninitialized(length);
+  return data == NULL ? data : memset(data, 0, length);
+}
+
+void* ArrayBufferAllocator::AllocateUninitialized(size_t length) {
+  bool bind = numa_node >= 0 && length >= kNumaBindThreshold;
+  void* data = NULL;
+  if (huge_pages != HUGE_PAGES_OFF && length >= kHugePageSize) {
+    data = AllocateHuge(length, bind);
+  }
+  if (data == NULL && bind) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (length + page - 1) & ~(page - 1);
+    data = Map(size, page);
+    if (data != NULL) {
+      NumaBindMemory(data, size, numa_node);
+      Track(data, size, kMapped);
+    }
+  }
+  if (data == NULL) data = malloc(length);
+  return data;
+}
+
+void ArrayBufferAllocator::Free(void* data, size_t) {
+  if (huge_pages != HUGE_PAGES_OFF || numa_node >= 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<void*, std::pair<size_t, Kind> >::iterator it = mapped_.find(data);
+    if (it != mapped_.end()) {
+      size_t size = it->second.first;
+      Kind kind = it->second.second;
+      mapped_.erase(it);
+      if (kind == kExplicit) explicit_bytes_ -= size;
+      if (kind == kTransparent || kind == kTransparentMapped) {
+        transparent_bytes_ -= size;
+      }
+      if (kind != kTransparent) {
+#ifdef __linux__
+        munmap(data, size);
+#endif
+        return;
+      }
+    }
+  }
+  free(data);
+}
+
+// Returns memory backed by huge pages, or NULL to fall back to malloc.
+// Explicit mode uses the reserved hugetlb pool and falls back to transparent
+// huge pages when the pool is exhausted. Memory to bind to numa_node is
+// always mapped.
+void* ArrayBufferAllocator::AllocateHuge(size_t length, bool bind) {
+#ifdef __linux__
+  size_t size = (length + kHugePageSize - 1) & ~(kHugePageSize - 1);
+
+  if (huge_pages == HUGE_PAGES_EXPLICIT) {
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data != MAP_FAILED) {
+      if (bind) NumaBindMemory(data, size, numa_node);
+      Track(data, size, kExplicit);
+      return data;
+    }
+  }
+
+  if (bind) {
+    void* data = Map(size, kHugePageSize);
+    if (data == NULL) return NULL;
+    madvise(data, size, MADV_HUGEPAGE);
+    NumaBindMemory(data, size, numa_node);
+    Track(data, size, kTransparentMapped);
+    return data;
+  }
+
+  // Aligned malloc memory so that every page of it can be a huge page, and
+  // so that it can still be released with free.
+  void* data;
+  if (posix_memalign(&data, kHugePageSize, size) != 0) return NULL;
+  madvise(data, size, MADV_HUGEPAGE);
+  Track(data, size, kTransparent);
+  return data;
+#else
+  return NULL;
+#endif
+}
+
+// Returns an anonymous mapping of size bytes aligned to alignment, a
+// multiple of the page size, or NULL.
+void* ArrayBufferAllocator::Map(size_t size, size_t alignment) {
+#ifdef __linux__
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t extra = alignment > page ? alignment : 0;
+  void* mapped = mmap(NULL, size + extra, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) return NULL;
+  if (extra == 0) return mapped;
+
+  // Trims the unaligned head and the tail.
+  uintptr_t start = reinterpret_cast<uintptr_t>(mapped);
+  uintptr_t aligned = (start + alignment - 1) & ~(alignment - 1);
+  if (aligned > start) munmap(mapped, aligned - start);
+  size_t tail = start + size + extra - (aligned + size);
+  if (tail > 0) munmap(reinterpret_cast<void*>(aligned + size), tail);
+  return reinterpret_cast<void*>(aligned);
+#else
+  return NULL;
+#endif
+}
+
+void ArrayBufferAllocator::Track(void* data, size_t size, Kind kind) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  mapped_[data] = std::make_pair(size, kind);
+  if (kind == kExplicit) explicit_bytes_ += size;
+  if (kind == kTransparent || kind == kTransparentMapped) {
+    transparent_bytes_ += size;
+  }
+}
+
+void ArrayBufferAllocator::GetHugePageStatistics(huge_page_statistics* hs) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hs->explicit_bytes = explicit_bytes_;
+    hs->transparent_bytes = transparent_bytes_;
+  }
+  GetProcessHugePageStatistics(hs);
+}
+
+void ArrayBufferAllocator::GetProcessHugePageStatistics(
+    huge_page_statistics* hs) {
+  hs->process_anon_huge_bytes = SmapsRollupBytes("AnonHugePages");
+  hs->process_hugetlb_bytes = SmapsRollupBytes("Private_Hugetlb") +
+                              SmapsRollupBytes("Shared_Hugetlb");
+}
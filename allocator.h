@@ -0,0 +1,61 @@
+#ifndef V8WORKER_ALLOCATOR_H_
+#define V8WORKER_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <map>
+#include <mutex>
+#include "v8.h"
+#include "binding.h"
+
+// ArrayBuffer allocator of a worker. Backed by malloc, with large buffers
+// optionally placed on a NUMA node and backed by 2 MB huge pages. Buffers
+// placed on a node are mappings of their own, as binding malloc memory would
+// also bind the allocator's neighbouring chunks.
+//
+// Free may be called with a length smaller than the one allocated, e.g. for
+// buffers grown by doubling and handed to V8 with their used length, so
+// anything that is not plain malloc memory is looked up by address.
+class ArrayBufferAllocator : public v8::ArrayBuffer::Allocator {
+ public:
+  ArrayBufferAllocator();
+  virtual ~ArrayBufferAllocator() {}
+
+  virtual void* Allocate(size_t length);
+  virtual void* AllocateUninitialized(size_t length);
+  virtual void Free(void* data, size_t length);
+
+  void GetHugePageStatistics(huge_page_statistics* hs);
+  // Fills in only the process-wide fields of hs.
+  static void GetProcessHugePageStatistics(huge_page_statistics* hs);
+
+  // NUMA node large buffers are allocated from, or -1 for the default
+  // policy. Buffers may be filled by threads other than the worker's, e.g.
+  // stream writers, so first-touch placement is not enough.
+  int numa_node;
+  // One of the HUGE_PAGES_* modes.
+  int huge_pages;
+
+ private:
+  enum Kind {
+    // hugetlb mapping
+    kExplicit,
+    // madvised malloc memory
+    kTransparent,
+    // madvised mapping, bound to numa_node
+    kTransparentMapped,
+    // plain mapping, bound to numa_node
+    kMapped,
+  };
+
+  void* AllocateHuge(size_t length, bool bind);
+  void* Map(size_t size, size_t alignment);
+  void Track(void* data, size_t size, Kind kind);
+
+  std::mutex mutex_;
+  // Allocations that are not plain malloc memory, by address: size and kind.
+  std::map<void*, std::pair<size_t, Kind> > mapped_;
+  size_t explicit_bytes_;
+  size_t transparent_bytes_;
+};
+
+#endif  // V8WORKER_ALLOCATOR_H_
@@ -0,0 +1,64 @@
+#include <string.h>
+#include "batch.h"
+#include "binding.h"
+
+batch_s::~batch_s() {
+  for (size_t i = 0; i < columns.size(); i++) {
+    if (columns[i].data != NULL) allocator->Free(columns[i].data, columns[i].size);
+  }
+}
+
+bool batch_s::Add(const char* name, int type, const void* values) {
+  Column c;
+  c.name = name;
+  c.type = type;
+  c.size = (size_t)length * (type == BATCH_INT32 || type == BATCH_DICTIONARY ? 4 : 8);
+  c.data = NULL;
+  if (c.size > 0) {
+    c.data = allocator->AllocateUninitialized(c.size);
+    if (c.data == NULL) return false;
+  }
+
+  if (type == BATCH_INT64) {
+    // Typed arrays of 64-bit integers are not available, so they are
+    // converted to doubles, exact up to 2^53.
+    const int64_t* in = static_cast<const int64_t*>(values);
+    double* out = static_cast<double*>(c.data);
+    for (int i = 0; i < length; i++) out[i] = static_cast<double>(in[i]);
+  } else if (c.size > 0) {
+    memcpy(c.data, values, c.size);
+  }
+  columns.push_back(c);
+  return true;
+}
+
+bool batch_s::AddDictionary(const char* name, const int32_t* codes,
+                            const char* strings, const int32_t* ends,
+                            int count) {
+  if (!Add(name, BATCH_DICTIONARY, codes)) return false;
+  std::vector<std::string>& dictionary = columns.back().dictionary;
+  dictionary.reserve(count);
+  int32_t start = 0;
+  for (int i = 0; i < count; i++) {
+    dictionary.push_back(std::string(strings + start, ends[i] - start));
+    start = ends[i];
+  }
+  return true;
+}
+
+extern "C" {
+
+int batch_add_column(batch* b, const char* name, int type, const void* values) {
+  return b->Add(name, type, values) ? 0 : 1;
+}
+
+int batch_add_dictionary(batch* b, const char* name, const int32_t* codes,
+                         const char* strings, const int32_t* ends, int count) {
+  return b->AddDictionary(name, codes, strings, ends, count) ? 0 : 1;
+}
+
+void batch_free(batch* b) {
+  delete b;
+}
+
+}
@@ -0,0 +1,157 @@
+package v8worker
+
+/*
+#include <stdlib.h>
+#include "binding.h"
+*/
+import "C"
+import (
+	"errors"
+	"strconv"
+	"unsafe"
+)
+
+// RecordBatch is a table of rows stored by column, for scripts that loop over
+// many rows. See SendRecordBatch. The slices passed to the Add methods are
+// only read when the batch is sent.
+type RecordBatch struct {
+	length  int
+	columns []batchColumn
+}
+
+type batchColumn struct {
+	name       string
+	kind       int
+	values     unsafe.Pointer
+	dictionary []string
+}
+
+// NewRecordBatch creates an empty batch of length rows.
+func NewRecordBatch(length int) *RecordBatch {
+	return &RecordBatch{length: length}
+}
+
+// Len returns the number of rows.
+func (b *RecordBatch) Len() int {
+	return b.length
+}
+
+func (b *RecordBatch) add(name string, kind int, n int, values unsafe.Pointer, dictionary []string) {
+	if n != b.length {
+		panic("column " + name + " has " + strconv.Itoa(n) + " values for " + strconv.Itoa(b.length) + " rows")
+	}
+	b.columns = append(b.columns, batchColumn{
+		name:       name,
+		kind:       kind,
+		values:     values,
+		dictionary: dictionary,
+	})
+}
+
+// AddFloat64 adds a column that javascript sees as a Float64Array.
+func (b *RecordBatch) AddFloat64(name string, values []float64) {
+	var p unsafe.Pointer
+	if len(values) > 0 {
+		p = unsafe.Pointer(&values[0])
+	}
+	b.add(name, C.BATCH_FLOAT64, len(values), p, nil)
+}
+
+// AddInt64 adds a column that javascript sees as a Float64Array, as V8 has no
+// typed array of 64-bit integers. Values beyond 2^53 lose precision.
+func (b *RecordBatch) AddInt64(name string, values []int64) {
+	var p unsafe.Pointer
+	if len(values) > 0 {
+		p = unsafe.Pointer(&values[0])
+	}
+	b.add(name, C.BATCH_INT64, len(values), p, nil)
+}
+
+// AddInt32 adds a column that javascript sees as an Int32Array.
+func (b *RecordBatch) AddInt32(name string, values []int32) {
+	var p unsafe.Pointer
+	if len(values) > 0 {
+		p = unsafe.Pointer(&values[0])
+	}
+	b.add(name, C.BATCH_INT32, len(values), p, nil)
+}
+
+// AddDictionary adds a column of strings encoded as codes into dictionary.
+// javascript sees the codes as an Int32Array, and the dictionary as an array
+// of strings under the same name in the batch's dictionaries.
+func (b *RecordBatch) AddDictionary(name string, codes []int32, dictionary []string) {
+	var p unsafe.Pointer
+	if len(codes) > 0 {
+		p = unsafe.Pointer(&codes[0])
+	}
+	b.add(name, C.BATCH_DICTIONARY, len(codes), p, dictionary)
+}
+
+// AddStrings adds a column of strings, dictionary encoded as by
+// AddDictionary with the distinct values in order of appearance.
+func (b *RecordBatch) AddStrings(name string, values []string) {
+	codes := make([]int32, len(values))
+	var dictionary []string
+	index := make(map[string]int32)
+	for i, s := range values {
+		code, ok := index[s]
+		if !ok {
+			code = int32(len(dictionary))
+			index[s] = code
+			dictionary = append(dictionary, s)
+		}
+		codes[i] = code
+	}
+	b.AddDictionary(name, codes, dictionary)
+}
+
+// SendRecordBatch passes b to the $recv callback in js as an object with the
+// number of rows in length, a typed array per column in columns, and an
+// array of strings per dictionary column in dictionaries. There are no
+// per-row objects: each column is copied once into a buffer of the worker,
+// which backs its typed array.
+func (w *Worker) SendRecordBatch(b *RecordBatch) error {
+	w.touch()
+	if w.remote != nil {
+		return errRemote
+	}
+	cBatch := C.worker_batch_new(w.cWorker, C.int(b.length))
+	for _, c := range b.columns {
+		if r := b.addColumn(cBatch, &c); r != 0 {
+			C.batch_free(cBatch)
+			return errors.New("out of memory for column " + c.name)
+		}
+	}
+
+	r := C.worker_send_batch(w.cWorker, cBatch)
+	if r != 0 {
+		errStr := C.worker_last_exception(w.cWorker)
+		return errors.New(C.GoString(errStr))
+	}
+
+	return nil
+}
+
+func (b *RecordBatch) addColumn(cBatch *C.batch, c *batchColumn) C.int {
+	cName := C.CString(c.name)
+	defer C.free(unsafe.Pointer(cName))
+	if c.kind != C.BATCH_DICTIONARY {
+		return C.batch_add_column(cBatch, cName, C.int(c.kind), c.values)
+	}
+
+	var strings []byte
+	ends := make([]int32, len(c.dictionary))
+	for i, s := range c.dictionary {
+		strings = append(strings, s...)
+		ends[i] = int32(len(strings))
+	}
+	var cStrings *C.char
+	if len(strings) > 0 {
+		cStrings = (*C.char)(unsafe.Pointer(&strings[0]))
+	}
+	var cEnds *C.int32_t
+	if len(ends) > 0 {
+		cEnds = (*C.int32_t)(unsafe.Pointer(&ends[0]))
+	}
+	return C.batch_add_dictionary(cBatch, cName, (*C.int32_t)(c.values), cStrings, cEnds, C.int(len(ends)))
+}
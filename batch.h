@@ -0,0 +1,44 @@
+#ifndef V8WORKER_BATCH_H_
+#define V8WORKER_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "v8.h"
+
+// Columns of a record batch on their way from Go to javascript. The values
+// of each column are copied once, into a buffer from the worker's ArrayBuffer
+// allocator, which is then handed to V8 as the backing store of a typed
+// array.
+struct batch_s {
+  struct Column {
+    std::string name;
+    // One of the BATCH_* types.
+    int type;
+    void* data;
+    size_t size;
+    // Strings indexed by the codes of a BATCH_DICTIONARY column.
+    std::vector<std::string> dictionary;
+  };
+
+  batch_s(v8::ArrayBuffer::Allocator* allocator, int length)
+      : allocator(allocator), length(length) {}
+  // Frees the buffers not released to V8.
+  ~batch_s();
+
+  // Copies length values. BATCH_INT64 values are converted to doubles.
+  // Returns false if out of memory.
+  bool Add(const char* name, int type, const void* values);
+
+  // Copies length int32 codes into count strings, stored back to back in
+  // strings and ending at the offsets in ends.
+  bool AddDictionary(const char* name, const int32_t* codes,
+                     const char* strings, const int32_t* ends, int count);
+
+  v8::ArrayBuffer::Allocator* allocator;
+  int length;
+  std::vector<Column> columns;
+};
+
+#endif  // V8WORKER_BATCH_H_
@@ -0,0 +1,299 @@
+package v8worker
+
+import (
+	"sort"
+	"sync"
+	"time"
+)
+
+// Number of recent message latencies the 99th percentile is taken from.
+const batcherLatencyWindow = 256
+
+// BatcherOptions configures a Batcher. Zero fields take the defaults.
+type BatcherOptions struct {
+	// Latency the 99th percentile of messages should stay under, from
+	// Batcher.Send until the $recv callback has handled them. Defaults to
+	// 10ms.
+	TargetP99 time.Duration
+	// Largest batch. Defaults to 256.
+	MaxBatch int
+	// Longest a message waits for others to join its batch. Defaults to a
+	// quarter of TargetP99.
+	MaxDelay time.Duration
+	// Most messages waiting to be sent. Send blocks while the queue is
+	// full. Defaults to 16 times MaxBatch.
+	MaxQueue int
+	// Called on the batcher's goroutine with each message whose $recv
+	// callback threw.
+	OnError func(msg string, err error)
+}
+
+// BatcherStats describes a Batcher. BatchSize and Delay are the current
+// parameters chosen by the batcher.
+type BatcherStats struct {
+	BatchSize int
+	Delay     time.Duration
+	// 99th percentile of the latency of recent messages.
+	P99 time.Duration
+	// Messages waiting to be sent.
+	QueueDepth int
+	Batches    int
+	Messages   int
+}
+
+// Batcher sends messages to a worker in batches with SendMessages, sizing
+// the batches to the load. Batches save entering the worker for each
+// message, but make messages wait for each other. The batcher grows its
+// batch size and flush delay while the worker is busy and the latency of
+// recent messages is well under the target, halves them when latency goes
+// over it, and drops the delay when the worker is mostly idle, as batching
+// only adds latency then.
+type Batcher struct {
+	w    *Worker
+	opts BatcherOptions
+
+	mu     sync.Mutex
+	queue  []batchedMessage
+	ready  chan struct{}
+	closed bool
+	done   chan struct{}
+	// Signalled when messages leave the queue or the batcher is closed.
+	space *sync.Cond
+
+	// Guarded by mu, updated after each batch.
+	size       int
+	delay      time.Duration
+	latencies  []time.Duration
+	next       int
+	perMessage time.Duration
+	lastBatch  time.Time
+	stats      BatcherStats
+}
+
+type batchedMessage struct {
+	msg string
+	at  time.Time
+}
+
+// NewBatcher creates a batcher sending to w, starting with batches of one
+// message and no delay.
+func NewBatcher(w *Worker, opts *BatcherOptions) *Batcher {
+	b := &Batcher{
+		w:     w,
+		ready: make(chan struct{}, 1),
+		done:  make(chan struct{}),
+		size:  1,
+	}
+	if opts != nil {
+		b.opts = *opts
+	}
+	if b.opts.TargetP99 <= 0 {
+		b.opts.TargetP99 = 10 * time.Millisecond
+	}
+	if b.opts.MaxBatch <= 0 {
+		b.opts.MaxBatch = 256
+	}
+	if b.opts.MaxDelay <= 0 {
+		b.opts.MaxDelay = b.opts.TargetP99 / 4
+	}
+	if b.opts.MaxQueue <= 0 {
+		b.opts.MaxQueue = 16 * b.opts.MaxBatch
+	}
+	b.space = sync.NewCond(&b.mu)
+	go b.run()
+	return b
+}
+
+// Send queues msg for the worker, waiting while MaxQueue messages are
+// queued. It returns false if the batcher is closed.
+func (b *Batcher) Send(msg string) bool {
+	b.mu.Lock()
+	for len(b.queue) >= b.opts.MaxQueue && !b.closed {
+		b.space.Wait()
+	}
+	if b.closed {
+		b.mu.Unlock()
+		return false
+	}
+	b.queue = append(b.queue, batchedMessage{msg, time.Now()})
+	b.mu.Unlock()
+	b.signal()
+	return true
+}
+
+// Close sends the messages still queued and stops the batcher.
+func (b *Batcher) Close() {
+	b.mu.Lock()
+	b.closed = true
+	b.space.Broadcast()
+	b.mu.Unlock()
+	b.signal()
+	<-b.done
+}
+
+// Stats returns the parameters chosen by the batcher and what it sent.
+func (b *Batcher) Stats() BatcherStats {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	stats := b.stats
+	stats.BatchSize = b.size
+	stats.Delay = b.delay
+	stats.QueueDepth = len(b.queue)
+	return stats
+}
+
+func (b *Batcher) signal() {
+	select {
+	case b.ready <- struct{}{}:
+	default:
+	}
+}
+
+func (b *Batcher) run() {
+	defer close(b.done)
+	for {
+		batch, depth, ok := b.take()
+		if !ok {
+			return
+		}
+		start := time.Now()
+		msgs := make([]string, len(batch))
+		for i, m := range batch {
+			msgs[i] = m.msg
+		}
+		b.send(msgs)
+		end := time.Now()
+		b.adjust(batch, depth, start, end)
+	}
+}
+
+// take waits for the next batch: size messages, or fewer once the first
+// has waited delay, within what SendMessages takes at once. It also returns
+// the queue depth before taking them. It returns false once the batcher is
+// closed and drained.
+func (b *Batcher) take() ([]batchedMessage, int, bool) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	for len(b.queue) == 0 {
+		if b.closed {
+			return nil, 0, false
+		}
+		b.mu.Unlock()
+		<-b.ready
+		b.mu.Lock()
+	}
+
+	deadline := b.queue[0].at.Add(b.delay)
+	for len(b.queue) < b.size && !b.closed {
+		wait := deadline.Sub(time.Now())
+		if wait <= 0 {
+			break
+		}
+		b.mu.Unlock()
+		timer := time.NewTimer(wait)
+		select {
+		case <-b.ready:
+		case <-timer.C:
+		}
+		timer.Stop()
+		b.mu.Lock()
+	}
+
+	depth := len(b.queue)
+	n, total := 0, 0
+	for n < b.size && n < depth {
+		// A message too large on its own is still taken, to fail alone.
+		if total += len(b.queue[n].msg); total > maxMessagesBytes && n > 0 {
+			break
+		}
+		n++
+	}
+	batch := b.queue[:n:n]
+	b.queue = b.queue[n:]
+	b.space.Broadcast()
+	return batch, depth, true
+}
+
+// send sends msgs, going on after the messages whose callback threw.
+func (b *Batcher) send(msgs []string) {
+	for len(msgs) > 0 {
+		sent, err := b.w.SendMessages(msgs)
+		if err == nil {
+			return
+		}
+		if b.opts.OnError != nil {
+			b.opts.OnError(msgs[sent], err)
+		}
+		msgs = msgs[sent+1:]
+	}
+}
+
+// adjust records the latencies of a batch sent from start to end and picks
+// the batch size and delay for the next ones.
+func (b *Batcher) adjust(batch []batchedMessage, depth int, start, end time.Time) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	for _, m := range batch {
+		if len(b.latencies) < batcherLatencyWindow {
+			b.latencies = append(b.latencies, end.Sub(m.at))
+		} else {
+			b.latencies[b.next] = end.Sub(m.at)
+			b.next = (b.next + 1) % batcherLatencyWindow
+		}
+	}
+	b.stats.Batches++
+	b.stats.Messages += len(batch)
+
+	perMessage := end.Sub(start) / time.Duration(len(batch))
+	if b.perMessage == 0 {
+		b.perMessage = perMessage
+	} else {
+		b.perMessage += (perMessage - b.perMessage) / 8
+	}
+	// Share of the time since the last batch the worker was busy.
+	busy := 1.0
+	if !b.lastBatch.IsZero() && start.After(b.lastBatch) {
+		busy = float64(end.Sub(start)) / float64(end.Sub(b.lastBatch))
+	}
+	b.lastBatch = end
+
+	sorted := append([]time.Duration(nil), b.latencies...)
+	sort.Sort(durations(sorted))
+	b.stats.P99 = sorted[len(sorted)*99/100]
+
+	target := b.opts.TargetP99
+	switch {
+	case b.stats.P99 > target:
+		b.size = (b.size + 1) / 2
+		b.delay /= 2
+	case busy < 0.5:
+		b.delay /= 2
+	case b.stats.P99 < target*3/4:
+		if depth > len(batch) || len(batch) == b.size {
+			b.size++
+		}
+		b.delay += target / 32
+	}
+
+	// A full batch should still fit in half the target once it has waited.
+	if b.delay > b.opts.MaxDelay {
+		b.delay = b.opts.MaxDelay
+	}
+	if b.perMessage > 0 {
+		if limit := int((target/2 - b.delay) / b.perMessage); b.size > limit {
+			b.size = limit
+		}
+	}
+	if b.size > b.opts.MaxBatch {
+		b.size = b.opts.MaxBatch
+	}
+	if b.size < 1 {
+		b.size = 1
+	}
+}
+
+type durations []time.Duration
+
+func (d durations) Len() int           { return len(d) }
+func (d durations) Swap(i, j int)      { d[i], d[j] = d[j], d[i] }
+func (d durations) Less(i, j int) bool { return d[i] < d[j] }
@@ -2,23 +2,76 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <vector>
 #include "v8.h"
 #include "libplatform/libplatform.h"
+#include "affinity.h"
+#include "allocator.h"
+#include "batch.h"
 #include "binding.h"
+#include "cache.h"
+#include "codec.h"
+#include "hash.h"
+#include "inflate.h"
+#include "intern.h"
+#include "io.h"
+#include "memo.h"
+#include "reaper.h"
+#include "stream.h"
+#include "value.h"
 
 using namespace v8;
 
-class ArrayBufferAllocator : public ArrayBuffer::Allocator {
- public:
-  virtual void* Allocate(size_t length) {
-    void* data = AllocateUninitialized(length);
-    return data == NULL ? data : memset(data, 0, length);
-  }
-  virtual void* AllocateUninitialized(size_t length) { return malloc(length); }
-  virtual void Free(void* data, size_t) { free(data); }
-};
+Platform* default_platform;
+
+// Workers waiting to be disposed. Beyond this many, worker_dispose disposes
+// inline.
+const size_t kReaperCapacity = 64;
+Reaper reaper(kReaperCapacity);
+
+// Threads reading files for $readFile, shared by all workers.
+const int kIoThreads = 4;
+IoPool io_pool(kIoThreads);
+
+// Registered with pthread_atfork by v8_init, so that the threads above can
+// be used in the child of a fork.
+void BeforeFork() {
+  reaper.BeforeFork();
+  io_pool.BeforeFork();
+}
+
+void AfterForkInParent() {
+  io_pool.AfterForkInParent();
+  reaper.AfterForkInParent();
+}
+
+void AfterForkInChild() {
+  io_pool.AfterForkInChild();
+  reaper.AfterForkInChild();
+}
+
+// Results of $recv calls of workers created with memoize, shared by all of
+// them.
+const size_t kMemoCapacity = 64 << 20;
+MemoCache memo(kMemoCapacity);
+
+// Entry points whose calls are memoized, part of the key.
+const int kMemoSend = 0;
+
+struct ProxyHandle;
+struct FileReads;
 
 struct worker_s {
   int id;
@@ -28,6 +81,64 @@ struct worker_s {
   Persistent<Function> recv;
   Persistent<Context> context;
   Persistent<Function> recv_sync_handler;
+  Persistent<ObjectTemplate> stream_template;
+  Persistent<Function> hibernation_save;
+  Persistent<Function> hibernation_restore;
+  Persistent<ObjectTemplate> proxy_template;
+  // Proxy objects not garbage collected yet.
+  std::set<ProxyHandle*> proxies;
+  KeyTable keys;
+  // Set once $readFile is enabled.
+  std::shared_ptr<FileReads> file_reads;
+  std::shared_ptr<StreamSet> streams;
+  // Hash of the sources loaded so far, part of the key of memoized calls.
+  uint64_t scripts_hash;
+  bool memoize;
+  // Set while a memoized call records the messages passed to $send.
+  bool recording;
+  bool recording_impure;
+  std::vector<std::string> recorded;
+  // Backs $cache if set.
+  cache* shared_cache;
+  // State of Math.random once reseeded by worker_after_fork.
+  uint64_t random_state[2];
+  // Thread CPU time spent in worker_load, the $recv and $recvSync callbacks
+  // and the callbacks of settled reads, read from other threads.
+  std::atomic<uint64_t> cpu_ns;
+};
+
+// A $readFile done on an I/O thread, whose promise is still to be settled.
+struct FileRead {
+  Persistent<Promise::Resolver>* pending;
+  bool ok;
+  // From the worker's allocator, NULL if no bytes were read.
+  void* data;
+  size_t length;
+  std::string error;
+};
+
+// Shared by a worker and the jobs of its $readFile calls, which outlive it
+// if it is disposed while they are queued.
+struct FileReads {
+  std::mutex mutex;
+  // NULL once the worker is being disposed.
+  worker* w;
+  // Reads holding on to w.
+  int active;
+  std::condition_variable idle;
+  // Reads done, settled by the next call into the worker.
+  std::vector<FileRead> done;
+  std::string root;
+  // Why every read fails, if root could not be resolved.
+  std::string root_error;
+};
+
+// Weak reference to a proxy object, which owns a reference to the Go value
+// registered as id until it is garbage collected.
+struct ProxyHandle {
+  worker* w;
+  int id;
+  Persistent<Object> object;
 };
 
 // Extracts a C string from a V8 Utf8Value.
@@ -94,11 +205,155 @@ std::string ExceptionString(Isolate* isolate, TryCatch* try_catch) {
   return out;
 }
 
+// Decompression target backed by a worker's ArrayBuffer allocator, so the
+// result can be handed to V8 as an ArrayBuffer or external string as is.
+class AllocatorInflateOutput : public InflateOutput {
+ public:
+  explicit AllocatorInflateOutput(ArrayBuffer::Allocator* allocator)
+      : allocator_(allocator) {}
+  virtual ~AllocatorInflateOutput() {
+    if (data != NULL) allocator_->Free(data, capacity);
+  }
+  virtual void* Allocate(size_t size) {
+    return allocator_->AllocateUninitialized(size);
+  }
+  virtual void Free(void* ptr, size_t size) { allocator_->Free(ptr, size); }
+
+ private:
+  ArrayBuffer::Allocator* allocator_;
+};
+
+// An ASCII string living outside the V8 heap in memory from a worker's
+// allocator. Used for large decompressed messages.
+class ExternalOneByteBuffer : public String::ExternalOneByteStringResource {
+ public:
+  ExternalOneByteBuffer(Isolate* isolate, ArrayBuffer::Allocator* allocator,
+                        char* data, size_t length, size_t capacity)
+      : isolate_(isolate), allocator_(allocator), data_(data),
+        length_(length), capacity_(capacity) {
+    isolate_->AdjustAmountOfExternalAllocatedMemory(capacity_);
+  }
+  virtual ~ExternalOneByteBuffer() {
+    isolate_->AdjustAmountOfExternalAllocatedMemory(-(int64_t)capacity_);
+    allocator_->Free(data_, capacity_);
+  }
+  virtual const char* data() const { return data_; }
+  virtual size_t length() const { return length_; }
+
+ private:
+  Isolate* isolate_;
+  ArrayBuffer::Allocator* allocator_;
+  char* data_;
+  size_t length_;
+  size_t capacity_;
+};
+
+// CPU time used by the calling thread.
+uint64_t ThreadCPUTime() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Adds the CPU time of the current thread until it goes out of scope to the
+// worker's account.
+class CPUTimer {
+ public:
+  explicit CPUTimer(worker* w) : w_(w), start_(ThreadCPUTime()) {}
+  ~CPUTimer() { w_->cpu_ns += ThreadCPUTime() - start_; }
+
+ private:
+  worker* w_;
+  uint64_t start_;
+};
+
+// Keeps the call being memoized, if any, out of the memo cache, as it
+// depends on more than its message. Called by the callbacks that read or
+// change state outside of the isolate.
+void MarkImpure(worker* w) {
+  w->recording_impure = true;
+}
+
+// Settles the promises of the reads done since the last call and runs the
+// callbacks waiting on them. The caller must hold the worker's locker and
+// have entered its context, so that javascript only ever runs on the thread
+// calling into the worker. Returns the number of reads settled.
+int SettleReads(worker* w) {
+  if (!w->file_reads) return 0;
+  std::vector<FileRead> done;
+  {
+    std::lock_guard<std::mutex> lock(w->file_reads->mutex);
+    done.swap(w->file_reads->done);
+  }
+  if (done.empty()) return 0;
+
+  // Their callbacks would be recorded as part of the current call.
+  MarkImpure(w);
+  // The callbacks are the worker's own work, like its $recv callback.
+  CPUTimer timer(w);
+  HandleScope handle_scope(w->isolate);
+  TryCatch try_catch;
+  for (size_t i = 0; i < done.size(); i++) {
+    FileRead& r = done[i];
+    Local<Promise::Resolver> resolver =
+        Local<Promise::Resolver>::New(w->isolate, *r.pending);
+    r.pending->Reset();
+    delete r.pending;
+    if (!r.ok) {
+      resolver->Reject(Exception::Error(String::NewFromUtf8(
+          w->isolate, r.error.data(), String::kNormalString,
+          (int)r.error.size())));
+    } else if (r.data == NULL) {
+      resolver->Resolve(ArrayBuffer::New(w->isolate, 0));
+    } else {
+      resolver->Resolve(ArrayBuffer::New(w->isolate, r.data, r.length,
+                                         ArrayBufferCreationMode::kInternalized));
+    }
+  }
+  // Outside of a call, nothing else runs the callbacks waiting on them.
+  w->isolate->RunMicrotasks();
+  return (int)done.size();
+}
+
+// Passes arg to the $recv callback. The caller must hold the worker's locker
+// and have entered its context.
+// non-zero return value indicates error. check worker_last_exception().
+int CallRecv(worker* w, Local<Context> context, Local<Value> arg) {
+  SettleReads(w);
+  TryCatch try_catch;
+
+  Local<Function> recv = Local<Function>::New(w->isolate, w->recv);
+  if (recv.IsEmpty()) {
+    w->last_exception = "$recv not called";
+    return 1;
+  }
+
+  Local<Value> args[1];
+  args[0] = arg;
+
+  {
+    CPUTimer timer(w);
+    recv->Call(context->Global(), 1, args);
+  }
+
+  if (try_catch.HasCaught()) {
+    w->last_exception = ExceptionString(w->isolate, &try_catch);
+    return 2;
+  }
+
+  return 0;
+}
+
 
 extern "C" {
 
 extern void recvCb(char*, int);
+extern void readsReadyCb(int);
 extern char* recvSyncCb(char*, int);
+extern void proxyGet(int, char*, int, int, proxy_value*);
+extern int proxyHas(int, char*, int, int);
+extern int proxyKeys(int, int, char**);
+extern void proxyRelease(int);
 
 const char* worker_version() {
   return V8::GetVersion();
@@ -108,10 +363,34 @@ const char* worker_last_exception(worker* w) {
   return w->last_exception.c_str();
 }
 
-int worker_load(worker* w, char* source_s, char* name_s, int line_offset_s, int column_offset_s, bool is_shared_cross_origin_s, int script_id_s, bool is_embedder_debug_script_s, char* source_map_url_s, bool is_opaque_s) {
+// Sources shorter than this are copied into each isolate, as sharing them
+// would save less than it costs to hash them.
+const size_t kMinInternedSourceLength = 1024;
+
+Local<String> SourceString(Isolate* isolate, const char* source) {
+  size_t length = strlen(source);
+  if (length >= kMinInternedSourceLength) {
+    InternedSource* resource = InternedSource::New(source, length);
+    Local<String> s;
+    if (resource != NULL) {
+      if (String::NewExternalOneByte(isolate, resource).ToLocal(&s)) return s;
+      delete resource;
+    }
+  }
+  return String::NewFromUtf8(isolate, source, String::kNormalString,
+                             (int)length);
+}
+
+// A code cache from an earlier load or from worker_produce_code_cache lets
+// V8 skip compiling the source. V8 rejects a cache that does not match the
+// source or itself, and compiles from scratch. cache may be NULL.
+int worker_load(worker* w, char* source_s, char* name_s, int line_offset_s, int column_offset_s, bool is_shared_cross_origin_s, int script_id_s, bool is_embedder_debug_script_s, char* source_map_url_s, bool is_opaque_s, code_cache* cache) {
+  w->scripts_hash = Xxh64(source_s, strlen(source_s), w->scripts_hash);
+
   Locker locker(w->isolate);
   Isolate::Scope isolate_scope(w->isolate);
   HandleScope handle_scope(w->isolate);
+  CPUTimer timer(w);
 
   Local<Context> context = Local<Context>::New(w->isolate, w->context);
   Context::Scope context_scope(context);
@@ -119,7 +398,7 @@ int worker_load(worker* w, char* source_s, char* name_s, int line_offset_s, int
   TryCatch try_catch;
 
   Local<String> name = String::NewFromUtf8(w->isolate, name_s);
-  Local<String> source = String::NewFromUtf8(w->isolate, source_s);
+  Local<String> source = SourceString(w->isolate, source_s);
   Local<Integer> line_offset = Integer::New(w->isolate, line_offset_s);
   Local<Integer> column_offset = Integer::New(w->isolate, column_offset_s);
   Local<Boolean> is_shared_cross_origin = Boolean::New(w->isolate, is_shared_cross_origin_s);
@@ -130,7 +409,30 @@ int worker_load(worker* w, char* source_s, char* name_s, int line_offset_s, int
 
   ScriptOrigin origin(name, line_offset, column_offset, is_shared_cross_origin, script_id, is_embedder_debug_script, source_map_url, is_opaque);
 
-  Local<Script> script = Script::Compile(source, &origin);
+  Local<Script> script;
+  if (cache != NULL && cache->length > 0) {
+    // The Source takes ownership of the CachedData, not of the buffer.
+    ScriptCompiler::CachedData* cached = new ScriptCompiler::CachedData(
+        static_cast<const uint8_t*>(cache->data), cache->length);
+    ScriptCompiler::Source compiler_source(source, origin, cached);
+    script = ScriptCompiler::Compile(w->isolate, &compiler_source,
+                                     ScriptCompiler::kConsumeCodeCache);
+    cache->rejected = cached->rejected;
+  } else if (cache != NULL && cache->produce) {
+    // The script run below is the one the cache is produced from, so it is
+    // compiled only once.
+    ScriptCompiler::Source compiler_source(source, origin);
+    script = ScriptCompiler::Compile(w->isolate, &compiler_source,
+                                     ScriptCompiler::kProduceCodeCache);
+    const ScriptCompiler::CachedData* cached = compiler_source.GetCachedData();
+    if (!script.IsEmpty() && cached != NULL && cached->length > 0) {
+      cache->produced = malloc(cached->length);
+      memcpy(cache->produced, cached->data, cached->length);
+      cache->produced_length = cached->length;
+    }
+  } else {
+    script = Script::Compile(source, &origin);
+  }
 
   if (script.IsEmpty()) {
     assert(try_catch.HasCaught());
@@ -149,15 +451,53 @@ int worker_load(worker* w, char* source_s, char* name_s, int line_offset_s, int
   return 0;
 }
 
+// Compiles source without running it and returns V8's code cache for it in
+// a malloc'd buffer, or NULL if V8 produced none.
+void* worker_produce_code_cache(worker* w, const char* source_s, const char* name_s, int* length) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  TryCatch try_catch;
+
+  ScriptOrigin origin(String::NewFromUtf8(w->isolate, name_s));
+  ScriptCompiler::Source compiler_source(
+      SourceString(w->isolate, source_s), origin);
+  Local<UnboundScript> script = ScriptCompiler::CompileUnbound(
+      w->isolate, &compiler_source, ScriptCompiler::kProduceCodeCache);
+
+  const ScriptCompiler::CachedData* cached = compiler_source.GetCachedData();
+  if (script.IsEmpty() || cached == NULL || cached->length <= 0) {
+    *length = 0;
+    return NULL;
+  }
+
+  void* out = malloc(cached->length);
+  memcpy(out, cached->data, cached->length);
+  *length = cached->length;
+  return out;
+}
+
 void worker_low_memory_notification(worker* w) {
   Locker locker(w->isolate);
   w->isolate->LowMemoryNotification();
 }
 
 bool worker_idle_notification_deadline(worker* w, double deadline_in_seconds) {
+  Locker locker(w->isolate);
   return w->isolate->IdleNotificationDeadline(deadline_in_seconds);
 }
 
+// Lets V8 collect garbage for up to idle_time_in_seconds from now.
+bool worker_idle_notification(worker* w, double idle_time_in_seconds) {
+  Locker locker(w->isolate);
+  double now = default_platform->MonotonicallyIncreasingTime();
+  return w->isolate->IdleNotificationDeadline(now + idle_time_in_seconds);
+}
+
 void Print(const FunctionCallbackInfo<Value>& args) {
   bool first = true;
   for (int i = 0; i < args.Length(); i++) {
@@ -210,6 +550,21 @@ void RecvSync(const FunctionCallbackInfo<Value>& args) {
   w->recv_sync_handler.Reset(isolate, func);
 }
 
+// Called from javascript as $hibernation(save, restore). save returns the
+// worker's state, which must survive JSON.stringify, and restore receives
+// it after the worker is rehydrated.
+void Hibernation(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  worker* w = (worker*)isolate->GetData(0);
+  assert(w->isolate == isolate);
+
+  HandleScope handle_scope(isolate);
+
+  assert(args[0]->IsFunction() && args[1]->IsFunction());
+  w->hibernation_save.Reset(isolate, Local<Function>::Cast(args[0]));
+  w->hibernation_restore.Reset(isolate, Local<Function>::Cast(args[1]));
+}
+
 // Called from javascript. Must route message to golang.
 void Send(const FunctionCallbackInfo<Value>& args) {
   std::string msg;
@@ -232,6 +587,7 @@ void Send(const FunctionCallbackInfo<Value>& args) {
     msg = ToCString(str);
   }
 
+  if (w->recording) w->recorded.push_back(msg);
   // XXX should we use Unlocker?
   recvCb((char*)msg.c_str(), w->id);
 }
@@ -258,15 +614,68 @@ void SendSync(const FunctionCallbackInfo<Value>& args) {
     String::Utf8Value str(v);
     msg = ToCString(str);
   }
+  MarkImpure(w);
   char *returnMsg = recvSyncCb((char*)msg.c_str(), w->id);
   Local<String> returnV = String::NewFromUtf8(w->isolate, returnMsg);
   args.GetReturnValue().Set(returnV);
   free(returnMsg);
 }
 
+int SendString(worker* w, const char* msg) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  return CallRecv(w, context, String::NewFromUtf8(w->isolate, msg));
+}
+
 // Called from golang. Must route message to javascript lang.
 // non-zero return value indicates error. check worker_last_exception().
+// Workers created with memoize replay the $send messages of an earlier call
+// with the same message to the same scripts, made by any such worker,
+// without entering the isolate. Calls that used $sendSync or failed are not
+// kept.
 int worker_send(worker* w, const char* msg) {
+  if (!w->memoize) return SendString(w, msg);
+
+  size_t length = strlen(msg);
+  std::vector<std::string> sends;
+  if (memo.Get(w->scripts_hash, kMemoSend, msg, length, &sends)) {
+    for (size_t i = 0; i < sends.size(); i++) {
+      recvCb((char*)sends[i].c_str(), w->id);
+    }
+    return 0;
+  }
+
+  w->recording = true;
+  w->recording_impure = false;
+  int r = SendString(w, msg);
+  w->recording = false;
+  if (r == 0 && !w->recording_impure) {
+    memo.Put(w->scripts_hash, kMemoSend, msg, length, w->recorded);
+  }
+  w->recorded.clear();
+  return r;
+}
+
+int worker_send_messages(worker* w, const char* data, const int32_t* ends, int count, int* sent) {
+  *sent = 0;
+  if (w->memoize) {
+    // Each message is looked up in the memo cache on its own.
+    int start = 0;
+    for (int i = 0; i < count; i++) {
+      std::string msg(data + start, ends[i] - start);
+      int r = worker_send(w, msg.c_str());
+      if (r != 0) return r;
+      start = ends[i];
+      (*sent)++;
+    }
+    return 0;
+  }
+
   Locker locker(w->isolate);
   Isolate::Scope isolate_scope(w->isolate);
   HandleScope handle_scope(w->isolate);
@@ -274,32 +683,197 @@ int worker_send(worker* w, const char* msg) {
   Local<Context> context = Local<Context>::New(w->isolate, w->context);
   Context::Scope context_scope(context);
 
-  TryCatch try_catch;
+  int start = 0;
+  for (int i = 0; i < count; i++) {
+    // Frees each message's handles before the next one.
+    HandleScope message_scope(w->isolate);
+    Local<String> msg = String::NewFromUtf8(
+        w->isolate, data + start, String::kNormalString, ends[i] - start);
+    int r = CallRecv(w, context, msg);
+    if (r != 0) return r;
+    start = ends[i];
+    (*sent)++;
+  }
+  return 0;
+}
 
-  Local<Function> recv = Local<Function>::New(w->isolate, w->recv);
-  if (recv.IsEmpty()) {
+// Called from golang. Decompresses a raw DEFLATE message straight into memory
+// owned by the worker and routes it to javascript: as an ArrayBuffer if
+// as_buffer is set, otherwise as a string. ASCII messages become external
+// strings so the decompressed bytes are never copied into the V8 heap.
+// size_hint is the uncompressed size if known, or 0. Messages decompressing
+// to more than max_length bytes are refused.
+// non-zero return value indicates error. check worker_last_exception().
+int worker_send_compressed(worker* w, const void* data, size_t length, size_t size_hint, size_t max_length, bool as_buffer) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  if (w->recv.IsEmpty()) {
     w->last_exception = "$recv not called";
     return 1;
   }
 
-  Local<Value> args[1];
-  args[0] = String::NewFromUtf8(w->isolate, msg);
+  AllocatorInflateOutput out(&w->allocator);
+  out.limit = max_length;
+  if (size_hint > max_length) {
+    w->last_exception = "decompressed message too large";
+    return 3;
+  }
+  if (size_hint > 0 && !out.ReserveExact(size_hint)) {
+    w->last_exception = "out of memory for decompressed message";
+    return 3;
+  }
+  int err = Inflate(static_cast<const unsigned char*>(data), length, &out);
+  if (err == kInflateTooLarge) {
+    w->last_exception = "decompressed message too large";
+    return 3;
+  } else if (err != 0) {
+    w->last_exception = "corrupt compressed message";
+    return 3;
+  }
 
-  assert(!try_catch.HasCaught());
+  Local<Value> msg;
+  if (out.length == 0) {
+    msg = as_buffer ? Local<Value>(ArrayBuffer::New(w->isolate, 0))
+                    : Local<Value>(String::Empty(w->isolate));
+  } else if (as_buffer) {
+    size_t n = out.length;
+    msg = ArrayBuffer::New(w->isolate, out.Release(), n,
+                           ArrayBufferCreationMode::kInternalized);
+  } else if (IsAsciiBytes(out.data, out.length)) {
+    size_t n = out.length;
+    size_t capacity = out.capacity;
+    ExternalOneByteBuffer* resource = new ExternalOneByteBuffer(
+        w->isolate, &w->allocator, reinterpret_cast<char*>(out.Release()), n,
+        capacity);
+    Local<String> str;
+    if (!String::NewExternalOneByte(w->isolate, resource).ToLocal(&str)) {
+      delete resource;
+    } else {
+      msg = str;
+    }
+  } else if (out.length <= String::kMaxLength) {
+    msg = String::NewFromUtf8(w->isolate, reinterpret_cast<char*>(out.data),
+                              String::kNormalString, (int)out.length);
+  }
 
-  recv->Call(context->Global(), 1, args);
+  if (msg.IsEmpty()) {
+    w->last_exception = "decompressed message too large";
+    return 3;
+  }
 
-  if (try_catch.HasCaught()) {
-    w->last_exception = ExceptionString(w->isolate, &try_catch);
-    return 2;
+  return CallRecv(w, context, msg);
+}
+
+// Returns the stream behind a stream object, or throws if it is no longer
+// readable because the $recv call it was passed to has returned.
+stream* UnwrapStream(const FunctionCallbackInfo<Value>& args) {
+  stream* s = static_cast<stream*>(
+      args.This()->GetAlignedPointerFromInternalField(0));
+  if (s == NULL) {
+    Isolate* isolate = args.GetIsolate();
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "stream is no longer readable")));
   }
+  return s;
+}
 
-  return 0;
+// Called from javascript as stream.read(). Blocks until the next chunk is
+// available and returns it as an ArrayBuffer, or null at the end of the stream.
+void StreamRead(const FunctionCallbackInfo<Value>& args) {
+  stream* s = UnwrapStream(args);
+  if (s == NULL) return;
+  MarkImpure(static_cast<worker*>(args.GetIsolate()->GetData(0)));
+
+  ChunkQueue::Chunk chunk;
+  if (!s->queue.Pop(&chunk)) {
+    args.GetReturnValue().SetNull();
+    return;
+  }
+  args.GetReturnValue().Set(ArrayBuffer::New(args.GetIsolate(), chunk.data,
+      chunk.length, ArrayBufferCreationMode::kInternalized));
 }
 
-// Called from golang. Must route message to javascript lang.
-// It will call the $recv_sync_handler callback function and return its string value.
-const char* worker_send_sync(worker* w, const char* msg) {
+// Called from javascript as stream.readString(). Like read() but decodes the
+// chunk as UTF-8. A multi-byte sequence split across chunks is held back
+// until the rest of it arrives.
+void StreamReadString(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  stream* s = UnwrapStream(args);
+  if (s == NULL) return;
+  MarkImpure(static_cast<worker*>(isolate->GetData(0)));
+
+  ChunkQueue::Chunk chunk;
+  if (!s->queue.Pop(&chunk)) {
+    if (s->carry.empty()) {
+      args.GetReturnValue().SetNull();
+    } else {
+      args.GetReturnValue().Set(String::NewFromUtf8(isolate, s->carry.data(),
+          String::kNormalString, (int)s->carry.size()));
+      s->carry.clear();
+    }
+    return;
+  }
+
+  std::string joined;
+  const char* data = static_cast<const char*>(chunk.data);
+  size_t length = chunk.length;
+  if (!s->carry.empty()) {
+    joined.swap(s->carry);
+    joined.append(data, length);
+    data = joined.data();
+    length = joined.size();
+  }
+
+  size_t complete = Utf8CompleteLength(data, length);
+  args.GetReturnValue().Set(String::NewFromUtf8(isolate, data,
+      String::kNormalString, (int)complete));
+  s->carry.assign(data + complete, length - complete);
+  s->queue.Free(chunk);
+}
+
+// Called from javascript as stream.next(), the iterator protocol, so streams
+// can be consumed with for-of.
+void StreamNext(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  stream* s = UnwrapStream(args);
+  if (s == NULL) return;
+  MarkImpure(static_cast<worker*>(isolate->GetData(0)));
+
+  Local<Object> result = Object::New(isolate);
+  ChunkQueue::Chunk chunk;
+  if (s->queue.Pop(&chunk)) {
+    result->Set(String::NewFromUtf8(isolate, "value"),
+                ArrayBuffer::New(isolate, chunk.data, chunk.length,
+                                 ArrayBufferCreationMode::kInternalized));
+    result->Set(String::NewFromUtf8(isolate, "done"), False(isolate));
+  } else {
+    result->Set(String::NewFromUtf8(isolate, "value"), Undefined(isolate));
+    result->Set(String::NewFromUtf8(isolate, "done"), True(isolate));
+  }
+  args.GetReturnValue().Set(result);
+}
+
+void StreamIterator(const FunctionCallbackInfo<Value>& args) {
+  args.GetReturnValue().Set(args.This());
+}
+
+stream* worker_stream_new(worker* w, size_t capacity) {
+  stream* s = new stream(&w->allocator, capacity, w->streams);
+  std::lock_guard<std::mutex> lock(w->streams->mutex);
+  w->streams->streams.insert(s);
+  return s;
+}
+
+// Called from golang. Passes a stream object to the $recv callback. The
+// stream is only readable until the callback returns; any chunks it did not
+// consume are dropped and further writes fail.
+// non-zero return value indicates error. check worker_last_exception().
+int worker_send_stream(worker* w, stream* s) {
   Locker locker(w->isolate);
   Isolate::Scope isolate_scope(w->isolate);
   HandleScope handle_scope(w->isolate);
@@ -307,92 +881,1225 @@ const char* worker_send_sync(worker* w, const char* msg) {
   Local<Context> context = Local<Context>::New(w->isolate, w->context);
   Context::Scope context_scope(context);
 
-  Local<Function> recv_sync_handler = Local<Function>::New(w->isolate, w->recv_sync_handler);
-  if (recv_sync_handler.IsEmpty()) {
-    return "err: $recvSync not called";
-  }
-
-  Local<Value> args[1];
-  args[0] = String::NewFromUtf8(w->isolate, msg);
-  Local<Value> response_value = recv_sync_handler->Call(context->Global(), 1, args);
+  Local<ObjectTemplate> stream_template =
+      Local<ObjectTemplate>::New(w->isolate, w->stream_template);
+  Local<Object> obj = stream_template->NewInstance();
+  obj->SetAlignedPointerInInternalField(0, s);
 
-  if (response_value->IsString()) {
-    String::Utf8Value response(response_value->ToString());
-    std::string out;
-    out.append(*response);
-    return out.c_str();
-  }
+  int r = CallRecv(w, context, obj);
 
-  return "err: non-string return value";
+  obj->SetAlignedPointerInInternalField(0, NULL);
+  s->queue.Cancel();
+  return r;
 }
 
-void v8_init() {
-  V8::InitializeICU();
-  Platform* platform = platform::CreateDefaultPlatform();
-  V8::InitializePlatform(platform);
-  V8::Initialize();
+void ProxyWeakCallback(const WeakCallbackInfo<ProxyHandle>& info) {
+  ProxyHandle* p = info.GetParameter();
+  p->object.Reset();
+  p->w->proxies.erase(p);
+  proxyRelease(p->id);
+  delete p;
 }
 
-worker* worker_new(int worker_id) {
-  worker* w = new(worker);
+// Wraps the Go value registered as id. The new object takes over a
+// reference to it.
+Local<Object> NewProxyObject(worker* w, int id, bool is_array) {
+  Isolate* isolate = w->isolate;
+  Local<ObjectTemplate> proxy_template =
+      Local<ObjectTemplate>::New(isolate, w->proxy_template);
+  Local<Object> obj = proxy_template->NewInstance();
+  obj->SetInternalField(0, Integer::New(isolate, id));
+  if (is_array) {
+    // Array methods only need length and indices, so they work as is.
+    Local<Object> array = isolate->GetCurrentContext()->Global()->Get(
+        String::NewFromUtf8(isolate, "Array"))->ToObject();
+    obj->SetPrototype(array->Get(String::NewFromUtf8(isolate, "prototype")));
+  }
 
-  Isolate::CreateParams create_params;
-  create_params.array_buffer_allocator = &w->allocator;
-  Isolate* isolate = Isolate::New(create_params);
-  Locker locker(isolate);
-  Isolate::Scope isolate_scope(isolate);
-  HandleScope handle_scope(isolate);
+  ProxyHandle* p = new ProxyHandle;
+  p->w = w;
+  p->id = id;
+  p->object.Reset(isolate, obj);
+  p->object.SetWeak(p, ProxyWeakCallback, WeakCallbackType::kParameter);
+  w->proxies.insert(p);
+  return obj;
+}
 
-  w->isolate = isolate;
-  w->isolate->SetCaptureStackTraceForUncaughtExceptions(true);
-  w->isolate->SetData(0, w);
-  w->id = worker_id;
+int ProxyId(Local<Object> holder) {
+  return holder->GetInternalField(0)->Int32Value();
+}
 
-  Local<ObjectTemplate> global = ObjectTemplate::New(w->isolate);
+// Converts a member fetched by proxyGet. Returns an empty handle if there is
+// no such member, so that the lookup goes on to the prototype.
+Local<Value> ProxyValue(worker* w, proxy_value* v) {
+  Isolate* isolate = w->isolate;
+  switch (v->kind) {
+    case PROXY_NULL:
+      return Null(isolate);
+    case PROXY_BOOL:
+      return Boolean::New(isolate, v->number != 0);
+    case PROXY_NUMBER:
+      return Number::New(isolate, v->number);
+    case PROXY_STRING: {
+      Local<String> str = String::NewFromUtf8(isolate, v->string,
+          String::kNormalString, v->length);
+      free(v->string);
+      return str;
+    }
+    case PROXY_OBJECT:
+    case PROXY_ARRAY:
+      return NewProxyObject(w, v->proxy, v->kind == PROXY_ARRAY);
+  }
+  return Local<Value>();
+}
 
-  global->Set(String::NewFromUtf8(w->isolate, "$print"),
-              FunctionTemplate::New(w->isolate, Print));
+// A missing key is passed as NULL, a missing index as -1.
+void ProxyGet(Isolate* isolate, Local<Object> holder, char* key, int key_length,
+              int index, ReturnValue<Value> result) {
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  MarkImpure(w);
+  proxy_value v;
+  memset(&v, 0, sizeof(v));
+  proxyGet(ProxyId(holder), key, key_length, index, &v);
+  Local<Value> value = ProxyValue(w, &v);
+  if (!value.IsEmpty()) result.Set(value);
+}
 
-  global->Set(String::NewFromUtf8(w->isolate, "$recv"),
-              FunctionTemplate::New(w->isolate, Recv));
+void ProxyQuery(Isolate* isolate, Local<Object> holder, char* key, int key_length,
+                int index, ReturnValue<Integer> result) {
+  MarkImpure(static_cast<worker*>(isolate->GetData(0)));
+  int r = proxyHas(ProxyId(holder), key, key_length, index);
+  if (r == 0) return;
+  int attributes = ReadOnly | DontDelete;
+  if (r == 2) attributes |= DontEnum;
+  result.Set(Integer::New(isolate, attributes));
+}
 
-  global->Set(String::NewFromUtf8(w->isolate, "$send"),
-              FunctionTemplate::New(w->isolate, Send));
+void ProxyEnumerate(Isolate* isolate, Local<Object> holder, bool indexed,
+                    ReturnValue<Array> result) {
+  MarkImpure(static_cast<worker*>(isolate->GetData(0)));
+  char* names = NULL;
+  int n = proxyKeys(ProxyId(holder), indexed, &names);
+  Local<Array> keys = Array::New(isolate, n);
+  const char* name = names;
+  for (int i = 0; i < n; i++) {
+    if (indexed) {
+      keys->Set(i, Integer::New(isolate, i));
+    } else {
+      keys->Set(i, String::NewFromUtf8(isolate, name));
+      name += strlen(name) + 1;
+    }
+  }
+  free(names);
+  result.Set(keys);
+}
 
-  global->Set(String::NewFromUtf8(w->isolate, "$sendSync"),
-              FunctionTemplate::New(w->isolate, SendSync));
+void ProxyNamedGetter(Local<Name> property, const PropertyCallbackInfo<Value>& info) {
+  if (property->IsSymbol()) return;
+  String::Utf8Value key(property);
+  ProxyGet(info.GetIsolate(), info.Holder(), *key, key.length(), -1,
+           info.GetReturnValue());
+}
 
-  global->Set(String::NewFromUtf8(w->isolate, "$recvSync"),
-              FunctionTemplate::New(w->isolate, RecvSync));
+void ProxyNamedQuery(Local<Name> property, const PropertyCallbackInfo<Integer>& info) {
+  if (property->IsSymbol()) return;
+  String::Utf8Value key(property);
+  ProxyQuery(info.GetIsolate(), info.Holder(), *key, key.length(), -1,
+             info.GetReturnValue());
+}
 
-  Local<Context> context = Context::New(w->isolate, NULL, global);
-  w->context.Reset(w->isolate, context);
-  //context->Enter();
+void ProxyNamedEnumerator(const PropertyCallbackInfo<Array>& info) {
+  ProxyEnumerate(info.GetIsolate(), info.Holder(), false, info.GetReturnValue());
+}
 
-  return w;
+void ProxyIndexedGetter(uint32_t index, const PropertyCallbackInfo<Value>& info) {
+  if (index > INT_MAX) return;
+  ProxyGet(info.GetIsolate(), info.Holder(), NULL, 0, index,
+           info.GetReturnValue());
 }
 
-void worker_dispose(worker* w) {
-  w->isolate->Dispose();
-  delete(w);
+void ProxyIndexedQuery(uint32_t index, const PropertyCallbackInfo<Integer>& info) {
+  if (index > INT_MAX) return;
+  ProxyQuery(info.GetIsolate(), info.Holder(), NULL, 0, index,
+             info.GetReturnValue());
 }
 
-void worker_terminate_execution(worker* w) {
-  w->isolate->TerminateExecution();
+void ProxyIndexedEnumerator(const PropertyCallbackInfo<Array>& info) {
+  ProxyEnumerate(info.GetIsolate(), info.Holder(), true, info.GetReturnValue());
 }
 
-void worker_get_heap_statistics(worker* w, heap_statistics* hs) {
-  HeapStatistics heap_statistics;
-  w->isolate->GetHeapStatistics(&heap_statistics);
+// Called from golang. Passes the Go value registered as proxy_id to the $recv
+// callback. Its members are only fetched, and converted, when javascript
+// reads them; nested structs, maps and slices become proxies in turn.
+// non-zero return value indicates error. check worker_last_exception().
+int worker_send_proxy(worker* w, int proxy_id, bool is_array) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
 
-  hs->total_heap_size = heap_statistics.total_heap_size();
-  hs->total_heap_size_executable = heap_statistics.total_heap_size_executable();
-  hs->total_physical_size = heap_statistics.total_physical_size();
-  hs->total_available_size = heap_statistics.total_available_size();
-  hs->used_heap_size = heap_statistics.used_heap_size();
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  return CallRecv(w, context, NewProxyObject(w, proxy_id, is_array));
+}
+
+batch* worker_batch_new(worker* w, int length) {
+  return new batch(&w->allocator, length);
+}
+
+// Called from golang. Passes a record batch to the $recv callback as
+// {length, columns, dictionaries}: columns maps each column name to a typed
+// array over the column's buffer, and dictionaries maps the name of each
+// dictionary column to the array of strings its codes index. The buffers
+// are handed over to V8 without another copy.
+// non-zero return value indicates error. check worker_last_exception().
+int worker_send_batch(worker* w, batch* b) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  Isolate* isolate = w->isolate;
+  Local<Object> columns = Object::New(isolate);
+  Local<Object> dictionaries = Object::New(isolate);
+  for (size_t i = 0; i < b->columns.size(); i++) {
+    batch::Column& c = b->columns[i];
+    Local<ArrayBuffer> buffer = c.data == NULL
+        ? ArrayBuffer::New(isolate, 0)
+        : ArrayBuffer::New(isolate, c.data, c.size,
+                           ArrayBufferCreationMode::kInternalized);
+    c.data = NULL;
+
+    Local<String> name = String::NewFromUtf8(isolate, c.name.c_str());
+    if (c.type == BATCH_INT32 || c.type == BATCH_DICTIONARY) {
+      columns->Set(name, Int32Array::New(buffer, 0, b->length));
+    } else {
+      columns->Set(name, Float64Array::New(buffer, 0, b->length));
+    }
+
+    if (c.type == BATCH_DICTIONARY) {
+      Local<Array> strings = Array::New(isolate, c.dictionary.size());
+      for (size_t j = 0; j < c.dictionary.size(); j++) {
+        strings->Set(j, String::NewFromUtf8(isolate, c.dictionary[j].data(),
+            String::kNormalString, (int)c.dictionary[j].size()));
+      }
+      dictionaries->Set(name, strings);
+    }
+  }
+
+  Local<Object> obj = Object::New(isolate);
+  obj->Set(String::NewFromUtf8(isolate, "length"), Integer::New(isolate, b->length));
+  obj->Set(String::NewFromUtf8(isolate, "columns"), columns);
+  obj->Set(String::NewFromUtf8(isolate, "dictionaries"), dictionaries);
+  delete b;
+
+  return CallRecv(w, context, obj);
+}
+
+// Builds the value sent by worker_send_value and worker_send_sync_value.
+// The caller must hold the worker's locker and have entered its context.
+Local<Value> ReceiveValue(worker* w, const void* keys, size_t keys_length,
+                          const void* tape, size_t tape_length) {
+  if (!w->keys.Define(w->isolate, static_cast<const char*>(keys), keys_length)) {
+    w->last_exception = "malformed keys";
+    return Local<Value>();
+  }
+  return DecodeValue(w->isolate, &w->keys, static_cast<const char*>(tape),
+                     tape_length, &w->last_exception);
+}
+
+// Called from golang. Passes a value built straight from a Go value, see
+// value.go, to the $recv callback.
+// non-zero return value indicates error. check worker_last_exception().
+int worker_send_value(worker* w, const void* keys, size_t keys_length, const void* tape, size_t tape_length) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  Local<Value> value = ReceiveValue(w, keys, keys_length, tape, tape_length);
+  if (value.IsEmpty()) return 3;
+  return CallRecv(w, context, value);
+}
+
+// Called from golang. Like worker_send_value but calls the $recvSync
+// callback, and encodes what it returns in *result for value.go to read
+// back.
+// non-zero return value indicates error. check worker_last_exception().
+int worker_send_sync_value(worker* w, const void* keys, size_t keys_length, const void* tape, size_t tape_length, void** result, size_t* result_length) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  *result = NULL;
+  *result_length = 0;
+  // The keys are defined even if the value cannot be passed on, as value.go
+  // assumes.
+  Local<Value> args[1];
+  args[0] = ReceiveValue(w, keys, keys_length, tape, tape_length);
+  if (args[0].IsEmpty()) return 3;
+
+  Local<Function> recv_sync_handler = Local<Function>::New(w->isolate, w->recv_sync_handler);
+  if (recv_sync_handler.IsEmpty()) {
+    w->last_exception = "$recvSync not called";
+    return 1;
+  }
+
+  TryCatch try_catch;
+
+  std::string out;
+  SettleReads(w);
+  CPUTimer timer(w);
+  Local<Value> response = recv_sync_handler->Call(context->Global(), 1, args);
+  if (!try_catch.HasCaught()) {
+    w->last_exception.clear();
+    EncodeValue(w->isolate, response, &out, &w->last_exception);
+  }
+  if (try_catch.HasCaught()) {
+    w->last_exception = ExceptionString(w->isolate, &try_catch);
+    return 2;
+  }
+  if (!w->last_exception.empty()) return 3;
+
+  *result = malloc(out.size());
+  memcpy(*result, out.data(), out.size());
+  *result_length = out.size();
+  return 0;
+}
+
+// Called from golang. Must route message to javascript lang.
+// It will call the $recv_sync_handler callback function and return its string value.
+const char* worker_send_sync(worker* w, const char* msg) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  Local<Function> recv_sync_handler = Local<Function>::New(w->isolate, w->recv_sync_handler);
+  if (recv_sync_handler.IsEmpty()) {
+    return "err: $recvSync not called";
+  }
+
+  Local<Value> args[1];
+  args[0] = String::NewFromUtf8(w->isolate, msg);
+  SettleReads(w);
+  CPUTimer timer(w);
+  Local<Value> response_value = recv_sync_handler->Call(context->Global(), 1, args);
+
+  if (response_value->IsString()) {
+    String::Utf8Value response(response_value->ToString());
+    std::string out;
+    out.append(*response);
+    return out.c_str();
+  }
+
+  return "err: non-string return value";
+}
+
+// Calls the global JSON[method] with arg.
+Local<Value> CallJSON(Isolate* isolate, Local<Context> context, const char* method, Local<Value> arg) {
+  Local<Object> json = context->Global()->Get(
+      String::NewFromUtf8(isolate, "JSON"))->ToObject();
+  Local<Function> fn = Local<Function>::Cast(
+      json->Get(String::NewFromUtf8(isolate, method)));
+  Local<Value> args[1];
+  args[0] = arg;
+  return fn->Call(json, 1, args);
+}
+
+// Called from golang before hibernating. Stores the JSON of the state
+// returned by the $hibernation save callback in *state, malloc'd, or NULL if
+// the worker declared no state.
+// non-zero return value indicates error. check worker_last_exception().
+int worker_save_state(worker* w, char** state) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  *state = NULL;
+  Local<Function> save = Local<Function>::New(w->isolate, w->hibernation_save);
+  if (save.IsEmpty()) return 0;
+
+  TryCatch try_catch;
+
+  Local<Value> value = save->Call(context->Global(), 0, NULL);
+  if (!try_catch.HasCaught()) {
+    value = CallJSON(w->isolate, context, "stringify", value);
+  }
+  if (try_catch.HasCaught()) {
+    w->last_exception = ExceptionString(w->isolate, &try_catch);
+    return 2;
+  }
+
+  // JSON.stringify(undefined) is undefined.
+  if (value->IsString()) {
+    String::Utf8Value json(value);
+    *state = strdup(*json);
+  }
+  return 0;
+}
+
+// Called from golang after the scripts of a hibernated worker were loaded
+// again. Passes the parsed state to the $hibernation restore callback.
+// non-zero return value indicates error. check worker_last_exception().
+int worker_restore_state(worker* w, const char* state) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  Local<Function> restore = Local<Function>::New(w->isolate, w->hibernation_restore);
+  if (restore.IsEmpty()) {
+    w->last_exception = "$hibernation not called";
+    return 1;
+  }
+
+  TryCatch try_catch;
+
+  Local<Value> args[1];
+  args[0] = CallJSON(w->isolate, context, "parse",
+                     String::NewFromUtf8(w->isolate, state));
+  if (!try_catch.HasCaught()) {
+    restore->Call(context->Global(), 1, args);
+  }
+  if (try_catch.HasCaught()) {
+    w->last_exception = ExceptionString(w->isolate, &try_catch);
+    return 2;
+  }
+  return 0;
+}
+
+void ThrowTypeError(Isolate* isolate, const char* message) {
+  isolate->ThrowException(Exception::TypeError(
+      String::NewFromUtf8(isolate, message)));
+}
+
+void ThrowError(Isolate* isolate, const char* message) {
+  isolate->ThrowException(Exception::Error(
+      String::NewFromUtf8(isolate, message)));
+}
+
+// Points *data at the bytes of an ArrayBuffer or of a view of one. Throws
+// and returns false for anything else.
+bool GetBytes(Isolate* isolate, Local<Value> v, const uint8_t** data,
+              size_t* length) {
+  if (v->IsArrayBuffer()) {
+    ArrayBuffer::Contents contents = Local<ArrayBuffer>::Cast(v)->GetContents();
+    *data = static_cast<const uint8_t*>(contents.Data());
+    *length = contents.ByteLength();
+    return true;
+  }
+  if (v->IsArrayBufferView()) {
+    Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(v);
+    ArrayBuffer::Contents contents = view->Buffer()->GetContents();
+    *data = static_cast<const uint8_t*>(contents.Data()) + view->ByteOffset();
+    *length = view->ByteLength();
+    return true;
+  }
+  ThrowTypeError(isolate, "expected an ArrayBuffer or a view of one");
+  return false;
+}
+
+// Copies the Latin-1 characters of v into out. Throws and returns false if v
+// has any other character.
+bool GetOneByteString(Isolate* isolate, Local<Value> v, std::string* out) {
+  Local<String> str = v->ToString();
+  if (str.IsEmpty()) return false;
+  if (!str->ContainsOnlyOneByte()) {
+    ThrowError(isolate, "string contains characters outside of Latin-1");
+    return false;
+  }
+  out->resize(str->Length());
+  if (!out->empty()) {
+    str->WriteOneByte(reinterpret_cast<uint8_t*>(&(*out)[0]), 0, -1,
+                      String::NO_NULL_TERMINATION);
+  }
+  return true;
+}
+
+Local<String> OneByteString(Isolate* isolate, const void* data, size_t length) {
+  return String::NewFromOneByte(isolate, static_cast<const uint8_t*>(data),
+                                String::kNormalString, (int)length);
+}
+
+// Called from javascript as new TextEncoder().encode(string). Returns the
+// string in UTF-8 as a Uint8Array.
+void TextEncoderEncode(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  Local<String> str = args.Length() > 0 && !args[0]->IsUndefined()
+      ? args[0]->ToString() : String::Empty(isolate);
+  if (str.IsEmpty()) return;
+
+  int n = str->Utf8Length();
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, n);
+  if (n > 0) {
+    str->WriteUtf8(static_cast<char*>(buffer->GetContents().Data()), n, NULL,
+                   String::NO_NULL_TERMINATION | String::REPLACE_INVALID_UTF8);
+  }
+  args.GetReturnValue().Set(Uint8Array::New(buffer, 0, n));
+}
+
+// Called from javascript as new TextDecoder(label). Only UTF-8 is supported.
+void TextDecoderNew(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  if (!args.IsConstructCall()) {
+    ThrowTypeError(isolate, "TextDecoder must be called with new");
+    return;
+  }
+  if (args.Length() > 0 && !args[0]->IsUndefined()) {
+    String::Utf8Value label(args[0]);
+    if (strcasecmp(ToCString(label), "utf-8") != 0 &&
+        strcasecmp(ToCString(label), "utf8") != 0) {
+      isolate->ThrowException(Exception::RangeError(
+          String::NewFromUtf8(isolate, "unsupported encoding")));
+    }
+  }
+}
+
+// Called from javascript as new TextDecoder().decode(buffer). Decodes an
+// ArrayBuffer or a view of one from UTF-8, skipping a byte order mark and
+// replacing invalid sequences with U+FFFD. ASCII input skips UTF-8 decoding.
+void TextDecoderDecode(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  if (args.Length() == 0 || args[0]->IsUndefined()) {
+    args.GetReturnValue().Set(String::Empty(isolate));
+    return;
+  }
+  const uint8_t* data;
+  size_t length;
+  if (!GetBytes(isolate, args[0], &data, &length)) return;
+  if (length >= 3 && data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf) {
+    data += 3;
+    length -= 3;
+  }
+
+  Local<String> str;
+  if (length <= String::kMaxLength) {
+    str = IsAsciiBytes(data, length)
+        ? OneByteString(isolate, data, length)
+        : String::NewFromUtf8(isolate, reinterpret_cast<const char*>(data),
+                              String::kNormalString, (int)length);
+  }
+  if (str.IsEmpty()) {
+    isolate->ThrowException(Exception::RangeError(
+        String::NewFromUtf8(isolate, "input too large to decode")));
+    return;
+  }
+  args.GetReturnValue().Set(str);
+}
+
+// Called from javascript as atob(string). Decodes base64 into a string of
+// Latin-1 characters, one per byte.
+void Atob(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  std::string in;
+  if (!GetOneByteString(isolate, args[0], &in)) return;
+
+  std::string out(Base64DecodedMaxLength(in.size()), 0);
+  size_t n;
+  if (!Base64Decode(in.data(), in.size(), reinterpret_cast<uint8_t*>(&out[0]),
+                    &n, true)) {
+    ThrowError(isolate, "string is not correctly encoded");
+    return;
+  }
+  args.GetReturnValue().Set(OneByteString(isolate, out.data(), n));
+}
+
+// Called from javascript as btoa(string). Encodes a string of Latin-1
+// characters, one byte each, as base64.
+void Btoa(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  std::string in;
+  if (!GetOneByteString(isolate, args[0], &in)) return;
+
+  std::string out(Base64EncodedLength(in.size()), 0);
+  Base64Encode(reinterpret_cast<const uint8_t*>(in.data()), in.size(), &out[0]);
+  args.GetReturnValue().Set(OneByteString(isolate, out.data(), out.size()));
+}
+
+// Called from javascript as $base64.encode(buffer).
+void Base64EncodeBytes(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  const uint8_t* data;
+  size_t length;
+  if (!GetBytes(isolate, args[0], &data, &length)) return;
+
+  std::string out(Base64EncodedLength(length), 0);
+  Base64Encode(data, length, &out[0]);
+  args.GetReturnValue().Set(OneByteString(isolate, out.data(), out.size()));
+}
+
+// Called from javascript as $base64.decode(string). Padding is optional and
+// whitespace is not allowed. Returns a Uint8Array.
+void Base64DecodeBytes(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  std::string in;
+  if (!GetOneByteString(isolate, args[0], &in)) return;
+
+  Local<ArrayBuffer> buffer =
+      ArrayBuffer::New(isolate, Base64DecodedMaxLength(in.size()));
+  size_t n;
+  if (!Base64Decode(in.data(), in.size(),
+                    static_cast<uint8_t*>(buffer->GetContents().Data()), &n,
+                    false)) {
+    ThrowError(isolate, "string is not correctly encoded");
+    return;
+  }
+  args.GetReturnValue().Set(Uint8Array::New(buffer, 0, n));
+}
+
+// Called from javascript as $hex.encode(buffer).
+void HexEncodeBytes(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  const uint8_t* data;
+  size_t length;
+  if (!GetBytes(isolate, args[0], &data, &length)) return;
+
+  std::string out(length * 2, 0);
+  HexEncode(data, length, &out[0]);
+  args.GetReturnValue().Set(OneByteString(isolate, out.data(), out.size()));
+}
+
+// Called from javascript as $hex.decode(string). Returns a Uint8Array.
+void HexDecodeBytes(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  std::string in;
+  if (!GetOneByteString(isolate, args[0], &in)) return;
+
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, in.size() / 2);
+  if (!HexDecode(in.data(), in.size(),
+                 static_cast<uint8_t*>(buffer->GetContents().Data()))) {
+    ThrowError(isolate, "string is not correctly encoded");
+    return;
+  }
+  args.GetReturnValue().Set(Uint8Array::New(buffer, 0, in.size() / 2));
+}
+
+// Adds TextEncoder, TextDecoder, atob, btoa, $base64 and $hex to global.
+void AddCodecs(Isolate* isolate, Local<ObjectTemplate> global) {
+  Local<FunctionTemplate> encoder = FunctionTemplate::New(isolate);
+  encoder->SetClassName(String::NewFromUtf8(isolate, "TextEncoder"));
+  encoder->PrototypeTemplate()->Set(String::NewFromUtf8(isolate, "encoding"),
+                                    String::NewFromUtf8(isolate, "utf-8"));
+  encoder->PrototypeTemplate()->Set(String::NewFromUtf8(isolate, "encode"),
+                                    FunctionTemplate::New(isolate, TextEncoderEncode));
+  global->Set(String::NewFromUtf8(isolate, "TextEncoder"), encoder);
+
+  Local<FunctionTemplate> decoder = FunctionTemplate::New(isolate, TextDecoderNew);
+  decoder->SetClassName(String::NewFromUtf8(isolate, "TextDecoder"));
+  decoder->PrototypeTemplate()->Set(String::NewFromUtf8(isolate, "encoding"),
+                                    String::NewFromUtf8(isolate, "utf-8"));
+  decoder->PrototypeTemplate()->Set(String::NewFromUtf8(isolate, "decode"),
+                                    FunctionTemplate::New(isolate, TextDecoderDecode));
+  global->Set(String::NewFromUtf8(isolate, "TextDecoder"), decoder);
+
+  global->Set(String::NewFromUtf8(isolate, "atob"),
+              FunctionTemplate::New(isolate, Atob));
+
+  global->Set(String::NewFromUtf8(isolate, "btoa"),
+              FunctionTemplate::New(isolate, Btoa));
+
+  Local<ObjectTemplate> base64 = ObjectTemplate::New(isolate);
+  base64->Set(String::NewFromUtf8(isolate, "encode"),
+              FunctionTemplate::New(isolate, Base64EncodeBytes));
+  base64->Set(String::NewFromUtf8(isolate, "decode"),
+              FunctionTemplate::New(isolate, Base64DecodeBytes));
+  global->Set(String::NewFromUtf8(isolate, "$base64"), base64);
+
+  Local<ObjectTemplate> hex = ObjectTemplate::New(isolate);
+  hex->Set(String::NewFromUtf8(isolate, "encode"),
+           FunctionTemplate::New(isolate, HexEncodeBytes));
+  hex->Set(String::NewFromUtf8(isolate, "decode"),
+           FunctionTemplate::New(isolate, HexDecodeBytes));
+  global->Set(String::NewFromUtf8(isolate, "$hex"), hex);
+}
+
+// The bytes hashed by $hash: a string in UTF-8, or an ArrayBuffer or a view
+// of one in place. Short strings are converted on the stack.
+class HashInput {
+ public:
+  HashInput() : data(NULL), length(0) {}
+
+  // Throws and returns false if v is none of the above.
+  bool Init(Isolate* isolate, Local<Value> v) {
+    if (v->IsArrayBuffer() || v->IsArrayBufferView()) {
+      return GetBytes(isolate, v, &data, &length);
+    }
+    if (!v->IsString()) {
+      ThrowTypeError(isolate, "expected a string, an ArrayBuffer or a view of one");
+      return false;
+    }
+    Local<String> str = Local<String>::Cast(v);
+    length = str->Utf8Length();
+    char* buffer = stack_;
+    if (length > sizeof(stack_)) {
+      heap_.resize(length);
+      buffer = &heap_[0];
+    }
+    str->WriteUtf8(buffer, (int)length, NULL, String::NO_NULL_TERMINATION);
+    data = reinterpret_cast<const uint8_t*>(buffer);
+    return true;
+  }
+
+  const uint8_t* data;
+  size_t length;
+
+ private:
+  char stack_[256];
+  std::string heap_;
+};
+
+Local<String> HexString(Isolate* isolate, uint64_t v) {
+  char s[17];
+  snprintf(s, sizeof(s), "%016llx", (unsigned long long)v);
+  return OneByteString(isolate, s, 16);
+}
+
+// Called from javascript as $hash.xxh64(data, seed). Returns the hash as 16
+// hex digits, as V8 has no 64-bit integers.
+void HashXxh64(const FunctionCallbackInfo<Value>& args) {
+  HashInput in;
+  if (!in.Init(args.GetIsolate(), args[0])) return;
+  uint64_t seed = args.Length() > 1 ? (uint64_t)args[1]->IntegerValue() : 0;
+  args.GetReturnValue().Set(HexString(args.GetIsolate(),
+                                      Xxh64(in.data, in.length, seed)));
+}
+
+// Called from javascript as $hash.xxh3(data, seed). Like xxh64.
+void HashXxh3(const FunctionCallbackInfo<Value>& args) {
+  HashInput in;
+  if (!in.Init(args.GetIsolate(), args[0])) return;
+  uint64_t seed = args.Length() > 1 ? (uint64_t)args[1]->IntegerValue() : 0;
+  args.GetReturnValue().Set(HexString(args.GetIsolate(),
+                                      Xxh3(in.data, in.length, seed)));
+}
+
+// Called from javascript as $hash.sha256(data). Returns the digest as 64 hex
+// digits.
+void HashSha256(const FunctionCallbackInfo<Value>& args) {
+  HashInput in;
+  if (!in.Init(args.GetIsolate(), args[0])) return;
+  uint8_t digest[kSha256Length];
+  Sha256(in.data, in.length, digest);
+  char hex[kSha256Length * 2];
+  HexEncode(digest, kSha256Length, hex);
+  args.GetReturnValue().Set(OneByteString(args.GetIsolate(), hex, sizeof(hex)));
+}
+
+// Called from javascript as $hash.crc32c(data, crc). crc is the result for
+// the preceding data, if any. Returns an unsigned 32-bit integer.
+void HashCrc32c(const FunctionCallbackInfo<Value>& args) {
+  HashInput in;
+  if (!in.Init(args.GetIsolate(), args[0])) return;
+  uint32_t crc = args.Length() > 1 ? args[1]->Uint32Value() : 0;
+  args.GetReturnValue().Set(Crc32c(crc, in.data, in.length));
+}
+
+// Called from javascript as $readFile(path, {offset, length}). Returns a
+// promise of an ArrayBuffer with the bytes read, shorter than length at the
+// end of the file. path is relative to the worker's file root. The read
+// runs on an I/O thread, and the promise settles on the next call into the
+// worker, for which readsReadyCb tells Go.
+void ReadFile(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  MarkImpure(w);
+  Local<Promise::Resolver> resolver = Promise::Resolver::New(isolate);
+  args.GetReturnValue().Set(resolver->GetPromise());
+
+  if (!args[0]->IsString()) {
+    resolver->Reject(Exception::TypeError(
+        String::NewFromUtf8(isolate, "path must be a string")));
+    return;
+  }
+  int64_t offset = 0, length = 0;
+  bool to_end = true;
+  if (args.Length() > 1 && args[1]->IsObject()) {
+    Local<Object> options = args[1]->ToObject();
+    Local<Value> v = options->Get(String::NewFromUtf8(isolate, "offset"));
+    if (!v->IsUndefined()) offset = v->IntegerValue();
+    v = options->Get(String::NewFromUtf8(isolate, "length"));
+    if (!v->IsUndefined()) {
+      length = v->IntegerValue();
+      to_end = false;
+    }
+  }
+  if (offset < 0 || length < 0) {
+    resolver->Reject(Exception::RangeError(
+        String::NewFromUtf8(isolate, "offset and length must not be negative")));
+    return;
+  }
+
+  String::Utf8Value path_value(args[0]);
+  std::string path(*path_value, path_value.length());
+  std::shared_ptr<FileReads> reads = w->file_reads;
+  Persistent<Promise::Resolver>* pending =
+      new Persistent<Promise::Resolver>(isolate, resolver);
+  io_pool.Post([=] {
+    worker* w;
+    int worker_id;
+    {
+      std::lock_guard<std::mutex> lock(reads->mutex);
+      if (reads->w == NULL) {
+        // The isolate is gone, so the handle is not reset.
+        delete pending;
+        return;
+      }
+      // The worker is not disposed until active drops back to zero.
+      w = reads->w;
+      worker_id = w->id;
+      reads->active++;
+    }
+    FileRead r;
+    r.pending = pending;
+    r.error = reads->root_error;
+    r.ok = r.error.empty() &&
+        ReadFileUnder(reads->root, path, offset, length, to_end,
+                      &w->allocator, &r.data, &r.length, &r.error);
+    {
+      std::lock_guard<std::mutex> lock(reads->mutex);
+      reads->done.push_back(r);
+      if (--reads->active == 0) reads->idle.notify_all();
+    }
+    readsReadyCb(worker_id);
+  });
+}
+
+// An ASCII string from $cache, shared with the cache rather than copied
+// into the V8 heap.
+class CachedString : public String::ExternalOneByteStringResource {
+ public:
+  explicit CachedString(const std::shared_ptr<const std::string>& data)
+      : data_(data) {}
+
+  virtual const char* data() const { return data_->data(); }
+  virtual size_t length() const { return data_->size(); }
+
+ private:
+  std::shared_ptr<const std::string> data_;
+};
+
+// Shorter strings from $cache are copied, which is cheaper than an external
+// string.
+const size_t kMinCachedStringLength = 256;
+
+// Every $cache call goes through here. The cache is shared state, so calls
+// using it are not memoized.
+cache* UnwrapCache(const FunctionCallbackInfo<Value>& args) {
+  worker* w = static_cast<worker*>(args.GetIsolate()->GetData(0));
+  MarkImpure(w);
+  return w->shared_cache;
+}
+
+std::string CacheKey(Local<Value> v) {
+  String::Utf8Value key(v);
+  return std::string(*key ? *key : "", key.length());
+}
+
+// Called from javascript as $cache.get(key). Returns the string or
+// ArrayBuffer stored under key, or undefined.
+void CacheGet(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  cache_s::Value value;
+  if (!UnwrapCache(args)->Get(CacheKey(args[0]), &value)) return;
+
+  const std::string& data = *value.data;
+  if (!value.is_string) {
+    Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, data.size());
+    if (!data.empty()) memcpy(buffer->GetContents().Data(), data.data(), data.size());
+    args.GetReturnValue().Set(buffer);
+    return;
+  }
+  Local<String> str;
+  if (value.ascii && data.size() >= kMinCachedStringLength) {
+    CachedString* resource = new CachedString(value.data);
+    if (!String::NewExternalOneByte(isolate, resource).ToLocal(&str)) {
+      delete resource;
+      return;
+    }
+  } else if (value.ascii) {
+    str = OneByteString(isolate, data.data(), data.size());
+  } else {
+    str = String::NewFromUtf8(isolate, data.data(), String::kNormalString,
+                              (int)data.size());
+  }
+  args.GetReturnValue().Set(str);
+}
+
+// Called from javascript as $cache.set(key, value), where value is a string,
+// an ArrayBuffer or a view of one. Returns false if value does not fit in
+// the cache.
+void CacheSet(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  cache_s::Value value;
+  if (args[1]->IsString()) {
+    Local<String> str = Local<String>::Cast(args[1]);
+    std::string* data = new std::string(str->Utf8Length(), 0);
+    value.data.reset(data);
+    if (!data->empty()) {
+      str->WriteUtf8(&(*data)[0], (int)data->size(), NULL,
+                     String::NO_NULL_TERMINATION);
+    }
+    value.is_string = true;
+    value.ascii = IsAsciiBytes(
+        reinterpret_cast<const uint8_t*>(data->data()), data->size());
+  } else if (args[1]->IsArrayBuffer() || args[1]->IsArrayBufferView()) {
+    const uint8_t* bytes;
+    size_t length;
+    if (!GetBytes(isolate, args[1], &bytes, &length)) return;
+    value.data.reset(new std::string(reinterpret_cast<const char*>(bytes), length));
+    value.is_string = false;
+    value.ascii = false;
+  } else {
+    ThrowTypeError(isolate, "value must be a string, an ArrayBuffer or a view of one");
+    return;
+  }
+  args.GetReturnValue().Set(UnwrapCache(args)->Set(CacheKey(args[0]), value));
+}
+
+// Called from javascript as $cache.has(key).
+void CacheHas(const FunctionCallbackInfo<Value>& args) {
+  args.GetReturnValue().Set(UnwrapCache(args)->Has(CacheKey(args[0])));
+}
+
+// Called from javascript as $cache.delete(key). Returns whether key was
+// there.
+void CacheDelete(const FunctionCallbackInfo<Value>& args) {
+  args.GetReturnValue().Set(UnwrapCache(args)->Delete(CacheKey(args[0])));
+}
+
+// Called from javascript as $cache.clear().
+void CacheClear(const FunctionCallbackInfo<Value>& args) {
+  UnwrapCache(args)->Clear();
+}
+
+void v8_set_flags(const char* flags) {
+  V8::SetFlagsFromString(flags, strlen(flags));
+}
+
+void v8_init() {
+  pthread_atfork(BeforeFork, AfterForkInParent, AfterForkInChild);
+  V8::InitializeICU();
+  default_platform = platform::CreateDefaultPlatform();
+  V8::InitializePlatform(default_platform);
+  V8::Initialize();
+}
+
+worker* worker_new(int worker_id, const worker_options* options) {
+  worker* w = new(worker);
+  // A worker created on a thread placed on a NUMA node keeps its memory
+  // there. Its heap pages follow from first touch on that thread.
+  w->allocator.numa_node = CurrentThreadNumaNode();
+  w->allocator.huge_pages = options->huge_pages;
+  w->scripts_hash = 0;
+  w->memoize = options->memoize != 0;
+  w->recording = false;
+  w->recording_impure = false;
+  w->shared_cache = NULL;
+  w->cpu_ns = 0;
+  w->streams.reset(new StreamSet);
+
+  Isolate::CreateParams create_params;
+  create_params.array_buffer_allocator = &w->allocator;
+  if (options->max_old_space_size > 0) {
+    create_params.constraints.set_max_old_space_size(options->max_old_space_size);
+  }
+  Isolate* isolate = Isolate::New(create_params);
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  w->isolate = isolate;
+  w->isolate->SetCaptureStackTraceForUncaughtExceptions(true);
+  w->isolate->SetData(0, w);
+  w->id = worker_id;
+
+  Local<ObjectTemplate> global = ObjectTemplate::New(w->isolate);
+
+  global->Set(String::NewFromUtf8(w->isolate, "$print"),
+              FunctionTemplate::New(w->isolate, Print));
+
+  global->Set(String::NewFromUtf8(w->isolate, "$recv"),
+              FunctionTemplate::New(w->isolate, Recv));
+
+  global->Set(String::NewFromUtf8(w->isolate, "$send"),
+              FunctionTemplate::New(w->isolate, Send));
+
+  global->Set(String::NewFromUtf8(w->isolate, "$sendSync"),
+              FunctionTemplate::New(w->isolate, SendSync));
+
+  global->Set(String::NewFromUtf8(w->isolate, "$recvSync"),
+              FunctionTemplate::New(w->isolate, RecvSync));
+
+  global->Set(String::NewFromUtf8(w->isolate, "$hibernation"),
+              FunctionTemplate::New(w->isolate, Hibernation));
+
+  Local<ObjectTemplate> hash = ObjectTemplate::New(w->isolate);
+  hash->Set(String::NewFromUtf8(w->isolate, "xxh64"),
+            FunctionTemplate::New(w->isolate, HashXxh64));
+  hash->Set(String::NewFromUtf8(w->isolate, "xxh3"),
+            FunctionTemplate::New(w->isolate, HashXxh3));
+  hash->Set(String::NewFromUtf8(w->isolate, "sha256"),
+            FunctionTemplate::New(w->isolate, HashSha256));
+  hash->Set(String::NewFromUtf8(w->isolate, "crc32c"),
+            FunctionTemplate::New(w->isolate, HashCrc32c));
+  global->Set(String::NewFromUtf8(w->isolate, "$hash"), hash);
+
+  if (options->codecs) AddCodecs(w->isolate, global);
+
+  Local<ObjectTemplate> stream_template = ObjectTemplate::New(w->isolate);
+  stream_template->SetInternalFieldCount(1);
+
+  stream_template->Set(String::NewFromUtf8(w->isolate, "read"),
+                       FunctionTemplate::New(w->isolate, StreamRead));
+
+  stream_template->Set(String::NewFromUtf8(w->isolate, "readString"),
+                       FunctionTemplate::New(w->isolate, StreamReadString));
+
+  stream_template->Set(String::NewFromUtf8(w->isolate, "next"),
+                       FunctionTemplate::New(w->isolate, StreamNext));
+
+  stream_template->Set(Symbol::GetIterator(w->isolate),
+                       FunctionTemplate::New(w->isolate, StreamIterator));
+
+  w->stream_template.Reset(w->isolate, stream_template);
+
+  Local<ObjectTemplate> proxy_template = ObjectTemplate::New(w->isolate);
+  proxy_template->SetInternalFieldCount(1);
+  proxy_template->SetHandler(NamedPropertyHandlerConfiguration(
+      ProxyNamedGetter, NULL, ProxyNamedQuery, NULL, ProxyNamedEnumerator));
+  proxy_template->SetHandler(IndexedPropertyHandlerConfiguration(
+      ProxyIndexedGetter, NULL, ProxyIndexedQuery, NULL, ProxyIndexedEnumerator));
+
+  w->proxy_template.Reset(w->isolate, proxy_template);
+
+  Local<Context> context = Context::New(w->isolate, NULL, global);
+  w->context.Reset(w->isolate, context);
+  //context->Enter();
+
+  return w;
+}
+
+void DisposeWorker(worker* w) {
+  if (w->file_reads) {
+    // Reads in progress settle first; queued ones are dropped.
+    std::unique_lock<std::mutex> lock(w->file_reads->mutex);
+    w->file_reads->w = NULL;
+    w->file_reads->idle.wait(lock, [&] { return w->file_reads->active == 0; });
+    // Reads done but never settled. Their handles go with the isolate.
+    for (size_t i = 0; i < w->file_reads->done.size(); i++) {
+      FileRead& r = w->file_reads->done[i];
+      delete r.pending;
+      if (r.data != NULL) w->allocator.Free(r.data, r.length);
+    }
+    w->file_reads->done.clear();
+  }
+  {
+    // Streams may still be written to and released from Go, but their
+    // chunks come from the allocator going away below.
+    std::lock_guard<std::mutex> lock(w->streams->mutex);
+    for (std::set<stream*>::iterator it = w->streams->streams.begin();
+         it != w->streams->streams.end(); ++it) {
+      (*it)->queue.Detach();
+    }
+    w->streams->streams.clear();
+  }
+  w->isolate->Dispose();
+  if (w->shared_cache != NULL) w->shared_cache->Release();
+  // Weak callbacks do not run on dispose.
+  for (std::set<ProxyHandle*>::iterator it = w->proxies.begin();
+       it != w->proxies.end(); ++it) {
+    proxyRelease((*it)->id);
+    delete *it;
+  }
+  delete(w);
+}
+
+// Hands the worker to the reaper thread and returns immediately. The worker
+// must not be used by any thread anymore.
+void worker_dispose(worker* w) {
+  if (!reaper.Post([w] { DisposeWorker(w); })) {
+    DisposeWorker(w);
+  }
+}
+
+size_t worker_dispose_pending() {
+  return reaper.Pending();
+}
+
+// Math.random of a reseeded worker: xorshift128+, like V8's own.
+void MathRandom(const FunctionCallbackInfo<Value>& args) {
+  worker* w = static_cast<worker*>(args.GetIsolate()->GetData(0));
+  uint64_t s1 = w->random_state[0];
+  const uint64_t s0 = w->random_state[1];
+  w->random_state[0] = s0;
+  s1 ^= s1 << 23;
+  w->random_state[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+  uint64_t bits = (w->random_state[1] + s0) >> 11;
+  args.GetReturnValue().Set((double)bits / 9007199254740992.0);
+}
+
+int worker_after_fork(worker* w) {
+  if (w->file_reads) {
+    // An I/O thread of the parent may have held the mutex at fork, and the
+    // reads it counted in active never finish here. The old state is
+    // leaked rather than destroyed.
+    std::shared_ptr<FileReads> reads(new FileReads);
+    reads->w = w;
+    reads->active = 0;
+    reads->root = w->file_reads->root;
+    reads->root_error = w->file_reads->root_error;
+    new std::shared_ptr<FileReads>(w->file_reads);
+    w->file_reads = reads;
+  }
+
+  uint64_t seed[2] = {0, 0};
+  int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  bool ok = fd >= 0 && read(fd, seed, sizeof(seed)) == (ssize_t)sizeof(seed);
+  if (fd >= 0) close(fd);
+  if (!ok || (seed[0] == 0 && seed[1] == 0)) {
+    w->last_exception = "cannot read /dev/urandom";
+    return 1;
+  }
+  w->random_state[0] = seed[0];
+  w->random_state[1] = seed[1];
+
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  Local<Value> math = context->Global()->Get(String::NewFromUtf8(w->isolate, "Math"));
+  if (!math->IsObject()) {
+    w->last_exception = "Math is not an object";
+    return 1;
+  }
+  math->ToObject()->Set(String::NewFromUtf8(w->isolate, "random"),
+                        FunctionTemplate::New(w->isolate, MathRandom)->GetFunction());
+  return 0;
+}
+
+int worker_settle_reads(worker* w) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  return SettleReads(w);
+}
+
+int worker_enable_read_file(worker* w, const char* root) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  if (w->file_reads) {
+    w->last_exception = "$readFile already enabled";
+    return 1;
+  }
+  std::shared_ptr<FileReads> reads(new FileReads);
+  reads->w = w;
+  reads->active = 0;
+  ResolveFileRoot(root, &reads->root, &reads->root_error);
+  w->file_reads = reads;
+
+  context->Global()->Set(String::NewFromUtf8(w->isolate, "$readFile"),
+                         FunctionTemplate::New(w->isolate, ReadFile)->GetFunction());
+  return 0;
+}
+
+void worker_set_cache(worker* w, cache* c) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  c->Retain();
+  if (w->shared_cache != NULL) w->shared_cache->Release();
+  w->shared_cache = c;
+
+  Local<Object> obj = Object::New(w->isolate);
+  obj->Set(String::NewFromUtf8(w->isolate, "get"),
+           FunctionTemplate::New(w->isolate, CacheGet)->GetFunction());
+  obj->Set(String::NewFromUtf8(w->isolate, "set"),
+           FunctionTemplate::New(w->isolate, CacheSet)->GetFunction());
+  obj->Set(String::NewFromUtf8(w->isolate, "has"),
+           FunctionTemplate::New(w->isolate, CacheHas)->GetFunction());
+  obj->Set(String::NewFromUtf8(w->isolate, "delete"),
+           FunctionTemplate::New(w->isolate, CacheDelete)->GetFunction());
+  obj->Set(String::NewFromUtf8(w->isolate, "clear"),
+           FunctionTemplate::New(w->isolate, CacheClear)->GetFunction());
+  context->Global()->Set(String::NewFromUtf8(w->isolate, "$cache"), obj);
+}
+
+void memo_set_capacity(size_t bytes) {
+  memo.SetCapacity(bytes);
+}
+
+void memo_get_statistics(memo_statistics* ms) {
+  memo.GetStatistics(ms);
+}
+
+void interned_sources_get_statistics(size_t* sources, size_t* bytes) {
+  InternedSource::GetStatistics(sources, bytes);
+}
+
+uint64_t worker_cpu_time(worker* w) {
+  return w->cpu_ns;
+}
+
+void worker_set_id(worker* w, int worker_id) {
+  w->id = worker_id;
+}
+
+void worker_terminate_execution(worker* w) {
+  w->isolate->TerminateExecution();
+}
+
+void worker_get_heap_statistics(worker* w, heap_statistics* hs) {
+  Locker locker(w->isolate);
+  HeapStatistics heap_statistics;
+  w->isolate->GetHeapStatistics(&heap_statistics);
+
+  hs->total_heap_size = heap_statistics.total_heap_size();
+  hs->total_heap_size_executable = heap_statistics.total_heap_size_executable();
+  hs->total_physical_size = heap_statistics.total_physical_size();
+  hs->total_available_size = heap_statistics.total_available_size();
+  hs->used_heap_size = heap_statistics.used_heap_size();
   hs->heap_size_limit = heap_statistics.heap_size_limit();
   //hs->malloced_memory = heap_statistics.malloced_memory();
   hs->does_zap_garbage = heap_statistics.does_zap_garbage();
 }
 
+void worker_get_huge_page_statistics(worker* w, huge_page_statistics* hs) {
+  w->allocator.GetHugePageStatistics(hs);
+}
+
+void get_process_huge_page_statistics(huge_page_statistics* hs) {
+  ArrayBufferAllocator::GetProcessHugePageStatistics(hs);
+}
+
 }
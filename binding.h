@@ -1,8 +1,13 @@
+#ifndef V8WORKER_BINDING_H_
+#define V8WORKER_BINDING_H_
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct heap_statistics_s {
   int 	total_heap_size;
@@ -16,30 +21,260 @@ struct heap_statistics_s {
 };
 typedef struct heap_statistics_s heap_statistics;
 
+enum {
+  HUGE_PAGES_OFF = 0,
+  // 2 MB aligned buffers advised for transparent huge pages
+  HUGE_PAGES_TRANSPARENT = 1,
+  // hugetlb pages from the reserved pool, transparent if it runs out
+  HUGE_PAGES_EXPLICIT = 2,
+};
+
+struct huge_page_statistics_s {
+  size_t explicit_bytes;
+  size_t transparent_bytes;
+  size_t process_anon_huge_bytes;
+  size_t process_hugetlb_bytes;
+};
+typedef struct huge_page_statistics_s huge_page_statistics;
+
+struct worker_options_s {
+  int huge_pages;
+  // in MB, 0 for V8's default
+  int max_old_space_size;
+  // installs TextEncoder, TextDecoder, atob, btoa, $base64 and $hex
+  int codecs;
+  // see worker_send
+  int memoize;
+};
+typedef struct worker_options_s worker_options;
+
+// Code cache exchanged with worker_load.
+struct code_cache_s {
+  // consumed if length is positive
+  const void* data;
+  int length;
+  // set if V8 did not accept data and compiled the source
+  bool rejected;
+  // without data, asks for V8's code cache of the script, returned in
+  // produced, a malloc'd buffer left NULL if V8 made none
+  bool produce;
+  void* produced;
+  int produced_length;
+};
+typedef struct code_cache_s code_cache;
+
+struct memo_statistics_s {
+  size_t hits;
+  size_t misses;
+  size_t entries;
+  // including keys and bookkeeping
+  size_t bytes;
+  size_t capacity;
+};
+typedef struct memo_statistics_s memo_statistics;
+
+struct cache_statistics_s {
+  size_t hits;
+  size_t misses;
+  size_t entries;
+  // including keys and bookkeeping
+  size_t bytes;
+  size_t capacity;
+};
+typedef struct cache_statistics_s cache_statistics;
+
+// Kinds of proxy_value.
+enum {
+  PROXY_UNDEFINED = 0,
+  PROXY_NULL = 1,
+  PROXY_BOOL = 2,
+  PROXY_NUMBER = 3,
+  PROXY_STRING = 4,
+  // a Go struct or map, exposed as another proxy
+  PROXY_OBJECT = 5,
+  // a Go slice or array, exposed as another proxy with Array.prototype
+  PROXY_ARRAY = 6,
+};
+
+// A member of a Go value exposed to javascript, see worker_send_proxy.
+struct proxy_value_s {
+  int kind;
+  // PROXY_BOOL as 0 or 1, and PROXY_NUMBER
+  double number;
+  // PROXY_STRING in UTF-8, malloc'd and freed by the binding
+  char* string;
+  int length;
+  // PROXY_OBJECT and PROXY_ARRAY
+  int proxy;
+};
+typedef struct proxy_value_s proxy_value;
+
+// Tags of the value tape, see value.h.
+enum {
+  VALUE_UNDEFINED = 0,
+  VALUE_NULL = 1,
+  VALUE_TRUE = 2,
+  VALUE_FALSE = 3,
+  VALUE_NUMBER = 4,
+  VALUE_STRING = 5,
+  VALUE_BYTES = 6,
+  VALUE_ARRAY = 7,
+  // keys as ids defined in the key section
+  VALUE_OBJECT = 8,
+  // keys as strings
+  VALUE_MAP = 9,
+};
+
+// Column types of a record batch.
+enum {
+  // a Float64Array
+  BATCH_FLOAT64 = 0,
+  // a Float64Array too, see batch_add_column
+  BATCH_INT64 = 1,
+  // an Int32Array
+  BATCH_INT32 = 2,
+  // an Int32Array of codes into an array of strings
+  BATCH_DICTIONARY = 3,
+};
+
 struct worker_s;
 typedef struct worker_s worker;
 
+struct stream_s;
+typedef struct stream_s stream;
+
+struct batch_s;
+typedef struct batch_s batch;
+
+struct cache_s;
+typedef struct cache_s cache;
+
 const char* worker_version();
 
+// must be called before v8_init
+void v8_set_flags(const char* flags);
 void v8_init();
+// Fork handlers registered by v8_init reset the background threads of the
+// binding in the child of a fork.
 
-worker* worker_new(int worker_id);
+// Prepares a worker for the child of a fork. Math.random is replaced with a
+// generator seeded from the system, as the worker would otherwise return the
+// same numbers as its siblings; the string hash seed of the isolate cannot
+// be changed. $readFile calls pending at fork never settle.
+// returns nonzero on error
+// get error from worker_last_exception
+int worker_after_fork(worker* w);
+
+worker* worker_new(int worker_id, const worker_options* options);
+void worker_set_id(worker* w, int worker_id);
+
+// Installs $readFile, reading the files under root on a pool of I/O threads.
+// If root is not a directory every read fails with the reason.
+// returns nonzero on error
+// get error from worker_last_exception
+int worker_enable_read_file(worker* w, const char* root);
+// Settles the promises of the $readFile calls done since the last call into
+// the worker, running their callbacks. Calls passing messages to the worker
+// settle them first too. Returns the number of reads settled.
+int worker_settle_reads(worker* w);
 
 // returns nonzero on error
 // get error from worker_last_exception
-int worker_load(worker* w, char* source_s, char* name_s, int line_offset_s, int column_offset_s, bool is_shared_cross_origin_s, int script_id_s, bool is_embedder_debug_script_s, char* source_map_url_s, bool is_opaque_s);
+int worker_load(worker* w, char* source_s, char* name_s, int line_offset_s, int column_offset_s, bool is_shared_cross_origin_s, int script_id_s, bool is_embedder_debug_script_s, char* source_map_url_s, bool is_opaque_s, code_cache* cache);
+// returns a malloc'd buffer, or NULL
+void* worker_produce_code_cache(worker* w, const char* source_s, const char* name_s, int* length);
 
 const char* worker_last_exception(worker* w);
 
 int worker_send(worker* w, const char* msg);
+int worker_send_compressed(worker* w, const void* data, size_t length, size_t size_hint, size_t max_length, bool as_buffer);
 const char* worker_send_sync(worker* w, const char* msg);
 
+stream* worker_stream_new(worker* w, size_t capacity);
+int worker_send_stream(worker* w, stream* s);
+// returns nonzero once the reader has gone away
+int stream_write(stream* s, const void* data, size_t length);
+void stream_close(stream* s);
+void stream_release(stream* s);
+
+// Passes the Go value registered as proxy_id to the $recv callback as an
+// object whose members are fetched from Go when read. The object owns a
+// reference to proxy_id, dropped once it is garbage collected.
+// returns nonzero on error
+// get error from worker_last_exception
+int worker_send_proxy(worker* w, int proxy_id, bool is_array);
+
+batch* worker_batch_new(worker* w, int length);
+// copy length values, BATCH_INT64 ones converted to doubles
+// return nonzero when out of memory
+int batch_add_column(batch* b, const char* name, int type, const void* values);
+int batch_add_dictionary(batch* b, const char* name, const int32_t* codes, const char* strings, const int32_t* ends, int count);
+// frees the batch
+// returns nonzero on error
+// get error from worker_last_exception
+int worker_send_batch(worker* w, batch* b);
+// frees a batch that is not sent
+void batch_free(batch* b);
+
+// Pass count messages, stored back to back in data and ending at the
+// offsets in ends, to the $recv callback one after the other, entering the
+// worker once for all of them. Stops at the first error, with *sent set to
+// the number of messages handled before it.
+// returns nonzero on error
+// get error from worker_last_exception
+int worker_send_messages(worker* w, const char* data, const int32_t* ends, int count, int* sent);
+
+// Pass the value encoded in tape, after defining the keys in the key section
+// keys, to the $recv or $recvSync callback. worker_send_sync_value encodes
+// what the callback returns in *result, malloc'd.
+// return nonzero on error
+// get error from worker_last_exception
+int worker_send_value(worker* w, const void* keys, size_t keys_length, const void* tape, size_t tape_length);
+int worker_send_sync_value(worker* w, const void* keys, size_t keys_length, const void* tape, size_t tape_length, void** result, size_t* result_length);
+
+// return nonzero on error
+// get error from worker_last_exception
+int worker_save_state(worker* w, char** state);
+int worker_restore_state(worker* w, const char* state);
+
+// disposes on a background thread
 void worker_dispose(worker* w);
+size_t worker_dispose_pending();
+
+// An off-heap LRU cache of strings and bytes within capacity bytes, shared
+// by the workers it is set on. The caller holds the first reference.
+cache* cache_new(size_t capacity);
+// Drops a reference. The cache is freed once no worker uses it either.
+void cache_release(cache* c);
+void cache_get_statistics(cache* c, cache_statistics* cs);
+// Installs $cache backed by c. The worker holds a reference to c until it
+// is disposed.
+void worker_set_cache(worker* w, cache* c);
+
+// The cache of memoized calls is shared by the whole process.
+void memo_set_capacity(size_t bytes);
+void memo_get_statistics(memo_statistics* ms);
+// Sources loaded by workers are kept once per process. These are the
+// sources kept and their bytes.
+void interned_sources_get_statistics(size_t* sources, size_t* bytes);
 void worker_terminate_execution(worker* w);
 void worker_low_memory_notification(worker* w);
 bool worker_idle_notification_deadline(worker* w, double deadline_in_seconds);
+bool worker_idle_notification(worker* w, double idle_time_in_seconds);
 void worker_get_heap_statistics(worker* w, heap_statistics* hs);
+void worker_get_huge_page_statistics(worker* w, huge_page_statistics* hs);
+void get_process_huge_page_statistics(huge_page_statistics* hs);
+// Thread CPU time in nanoseconds spent loading scripts, in the $recv and
+// $recvSync callbacks and in the callbacks of settled $readFile promises.
+uint64_t worker_cpu_time(worker* w);
+
+int numa_node_count();
+int numa_node_of_cpu(int cpu);
+// returns nonzero on error
+int pin_thread_to_cpu(int cpu);
 
 #ifdef __cplusplus
 } // extern "C"
 #endif
+
+#endif  // V8WORKER_BINDING_H_
@@ -0,0 +1,100 @@
+#include "cache.h"
+
+cache_s::cache_s(size_t capacity)
+    : refs_(1), bytes_(0), capacity_(capacity), hits_(0), misses_(0) {}
+
+void cache_s::Retain() {
+  refs_++;
+}
+
+void cache_s::Release() {
+  if (--refs_ == 0) delete this;
+}
+
+bool cache_s::Get(const std::string& key, Value* value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it =
+      index_.find(key);
+  if (it == index_.end()) {
+    misses_++;
+    return false;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  *value = it->second->value;
+  hits_++;
+  return true;
+}
+
+bool cache_s::Set(const std::string& key, const Value& value) {
+  // Keys are stored twice, in the list and the index.
+  size_t bytes = sizeof(Entry) + 2 * key.size() + value.data->size();
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it =
+      index_.find(key);
+  if (it != index_.end()) Erase(it->second);
+  if (bytes > capacity_) return false;
+
+  Entry entry;
+  entry.key = key;
+  entry.value = value;
+  entry.bytes = bytes;
+  entries_.push_front(entry);
+  index_[key] = entries_.begin();
+  bytes_ += bytes;
+  Evict();
+  return true;
+}
+
+bool cache_s::Has(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.count(key) != 0;
+}
+
+bool cache_s::Delete(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it =
+      index_.find(key);
+  if (it == index_.end()) return false;
+  Erase(it->second);
+  return true;
+}
+
+void cache_s::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  index_.clear();
+  bytes_ = 0;
+}
+
+void cache_s::GetStatistics(cache_statistics* cs) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cs->hits = hits_;
+  cs->misses = misses_;
+  cs->entries = entries_.size();
+  cs->bytes = bytes_;
+  cs->capacity = capacity_;
+}
+
+void cache_s::Evict() {
+  while (bytes_ > capacity_ && !entries_.empty()) {
+    Erase(--entries_.end());
+  }
+}
+
+void cache_s::Erase(std::list<Entry>::iterator it) {
+  bytes_ -= it->bytes;
+  index_.erase(it->key);
+  entries_.erase(it);
+}
+
+cache* cache_new(size_t capacity) {
+  return new cache_s(capacity);
+}
+
+void cache_release(cache* c) {
+  c->Release();
+}
+
+void cache_get_statistics(cache* c, cache_statistics* cs) {
+  c->GetStatistics(cs);
+}
@@ -0,0 +1,57 @@
+package v8worker
+
+/*
+#include "binding.h"
+*/
+import "C"
+import "runtime"
+
+// Cache backs the $cache global of the workers it is set on through
+// Options.Cache. It is an LRU cache of strings and ArrayBuffers held outside
+// of the V8 heaps, within a byte budget, so that scripts can keep large
+// caches without slowing down garbage collection. The entries outlive the
+// workers using them: a recycled or restored worker finds them again, and
+// workers of the same tenant can share a Cache.
+//
+// In javascript, $cache.get(key) returns the string or ArrayBuffer stored
+// under key, or undefined; $cache.set(key, value) stores a string, an
+// ArrayBuffer or a view of one, and returns false if it is larger than the
+// whole cache; $cache.has, $cache.delete and $cache.clear work as for a Map.
+// ArrayBuffers are copied in and out; long ASCII strings are returned
+// without copying.
+type Cache struct {
+	cCache *C.cache
+}
+
+// CacheStats describes the state of a Cache.
+type CacheStats struct {
+	Hits    int
+	Misses  int
+	Entries int
+	// Bytes used, including keys and bookkeeping.
+	Bytes    int
+	Capacity int
+}
+
+// NewCache creates a cache keeping at most capacity bytes.
+func NewCache(capacity int) *Cache {
+	c := &Cache{cCache: C.cache_new(C.size_t(capacity))}
+	runtime.SetFinalizer(c, func(c *Cache) {
+		C.cache_release(c.cCache)
+	})
+	return c
+}
+
+// Stats returns the state of the cache.
+func (c *Cache) Stats() CacheStats {
+	var cs C.cache_statistics
+	C.cache_get_statistics(c.cCache, &cs)
+	runtime.KeepAlive(c)
+	return CacheStats{
+		Hits:     int(cs.hits),
+		Misses:   int(cs.misses),
+		Entries:  int(cs.entries),
+		Bytes:    int(cs.bytes),
+		Capacity: int(cs.capacity),
+	}
+}
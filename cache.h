@@ -0,0 +1,62 @@
+#ifndef V8WORKER_CACHE_H_
+#define V8WORKER_CACHE_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "binding.h"
+
+// LRU cache behind the $cache global, holding strings and bytes outside of
+// any V8 heap within a byte budget. It is reference counted so that it can
+// outlive the workers using it, and be shared by several of them.
+struct cache_s {
+  struct Value {
+    // A string in UTF-8, otherwise the bytes of an ArrayBuffer.
+    bool is_string;
+    bool ascii;
+    // Shared with the external strings made from it, so that replacing or
+    // evicting the entry does not free bytes javascript still uses.
+    std::shared_ptr<const std::string> data;
+  };
+
+  explicit cache_s(size_t capacity);
+
+  void Retain();
+  // Frees the cache with the last reference.
+  void Release();
+
+  bool Get(const std::string& key, Value* value);
+  // Returns false if the entry alone is larger than the capacity.
+  bool Set(const std::string& key, const Value& value);
+  bool Has(const std::string& key);
+  bool Delete(const std::string& key);
+  void Clear();
+
+  void GetStatistics(cache_statistics* cs);
+
+ private:
+  struct Entry {
+    std::string key;
+    Value value;
+    size_t bytes;
+  };
+
+  void Evict();
+  void Erase(std::list<Entry>::iterator it);
+
+  std::atomic<int> refs_;
+  std::mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  size_t bytes_;
+  size_t capacity_;
+  size_t hits_;
+  size_t misses_;
+};
+
+#endif  // V8WORKER_CACHE_H_
@@ -0,0 +1,393 @@
+// v8worker-host runs workers in a child process of a Go program, see
+// v8worker.StartHost. It is built from the same binding as the Go package
+// and talks to its parent over the shared memory rings in ipc.h:
+//
+//   v8worker-host [--zygote] SHM_PATH
+//
+// Requests are handled one at a time on the main thread, so a worker's
+// isolate is only ever used from there. A watchdog thread terminates
+// running scripts on request, since the main thread is busy running them.
+//
+// A zygote, see v8worker.StartZygote, also forks itself on request into a
+// host around one of its workers, loaded and warmed up beforehand. The
+// child shares the heap pages the worker does not modify with the zygote
+// and every other child. V8 runs with its background threads disabled in a
+// zygote, as threads do not survive fork.
+//
+// Each child reseeds Math.random, but keeps the string hash seed of the
+// zygote's isolate, which V8 fixes when the isolate is created. Scripts
+// that can guess the hashes of one child can guess those of all of them.
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "../../binding.h"
+#include "../../ipc.h"
+
+namespace {
+
+struct Message {
+  ipc_message header;
+  std::string payload;
+};
+
+// Flags that keep V8 from doing work on its platform threads.
+const char kZygoteFlags[] =
+    "--noconcurrent_recompilation --noconcurrent_osr "
+    "--noconcurrent_sweeping --noparallel_compaction --nomemory_reducer";
+
+ipc_shm* shm;
+std::map<uint32_t, worker*> workers;
+
+bool is_zygote;
+// The shared memory of each forked child, closed when it exits so that the
+// parent does not wait for it forever.
+std::mutex children_mutex;
+std::condition_variable children_added;
+std::map<pid_t, ipc_shm*> children;
+
+// Requests that arrived while a script waited in $sendSync, handled once it
+// returns.
+std::deque<Message> deferred;
+uint32_t sync_seq;
+
+// The worker running a script, for the watchdog.
+std::mutex running_mutex;
+worker* running;
+uint32_t running_id;
+
+class RunningScope {
+ public:
+  RunningScope(worker* w, uint32_t id) {
+    std::lock_guard<std::mutex> lock(running_mutex);
+    previous_ = running;
+    previous_id_ = running_id;
+    running = w;
+    running_id = id;
+  }
+  ~RunningScope() {
+    std::lock_guard<std::mutex> lock(running_mutex);
+    running = previous_;
+    running_id = previous_id_;
+  }
+
+ private:
+  worker* previous_;
+  uint32_t previous_id_;
+};
+
+bool Read(Message* m) {
+  char* payload = ipc_read(ipc_to_host(shm), &m->header);
+  if (payload == NULL) return false;
+  m->payload.assign(payload, m->header.length);
+  free(payload);
+  return true;
+}
+
+void Write(uint32_t kind, uint32_t worker_id, uint32_t seq, uint32_t status,
+           const std::string& payload) {
+  ipc_message m = {kind, worker_id, seq, status, payload.size()};
+  ipc_write(ipc_to_parent(shm), &m, payload.data());
+}
+
+void Reply(const Message& req, uint32_t status, const std::string& payload) {
+  Write(IPC_RESULT, req.header.worker_id, req.header.seq, status, payload);
+}
+
+ipc_shm* MapShm(const char* path) {
+  int fd = open(path, O_RDWR);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+  void* mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) return NULL;
+  ipc_shm* s = static_cast<ipc_shm*>(mem);
+  if (s->magic != IPC_MAGIC ||
+      ipc_shm_size(s->ring_capacity) > static_cast<size_t>(st.st_size)) {
+    munmap(mem, st.st_size);
+    return NULL;
+  }
+  return s;
+}
+
+void UnmapShm(ipc_shm* s) {
+  munmap(s, ipc_shm_size(s->ring_capacity));
+}
+
+void Watchdog() {
+  uint32_t seen = 0;
+  for (;;) {
+    uint32_t id;
+    seen = ipc_wait_terminate(shm, seen, &id);
+    std::lock_guard<std::mutex> lock(running_mutex);
+    if (running != NULL && running_id == id) {
+      worker_terminate_execution(running);
+    }
+  }
+}
+
+void ReapChildren() {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(children_mutex);
+      children_added.wait(lock, [] { return !children.empty(); });
+    }
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) continue;
+
+    std::lock_guard<std::mutex> lock(children_mutex);
+    std::map<pid_t, ipc_shm*>::iterator it = children.find(pid);
+    if (it != children.end()) {
+      ipc_close(ipc_to_host(it->second));
+      ipc_close(ipc_to_parent(it->second));
+      UnmapShm(it->second);
+      children.erase(it);
+    }
+  }
+}
+
+// Turns a freshly forked zygote into a host serving child_shm, with the
+// worker that was forked around renamed to worker_id.
+void BecomeHost(ipc_shm* child_shm, uint32_t template_id, uint32_t worker_id) {
+#ifdef __linux__
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+  for (std::map<pid_t, ipc_shm*>::iterator it = children.begin();
+       it != children.end(); ++it) {
+    UnmapShm(it->second);
+  }
+  children.clear();
+  UnmapShm(shm);
+  shm = child_shm;
+  is_zygote = false;
+  deferred.clear();
+
+  worker* w = workers[template_id];
+  workers.clear();
+  worker_set_id(w, worker_id);
+  workers[worker_id] = w;
+
+  if (worker_after_fork(w) != 0) {
+    fprintf(stderr, "v8worker-host: reseeding Math.random: %s\n",
+            worker_last_exception(w));
+    _exit(1);
+  }
+  std::thread(Watchdog).detach();
+}
+
+// Payload: worker id NUL shm path.
+void Fork(const Message& m) {
+  size_t split = m.payload.find('\0');
+  if (!is_zygote || split == std::string::npos) {
+    Reply(m, 1, "bad fork request");
+    return;
+  }
+  uint32_t worker_id = strtoul(m.payload.c_str(), NULL, 10);
+  std::string path = m.payload.substr(split + 1);
+  ipc_shm* child_shm = MapShm(path.c_str());
+  if (child_shm == NULL) {
+    Reply(m, 1, "cannot map " + path);
+    return;
+  }
+
+  // Held across fork so that the child is registered before the reaper
+  // can see it exit.
+  std::unique_lock<std::mutex> lock(children_mutex);
+  pid_t pid = fork();
+  if (pid == 0) {
+    lock.unlock();
+    BecomeHost(child_shm, m.header.worker_id, worker_id);
+    return;
+  }
+  if (pid < 0) {
+    lock.unlock();
+    UnmapShm(child_shm);
+    Reply(m, 1, strerror(errno));
+    return;
+  }
+  children[pid] = child_shm;
+  lock.unlock();
+  children_added.notify_one();
+  Reply(m, 0, std::to_string(pid));
+}
+
+void Dispatch(Message& m) {
+  uint32_t id = m.header.worker_id;
+  if (m.header.kind == IPC_NEW) {
+    worker_options options;
+    memset(&options, 0, sizeof(options));
+    memcpy(&options, m.payload.data(),
+           m.payload.size() < sizeof(options) ? m.payload.size() : sizeof(options));
+    workers[id] = worker_new(id, &options);
+    Reply(m, 0, "");
+    return;
+  }
+
+  std::map<uint32_t, worker*>::iterator it = workers.find(id);
+  if (it == workers.end()) {
+    if (m.header.seq != 0) Reply(m, 1, "no such worker");
+    return;
+  }
+  worker* w = it->second;
+
+  switch (m.header.kind) {
+    case IPC_LOAD: {
+      ipc_load origin;
+      size_t name_at = sizeof(origin);
+      size_t url_at = m.payload.find('\0', name_at);
+      size_t source_at = url_at == std::string::npos ? url_at : m.payload.find('\0', url_at + 1);
+      if (source_at == std::string::npos) {
+        Reply(m, 1, "bad load request");
+        break;
+      }
+      memcpy(&origin, m.payload.data(), sizeof(origin));
+      std::string name = m.payload.substr(name_at, url_at - name_at);
+      std::string url = m.payload.substr(url_at + 1, source_at - url_at - 1);
+      std::string source = m.payload.substr(source_at + 1);
+      RunningScope scope(w, id);
+      int r = worker_load(w, &source[0], &name[0], origin.line_offset,
+                          origin.column_offset, origin.is_shared_cross_origin != 0,
+                          origin.script_id, origin.is_embedder_debug_script != 0,
+                          &url[0], origin.is_opaque != 0, NULL);
+      Reply(m, r, r != 0 ? worker_last_exception(w) : "");
+      break;
+    }
+    case IPC_SEND: {
+      RunningScope scope(w, id);
+      int r = worker_send(w, m.payload.c_str());
+      Reply(m, r, r != 0 ? worker_last_exception(w) : "");
+      break;
+    }
+    case IPC_SEND_SYNC: {
+      RunningScope scope(w, id);
+      std::string response = worker_send_sync(w, m.payload.c_str());
+      Reply(m, 0, response);
+      break;
+    }
+    case IPC_DISPOSE:
+      workers.erase(it);
+      worker_dispose(w);
+      break;
+    case IPC_HEAP_STATISTICS: {
+      heap_statistics hs;
+      memset(&hs, 0, sizeof(hs));
+      worker_get_heap_statistics(w, &hs);
+      Reply(m, 0, std::string(reinterpret_cast<char*>(&hs), sizeof(hs)));
+      break;
+    }
+    case IPC_LOW_MEMORY:
+      worker_low_memory_notification(w);
+      Reply(m, 0, "");
+      break;
+    case IPC_FORK:
+      Fork(m);
+      break;
+    default:
+      Reply(m, 1, "unknown request");
+  }
+}
+
+}  // namespace
+
+extern "C" {
+
+void recvCb(char* msg, int worker_id) {
+  Write(IPC_RECV, worker_id, 0, 0, msg);
+}
+
+// Blocks the script until the parent answers. Requests arriving meanwhile
+// are deferred, as the worker they are for may be the one waiting.
+char* recvSyncCb(char* msg, int worker_id) {
+  uint32_t seq = ++sync_seq;
+  Write(IPC_RECV_SYNC, worker_id, seq, 0, msg);
+
+  Message m;
+  while (Read(&m)) {
+    if (m.header.kind == IPC_SYNC_RESPONSE && m.header.seq == seq) {
+      return strdup(m.payload.c_str());
+    }
+    deferred.push_back(m);
+  }
+  return strdup("err: parent gone");
+}
+
+// Go values cannot be proxied into another process, see Worker.NewProxy.
+void proxyGet(int proxy_id, char* key, int key_length, int index, proxy_value* out) {
+  out->kind = PROXY_UNDEFINED;
+}
+
+int proxyHas(int proxy_id, char* key, int key_length, int index) {
+  return 0;
+}
+
+int proxyKeys(int proxy_id, int indexed, char** names) {
+  *names = NULL;
+  return 0;
+}
+
+void proxyRelease(int proxy_id) {}
+
+// $readFile is not enabled in a host, see Options.FileRoot.
+void readsReadyCb(int worker_id) {}
+
+}
+
+int main(int argc, char** argv) {
+  is_zygote = argc == 3 && strcmp(argv[1], "--zygote") == 0;
+  if (argc != 2 && !is_zygote) {
+    fprintf(stderr, "usage: %s [--zygote] SHM_PATH\n", argv[0]);
+    return 2;
+  }
+  const char* path = argv[argc - 1];
+#ifdef __linux__
+  // Do not outlive the parent.
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+
+  shm = MapShm(path);
+  if (shm == NULL) {
+    fprintf(stderr, "%s: cannot map v8worker host shared memory\n", path);
+    return 1;
+  }
+
+  if (is_zygote) {
+    v8_set_flags(kZygoteFlags);
+    std::thread(ReapChildren).detach();
+  } else {
+    std::thread(Watchdog).detach();
+  }
+  v8_init();
+
+  Message m;
+  for (;;) {
+    if (!deferred.empty()) {
+      m = deferred.front();
+      deferred.pop_front();
+    } else if (!Read(&m)) {
+      break;
+    }
+    if (m.header.kind == IPC_EXIT) break;
+    Dispatch(m);
+  }
+  ipc_close(ipc_to_parent(shm));
+  return 0;
+}
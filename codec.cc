@@ -0,0 +1,263 @@
+#include <string.h>
+#include <string>
+#include "codec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define V8WORKER_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+namespace {
+
+const char kBase64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const char kHex[] = "0123456789abcdef";
+
+// Value of each base64 character, or kInvalid.
+const uint8_t kInvalid = 0xff;
+
+struct DecodeTables {
+  uint8_t base64[256];
+  uint8_t hex[256];
+
+  DecodeTables() {
+    memset(base64, kInvalid, sizeof(base64));
+    memset(hex, kInvalid, sizeof(hex));
+    for (int i = 0; i < 64; i++) base64[(uint8_t)kBase64[i]] = i;
+    for (int i = 0; i < 10; i++) hex['0' + i] = i;
+    for (int i = 0; i < 6; i++) hex['a' + i] = hex['A' + i] = 10 + i;
+  }
+};
+
+const DecodeTables tables;
+
+bool IsAsciiWhitespace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\f' || c == '\r';
+}
+
+#ifdef V8WORKER_SSSE3
+
+bool HasSsse3() {
+  static const bool has = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3") != 0;
+  }();
+  return has;
+}
+
+// The SSSE3 base64 codecs are the ones described by Wojciech Muła and Daniel
+// Lemire in "Faster Base64 Encoding and Decoding using AVX2 Instructions",
+// on 128-bit registers.
+
+// Encodes 12 bytes at a time while 16 can be loaded. Returns the number of
+// bytes encoded.
+__attribute__((target("ssse3")))
+size_t Base64EncodeSsse3(const uint8_t* in, size_t length, char* out) {
+  const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+  size_t i = 0;
+  for (; length - i >= 16; i += 12, out += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    // Spread each 3 bytes over 4 bytes of 6 bits.
+    v = _mm_shuffle_epi8(v, shuffle);
+    __m128i t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    v = _mm_or_si128(t1, t3);
+    // Map 0..63 to the alphabet by adding an offset per range.
+    __m128i index = _mm_subs_epu8(v, _mm_set1_epi8(51));
+    index = _mm_sub_epi8(index, _mm_cmpgt_epi8(v, _mm_set1_epi8(25)));
+    v = _mm_add_epi8(v, _mm_shuffle_epi8(lut, index));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+  }
+  return i;
+}
+
+// Decodes 16 characters at a time into 12 bytes. Stops at the first block
+// with anything but base64 characters, padding included. Returns the number
+// of characters decoded.
+__attribute__((target("ssse3")))
+size_t Base64DecodeSsse3(const char* in, size_t length, uint8_t* out) {
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  for (; length - i >= 16; i += 16, out += 12) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(v, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(v, mask_2f);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0) {
+      break;
+    }
+    __m128i roll = _mm_shuffle_epi8(
+        lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, mask_2f), hi_nibbles));
+    v = _mm_add_epi8(v, roll);
+    // Pack 4 values of 6 bits into 3 bytes.
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8(v, pack);
+    uint8_t block[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(block), v);
+    memcpy(out, block, 12);
+  }
+  return i;
+}
+
+// Encodes 16 bytes at a time. Returns the number of bytes encoded.
+__attribute__((target("ssse3")))
+size_t HexEncodeSsse3(const uint8_t* in, size_t length, char* out) {
+  const __m128i lut = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kHex));
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; length - i >= 16; i += 16, out += 32) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+  return i;
+}
+
+// Checks 16 bytes at a time. Returns the number of bytes checked, less than
+// length if one of them is not ASCII.
+__attribute__((target("ssse3")))
+size_t AsciiPrefixSsse3(const uint8_t* data, size_t length) {
+  size_t i = 0;
+  for (; length - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    if (_mm_movemask_epi8(v) != 0) break;
+  }
+  return i;
+}
+
+#endif  // V8WORKER_SSSE3
+
+bool DecodeBase64Strict(const char* in, size_t length, uint8_t* out,
+                        size_t* out_length) {
+  // Padding is optional, but must complete a group of 4 if present.
+  if (length % 4 == 0 && length > 0 && in[length - 1] == '=') {
+    length--;
+    if (in[length - 1] == '=') length--;
+  }
+  if (length % 4 == 1) return false;
+
+  size_t i = 0;
+  uint8_t* start = out;
+#ifdef V8WORKER_SSSE3
+  if (HasSsse3()) {
+    i = Base64DecodeSsse3(in, length, out);
+    out += i / 4 * 3;
+  }
+#endif
+
+  const uint8_t* t = tables.base64;
+  for (; i + 4 <= length; i += 4) {
+    uint8_t a = t[(uint8_t)in[i]], b = t[(uint8_t)in[i + 1]];
+    uint8_t c = t[(uint8_t)in[i + 2]], d = t[(uint8_t)in[i + 3]];
+    if (a == kInvalid || b == kInvalid || c == kInvalid || d == kInvalid) {
+      return false;
+    }
+    uint32_t n = a << 18 | b << 12 | c << 6 | d;
+    *out++ = n >> 16;
+    *out++ = n >> 8;
+    *out++ = n;
+  }
+  size_t rest = length - i;
+  if (rest > 0) {
+    uint8_t a = t[(uint8_t)in[i]], b = t[(uint8_t)in[i + 1]];
+    uint8_t c = rest == 3 ? t[(uint8_t)in[i + 2]] : 0;
+    if (a == kInvalid || b == kInvalid || c == kInvalid) return false;
+    uint32_t n = a << 18 | b << 12 | c << 6;
+    *out++ = n >> 16;
+    if (rest == 3) *out++ = n >> 8;
+  }
+  *out_length = out - start;
+  return true;
+}
+
+}  // namespace
+
+void Base64Encode(const uint8_t* in, size_t length, char* out) {
+  size_t i = 0;
+#ifdef V8WORKER_SSSE3
+  if (HasSsse3()) {
+    i = Base64EncodeSsse3(in, length, out);
+    out += i / 3 * 4;
+  }
+#endif
+  for (; i + 3 <= length; i += 3) {
+    uint32_t n = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+    *out++ = kBase64[n >> 18];
+    *out++ = kBase64[(n >> 12) & 63];
+    *out++ = kBase64[(n >> 6) & 63];
+    *out++ = kBase64[n & 63];
+  }
+  if (i < length) {
+    uint32_t n = in[i] << 16 | (i + 1 < length ? in[i + 1] << 8 : 0);
+    *out++ = kBase64[n >> 18];
+    *out++ = kBase64[(n >> 12) & 63];
+    *out++ = i + 1 < length ? kBase64[(n >> 6) & 63] : '=';
+    *out++ = '=';
+  }
+}
+
+bool Base64Decode(const char* in, size_t length, uint8_t* out,
+                  size_t* out_length, bool forgiving) {
+  if (forgiving) {
+    for (size_t i = 0; i < length; i++) {
+      if (!IsAsciiWhitespace(in[i])) continue;
+      std::string stripped;
+      stripped.reserve(length);
+      for (size_t j = 0; j < length; j++) {
+        if (!IsAsciiWhitespace(in[j])) stripped.push_back(in[j]);
+      }
+      return DecodeBase64Strict(stripped.data(), stripped.size(), out,
+                                out_length);
+    }
+  }
+  return DecodeBase64Strict(in, length, out, out_length);
+}
+
+void HexEncode(const uint8_t* in, size_t length, char* out) {
+  size_t i = 0;
+#ifdef V8WORKER_SSSE3
+  if (HasSsse3()) {
+    i = HexEncodeSsse3(in, length, out);
+    out += i * 2;
+  }
+#endif
+  for (; i < length; i++) {
+    *out++ = kHex[in[i] >> 4];
+    *out++ = kHex[in[i] & 15];
+  }
+}
+
+bool HexDecode(const char* in, size_t length, uint8_t* out) {
+  if (length % 2 != 0) return false;
+  const uint8_t* t = tables.hex;
+  for (size_t i = 0; i < length; i += 2) {
+    uint8_t hi = t[(uint8_t)in[i]], lo = t[(uint8_t)in[i + 1]];
+    if (hi == kInvalid || lo == kInvalid) return false;
+    *out++ = hi << 4 | lo;
+  }
+  return true;
+}
+
+bool IsAsciiBytes(const uint8_t* data, size_t length) {
+  size_t i = 0;
+#ifdef V8WORKER_SSSE3
+  if (HasSsse3()) i = AsciiPrefixSsse3(data, length);
+#endif
+  unsigned char acc = 0;
+  for (; i < length; i++) acc |= data[i];
+  return (acc & 0x80) == 0;
+}
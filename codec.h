@@ -0,0 +1,34 @@
+#ifndef V8WORKER_CODEC_H_
+#define V8WORKER_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte codecs behind the TextEncoder, TextDecoder, atob, btoa, $base64 and
+// $hex globals. Each has a scalar version and, on x86, an SSSE3 one picked
+// at run time when the CPU supports it.
+
+// Base64 with padding, as in RFC 4648.
+inline size_t Base64EncodedLength(size_t length) {
+  return (length + 2) / 3 * 4;
+}
+void Base64Encode(const uint8_t* in, size_t length, char* out);
+
+// Upper bound of the decoded length of length characters.
+inline size_t Base64DecodedMaxLength(size_t length) {
+  return (length + 3) / 4 * 3;
+}
+// Decodes base64 with or without padding. With forgiving set, ASCII
+// whitespace is skipped, as atob does. Returns false if in is not base64,
+// otherwise stores the decoded length in *out_length.
+bool Base64Decode(const char* in, size_t length, uint8_t* out,
+                  size_t* out_length, bool forgiving);
+
+// Lower case hex. Decoding accepts either case and fails on an odd length or
+// anything but hex digits.
+void HexEncode(const uint8_t* in, size_t length, char* out);
+bool HexDecode(const char* in, size_t length, uint8_t* out);
+
+bool IsAsciiBytes(const uint8_t* data, size_t length);
+
+#endif  // V8WORKER_CODEC_H_
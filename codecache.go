@@ -0,0 +1,224 @@
+package v8worker
+
+import (
+	"bytes"
+	"container/list"
+	"crypto/sha256"
+	"encoding/hex"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"sync"
+	"sync/atomic"
+)
+
+// CodeCache shares compiled scripts between workers. The first worker to
+// load a script compiles it and keeps V8's code cache for it; every other
+// worker loading the same source deserializes that instead of compiling it
+// again. Workers loading a script no one has compiled yet wait for the first
+// of them to compile it. A CodeCache with a directory also keeps the code
+// caches there, so they survive restarts. Set Options.CodeCache to use one;
+// a single CodeCache is typically shared by all workers of a process.
+//
+// Entries are keyed by the source and the V8 version. V8 checks a code cache
+// against its flags too, and compiles from scratch if it does not match; the
+// entry is then dropped and replaced by the next load.
+type CodeCache struct {
+	dir string
+	// Held while replacing or removing a file in dir, so that a rejected
+	// code cache is only removed if it is still the file there.
+	diskMu sync.Mutex
+
+	mu sync.Mutex
+	// Entries in memory, most recently used first, up to
+	// codeCacheMemoryLimit bytes.
+	entries map[string]*list.Element
+	lru     *list.List
+	bytes   int
+	// Closed once the load compiling the script of a key is done.
+	compiling map[string]chan struct{}
+
+	hits     int64
+	misses   int64
+	rejected int64
+}
+
+// Bytes of code caches a CodeCache keeps in memory. Least recently used ones
+// beyond it are dropped, and read again from disk if the cache has a
+// directory.
+const codeCacheMemoryLimit = 64 << 20
+
+type codeCacheEntry struct {
+	key  string
+	data []byte
+}
+
+// CodeCacheStats counts the loads served by a CodeCache.
+type CodeCacheStats struct {
+	// Scripts loaded from a code cache, from memory or disk.
+	Hits int64
+	// Scripts compiled from source.
+	Misses int64
+	// Code caches V8 rejected, also counted in Misses.
+	Rejected int64
+}
+
+// NewCodeCache creates a code cache kept in memory and, unless dir is empty,
+// in files in dir, which is created if needed.
+func NewCodeCache(dir string) (*CodeCache, error) {
+	if dir != "" {
+		if err := os.MkdirAll(dir, 0700); err != nil {
+			return nil, err
+		}
+	}
+	return &CodeCache{
+		dir:       dir,
+		entries:   make(map[string]*list.Element),
+		lru:       list.New(),
+		compiling: make(map[string]chan struct{}),
+	}, nil
+}
+
+// Stats returns the number of hits and misses so far.
+func (c *CodeCache) Stats() CodeCacheStats {
+	return CodeCacheStats{
+		Hits:     atomic.LoadInt64(&c.hits),
+		Misses:   atomic.LoadInt64(&c.misses),
+		Rejected: atomic.LoadInt64(&c.rejected),
+	}
+}
+
+func codeCacheKey(code string) string {
+	sum := sha256.Sum256([]byte(Version() + "\x00" + code))
+	return hex.EncodeToString(sum[:])
+}
+
+func (c *CodeCache) path(key string) string {
+	return filepath.Join(c.dir, key+".v8cache")
+}
+
+// acquire returns the code cache of key, from memory or disk. If there is
+// none, the first caller gets nil and true and must call release once it has
+// compiled the script; other callers wait for it meanwhile.
+func (c *CodeCache) acquire(key string) ([]byte, bool) {
+	for {
+		c.mu.Lock()
+		if e, ok := c.entries[key]; ok {
+			c.lru.MoveToFront(e)
+			data := e.Value.(*codeCacheEntry).data
+			c.mu.Unlock()
+			return data, false
+		}
+		if done, ok := c.compiling[key]; ok {
+			c.mu.Unlock()
+			<-done
+			continue
+		}
+		c.compiling[key] = make(chan struct{})
+		c.mu.Unlock()
+
+		if c.dir != "" {
+			if data, err := ioutil.ReadFile(c.path(key)); err == nil && len(data) > 0 {
+				c.release(key, data)
+				return data, false
+			}
+		}
+		return nil, true
+	}
+}
+
+// release ends the compilation of key, keeping data, its code cache, if not
+// nil.
+func (c *CodeCache) release(key string, data []byte) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	close(c.compiling[key])
+	delete(c.compiling, key)
+	if data == nil {
+		return
+	}
+	c.entries[key] = c.lru.PushFront(&codeCacheEntry{key, data})
+	c.bytes += len(data)
+	for c.bytes > codeCacheMemoryLimit && c.lru.Len() > 1 {
+		e := c.lru.Back()
+		c.drop(e)
+	}
+}
+
+// drop removes an entry from memory. Called with mu held.
+func (c *CodeCache) drop(e *list.Element) {
+	entry := c.lru.Remove(e).(*codeCacheEntry)
+	delete(c.entries, entry.key)
+	c.bytes -= len(entry.data)
+}
+
+// reject drops data, the code cache of key, from memory and disk unless it
+// was replaced meanwhile. Another process sharing dir may still replace the
+// file between the check and the removal; its next load then compiles again.
+func (c *CodeCache) reject(key string, data []byte) {
+	c.mu.Lock()
+	e, ok := c.entries[key]
+	if ok && &e.Value.(*codeCacheEntry).data[0] == &data[0] {
+		c.drop(e)
+	}
+	c.mu.Unlock()
+	if c.dir == "" {
+		return
+	}
+	c.diskMu.Lock()
+	defer c.diskMu.Unlock()
+	if onDisk, err := ioutil.ReadFile(c.path(key)); err == nil && bytes.Equal(onDisk, data) {
+		os.Remove(c.path(key))
+	}
+}
+
+// write keeps data, the code cache of key, on disk.
+func (c *CodeCache) write(key string, data []byte) {
+	if c.dir == "" {
+		return
+	}
+
+	// Written aside and renamed, so readers never see a partial file.
+	f, err := ioutil.TempFile(c.dir, key+".tmp")
+	if err != nil {
+		return
+	}
+	_, err = f.Write(data)
+	if closeErr := f.Close(); err == nil {
+		err = closeErr
+	}
+	if err == nil {
+		c.diskMu.Lock()
+		err = os.Rename(f.Name(), c.path(key))
+		c.diskMu.Unlock()
+	}
+	if err != nil {
+		os.Remove(f.Name())
+	}
+}
+
+// load loads code into w from its code cache if there is one. Otherwise it
+// compiles code, producing the code cache from that same compilation.
+func (c *CodeCache) load(w *Worker, origin *ScriptOrigin, code string) error {
+	key := codeCacheKey(code)
+	cache, compile := c.acquire(key)
+	if compile {
+		atomic.AddInt64(&c.misses, 1)
+		produced, _, err := w.loadCached(origin, code, nil, true)
+		c.release(key, produced)
+		if produced != nil {
+			c.write(key, produced)
+		}
+		return err
+	}
+
+	_, rejected, err := w.loadCached(origin, code, cache, false)
+	if rejected {
+		atomic.AddInt64(&c.misses, 1)
+		atomic.AddInt64(&c.rejected, 1)
+		c.reject(key, cache)
+	} else {
+		atomic.AddInt64(&c.hits, 1)
+	}
+	return err
+}
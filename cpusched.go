@@ -0,0 +1,205 @@
+package v8worker
+
+import (
+	"runtime"
+	"sync"
+	"time"
+)
+
+// CPUSchedulerOptions configures a CPUScheduler. Zero fields take the
+// defaults.
+type CPUSchedulerOptions struct {
+	// Length of the accounting periods. Defaults to 100ms.
+	Period time.Duration
+	// CPUs available to all tenants. Defaults to runtime.NumCPU().
+	CPUs int
+}
+
+// TenantOptions configures a Tenant.
+type TenantOptions struct {
+	// Weight of the tenant's fair share of the CPUs when they are all in
+	// use. Defaults to 1.
+	Shares float64
+	// CPU time the tenant may use per period, whether or not the CPUs are
+	// busy. Zero is unlimited.
+	Quota time.Duration
+}
+
+// TenantStats describes the CPU time of a tenant.
+type TenantStats struct {
+	// CPU time used by the tenant's calls.
+	CPUTime time.Duration
+	// Time calls waited because the tenant was over its quota or share, and
+	// the number of calls that waited.
+	Throttled     time.Duration
+	ThrottledRuns int
+}
+
+// CPUScheduler shares the CPUs of a process between tenants, each running
+// its own workers, so that a tenant with heavy $recv handlers cannot take
+// them all. The CPU time of every call is charged to its tenant from the
+// worker's CPUTime. Calls of a tenant over its quota for the current period
+// wait for the next one. Once the tenants together have used all the CPUs
+// in a period, calls of those over their fair share wait too, so tenants
+// under it keep running.
+type CPUScheduler struct {
+	period   time.Duration
+	capacity time.Duration
+
+	mu      sync.Mutex
+	start   time.Time
+	used    time.Duration
+	tenants map[string]*Tenant
+}
+
+// Tenant is an account of a CPUScheduler.
+type Tenant struct {
+	s    *CPUScheduler
+	name string
+
+	// Guarded by s.mu.
+	opts  TenantOptions
+	used  time.Duration
+	stats TenantStats
+}
+
+// NewCPUScheduler creates a scheduler.
+func NewCPUScheduler(opts *CPUSchedulerOptions) *CPUScheduler {
+	s := &CPUScheduler{
+		tenants: make(map[string]*Tenant),
+		start:   time.Now(),
+	}
+	if opts != nil {
+		s.period = opts.Period
+		s.capacity = time.Duration(opts.CPUs) * s.period
+	}
+	if s.period <= 0 {
+		s.period = 100 * time.Millisecond
+	}
+	if s.capacity <= 0 {
+		s.capacity = time.Duration(runtime.NumCPU()) * s.period
+	}
+	return s
+}
+
+// Tenant returns the tenant called name, created with opts if it does not
+// exist yet, and otherwise updated with them. A nil opts takes the defaults.
+func (s *CPUScheduler) Tenant(name string, opts *TenantOptions) *Tenant {
+	var o TenantOptions
+	if opts != nil {
+		o = *opts
+	}
+	if o.Shares <= 0 {
+		o.Shares = 1
+	}
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	t, ok := s.tenants[name]
+	if !ok {
+		t = &Tenant{s: s, name: name}
+		s.tenants[name] = t
+	}
+	t.opts = o
+	return t
+}
+
+// Remove forgets a tenant. Its calls are no longer limited.
+func (s *CPUScheduler) Remove(t *Tenant) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if s.tenants[t.name] == t {
+		delete(s.tenants, t.name)
+	}
+}
+
+// Name returns the name of the tenant.
+func (t *Tenant) Name() string {
+	return t.name
+}
+
+// Stats returns the CPU time used by the tenant so far and how long it was
+// throttled.
+func (t *Tenant) Stats() TenantStats {
+	t.s.mu.Lock()
+	defer t.s.mu.Unlock()
+	return t.stats
+}
+
+// Run calls fn with w, one of the tenant's workers, once the tenant is
+// within its quota and share, and charges the CPU time w used meanwhile to
+// the tenant. fn should pass messages to w, for example with Send.
+func (t *Tenant) Run(w *Worker, fn func(w *Worker)) {
+	s := t.s
+	var waited time.Time
+	s.mu.Lock()
+	for {
+		now := time.Now()
+		s.roll(now)
+		if !s.over(t) {
+			break
+		}
+		if waited.IsZero() {
+			waited = now
+		}
+		next := s.start.Add(s.period).Sub(now)
+		s.mu.Unlock()
+		time.Sleep(next)
+		s.mu.Lock()
+	}
+	if !waited.IsZero() {
+		t.stats.Throttled += time.Since(waited)
+		t.stats.ThrottledRuns++
+	}
+	s.mu.Unlock()
+
+	before := w.CPUTime()
+	fn(w)
+	used := w.CPUTime() - before
+	if used < 0 {
+		// fn hibernated and restored the worker, which restarts its count.
+		used = 0
+	}
+
+	s.mu.Lock()
+	s.roll(time.Now())
+	t.used += used
+	s.used += used
+	t.stats.CPUTime += used
+	s.mu.Unlock()
+}
+
+// roll starts a new period once the current one is over.
+func (s *CPUScheduler) roll(now time.Time) {
+	elapsed := now.Sub(s.start)
+	if elapsed < s.period {
+		return
+	}
+	s.start = s.start.Add(elapsed - elapsed%s.period)
+	s.used = 0
+	for _, t := range s.tenants {
+		t.used = 0
+	}
+}
+
+// over returns whether calls of t must wait for the next period.
+func (s *CPUScheduler) over(t *Tenant) bool {
+	if s.tenants[t.name] != t {
+		return false
+	}
+	if t.opts.Quota > 0 && t.used >= t.opts.Quota {
+		return true
+	}
+	if s.used < s.capacity {
+		return false
+	}
+	// Shares are split between the tenants active in this period.
+	shares := t.opts.Shares
+	for _, other := range s.tenants {
+		if other != t && other.used > 0 {
+			shares += other.opts.Shares
+		}
+	}
+	fair := time.Duration(float64(s.capacity) * t.opts.Shares / shares)
+	return t.used >= fair
+}
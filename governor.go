@@ -0,0 +1,426 @@
+package v8worker
+
+import (
+	"bufio"
+	"io/ioutil"
+	"os"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+)
+
+// PressureLevel is how close the process is to its memory limit.
+type PressureLevel int
+
+const (
+	PressureNone PressureLevel = iota
+	// PressureModerate gives idle workers time to collect garbage.
+	PressureModerate
+	// PressureHigh also forces full collections in the largest workers.
+	PressureHigh
+	// PressureCritical also lowers the heap limit of new workers.
+	PressureCritical
+)
+
+// GovernorOptions configures a Governor. Zero fields take the defaults.
+type GovernorOptions struct {
+	// How often usage is checked. Defaults to one second.
+	Interval time.Duration
+	// Fractions of the limit at which each pressure level starts. Default to
+	// 0.7, 0.8 and 0.9.
+	ModerateRatio float64
+	HighRatio     float64
+	CriticalRatio float64
+	// Heap limit in MB for new workers when there is no pressure. Zero
+	// leaves it to V8.
+	MaxHeapSizeMB int
+	// The heap limit is never lowered below this. Defaults to 16.
+	MinHeapSizeMB int
+	// Usage returns the memory used by the process and its limit in bytes.
+	// Defaults to the cgroup v2 memory.current and memory.max, falling back
+	// to the resident set size and the machine's memory.
+	Usage func() (current, limit int64)
+	// OverLimit, if set, is called at critical pressure for each worker
+	// whose heap is larger than the lowered heap limit, so that the caller
+	// can replace it, for example with WorkerGroup.Recycle. It is called on
+	// the governor's goroutine.
+	OverLimit func(w *Worker)
+}
+
+// GovernorStats counts what a Governor did.
+type GovernorStats struct {
+	Level               PressureLevel
+	Current             int64
+	Limit               int64
+	HeapLimitMB         int
+	IdleNotifications   int
+	LowMemoryNotices    int
+	HeapLimitReductions int
+}
+
+// Governor keeps a process with many workers under its container's memory
+// limit. Each worker grows its heap on its own, so the governor watches the
+// process usage and the workers' heaps and responds in steps as usage nears
+// the limit: first idle workers get time to collect garbage, then the
+// largest workers are forced to do full collections, and finally the heap
+// limit for new workers is lowered and workers over it are reported for
+// replacement. Disposed and hibernated workers are skipped until they are
+// removed.
+//
+// V8 cannot change the heap limit of a running isolate, so lowered limits
+// only apply to workers created with Options from ApplyOptions.
+type Governor struct {
+	opts GovernorOptions
+
+	mu          sync.Mutex
+	workers     map[*Worker]struct{}
+	heapLimitMB int
+	stats       GovernorStats
+	stop        chan struct{}
+	// Checks in a row at critical pressure, and the workers passed to
+	// OverLimit since it started.
+	criticalChecks int
+	reported       map[*Worker]struct{}
+}
+
+// Checks at critical pressure between two cuts of the heap limit, giving
+// the workers replaced after a cut time to come back smaller.
+const heapLimitCutInterval = 10
+
+// NewGovernor creates a governor. Call Start to run it in the background or
+// Check to run one step.
+func NewGovernor(opts *GovernorOptions) *Governor {
+	g := &Governor{workers: make(map[*Worker]struct{})}
+	if opts != nil {
+		g.opts = *opts
+	}
+	if g.opts.Interval <= 0 {
+		g.opts.Interval = time.Second
+	}
+	if g.opts.ModerateRatio <= 0 {
+		g.opts.ModerateRatio = 0.7
+	}
+	if g.opts.HighRatio <= 0 {
+		g.opts.HighRatio = 0.8
+	}
+	if g.opts.CriticalRatio <= 0 {
+		g.opts.CriticalRatio = 0.9
+	}
+	if g.opts.MinHeapSizeMB <= 0 {
+		g.opts.MinHeapSizeMB = 16
+	}
+	if g.opts.Usage == nil {
+		g.opts.Usage = processMemoryUsage
+	}
+	g.heapLimitMB = g.opts.MaxHeapSizeMB
+	return g
+}
+
+// Add puts a worker under the governor's watch.
+func (g *Governor) Add(w *Worker) {
+	g.mu.Lock()
+	g.workers[w] = struct{}{}
+	g.mu.Unlock()
+}
+
+// Remove stops watching a worker.
+func (g *Governor) Remove(w *Worker) {
+	g.mu.Lock()
+	delete(g.workers, w)
+	delete(g.reported, w)
+	g.mu.Unlock()
+}
+
+// HeapLimitMB returns the heap limit for new workers, 0 if unlimited.
+func (g *Governor) HeapLimitMB() int {
+	g.mu.Lock()
+	defer g.mu.Unlock()
+	return g.heapLimitMB
+}
+
+// ApplyOptions sets the heap limit of opts to the current limit and returns
+// it. A nil opts is allocated.
+func (g *Governor) ApplyOptions(opts *Options) *Options {
+	if opts == nil {
+		opts = new(Options)
+	}
+	opts.MaxHeapSizeMB = g.HeapLimitMB()
+	return opts
+}
+
+// Stats returns what the governor has done so far.
+func (g *Governor) Stats() GovernorStats {
+	g.mu.Lock()
+	defer g.mu.Unlock()
+	s := g.stats
+	s.HeapLimitMB = g.heapLimitMB
+	return s
+}
+
+// Start checks usage every Interval until Stop.
+func (g *Governor) Start() {
+	g.mu.Lock()
+	if g.stop != nil {
+		g.mu.Unlock()
+		return
+	}
+	stop := make(chan struct{})
+	g.stop = stop
+	g.mu.Unlock()
+
+	go func() {
+		ticker := time.NewTicker(g.opts.Interval)
+		defer ticker.Stop()
+		for {
+			select {
+			case <-ticker.C:
+				g.Check()
+			case <-stop:
+				return
+			}
+		}
+	}()
+}
+
+// Stop stops the background checks.
+func (g *Governor) Stop() {
+	g.mu.Lock()
+	if g.stop != nil {
+		close(g.stop)
+		g.stop = nil
+	}
+	g.mu.Unlock()
+}
+
+type governedWorker struct {
+	worker   *Worker
+	heapUsed int
+	idle     time.Duration
+}
+
+// Check measures usage once, responds to the pressure level and returns it.
+func (g *Governor) Check() PressureLevel {
+	current, limit := g.opts.Usage()
+	level := PressureNone
+	if limit > 0 {
+		switch ratio := float64(current) / float64(limit); {
+		case ratio >= g.opts.CriticalRatio:
+			level = PressureCritical
+		case ratio >= g.opts.HighRatio:
+			level = PressureHigh
+		case ratio >= g.opts.ModerateRatio:
+			level = PressureModerate
+		}
+	}
+
+	g.mu.Lock()
+	g.stats.Level = level
+	g.stats.Current = current
+	g.stats.Limit = limit
+	if level != PressureCritical {
+		g.criticalChecks = 0
+		g.reported = nil
+	}
+	workers := make([]governedWorker, 0, len(g.workers))
+	for w := range g.workers {
+		workers = append(workers, governedWorker{worker: w})
+	}
+	g.mu.Unlock()
+
+	if level == PressureNone {
+		g.relaxHeapLimit()
+		return level
+	}
+
+	// A worker busy on another thread blocks the governor until it is done,
+	// so only the workers acted on are touched beyond their heap size.
+	now := time.Now()
+	for i := range workers {
+		gw := &workers[i]
+		gw.heapUsed = gw.worker.GetHeapStatistics().UsedHeapSize
+		gw.idle = now.Sub(gw.worker.LastActive())
+	}
+	// Acting on a quarter of the workers per step spreads the pauses over
+	// several intervals.
+	n := (len(workers) + 3) / 4
+
+	// Idlest first: they will not notice the collection.
+	sort.Sort(byIdle(workers))
+	idle := 0
+	for i := 0; i < n; i++ {
+		if workers[i].idle < g.opts.Interval {
+			break
+		}
+		workers[i].worker.IdleNotification(g.opts.Interval / 10)
+		idle++
+	}
+
+	low := 0
+	if level >= PressureHigh {
+		// Largest first: they have the most to give back.
+		sort.Sort(byHeapUsed(workers))
+		for i := 0; i < n; i++ {
+			workers[i].worker.LowMemoryNotification()
+			low++
+		}
+	}
+
+	// The limit is cut once as critical pressure starts and again only if
+	// it lasts, and each worker over it is reported once, so that replacing
+	// workers can take effect before the next cut.
+	var over []*Worker
+	reduced := false
+	g.mu.Lock()
+	if level == PressureCritical {
+		if g.criticalChecks%heapLimitCutInterval == 0 {
+			g.lowerHeapLimit(workers)
+			reduced = true
+		}
+		g.criticalChecks++
+		if g.reported == nil {
+			g.reported = make(map[*Worker]struct{})
+		}
+		for _, gw := range workers {
+			if _, ok := g.reported[gw.worker]; !ok && gw.heapUsed > g.heapLimitMB<<20 {
+				g.reported[gw.worker] = struct{}{}
+				over = append(over, gw.worker)
+			}
+		}
+	}
+	g.stats.IdleNotifications += idle
+	g.stats.LowMemoryNotices += low
+	if reduced {
+		g.stats.HeapLimitReductions++
+	}
+	g.mu.Unlock()
+
+	if g.opts.OverLimit != nil {
+		for _, w := range over {
+			g.opts.OverLimit(w)
+		}
+	}
+	return level
+}
+
+// lowerHeapLimit cuts the heap limit for new workers by a quarter. Without a
+// limit yet, it starts from the largest heap in use. Called with mu held.
+func (g *Governor) lowerHeapLimit(workers []governedWorker) {
+	limitMB := g.heapLimitMB
+	if limitMB == 0 {
+		for _, gw := range workers {
+			if mb := gw.heapUsed >> 20; mb > limitMB {
+				limitMB = mb
+			}
+		}
+	}
+	limitMB -= limitMB / 4
+	if limitMB < g.opts.MinHeapSizeMB {
+		limitMB = g.opts.MinHeapSizeMB
+	}
+	g.heapLimitMB = limitMB
+}
+
+// relaxHeapLimit raises a lowered heap limit back towards MaxHeapSizeMB by
+// an eighth per check.
+func (g *Governor) relaxHeapLimit() {
+	g.mu.Lock()
+	defer g.mu.Unlock()
+	if g.heapLimitMB == g.opts.MaxHeapSizeMB {
+		return
+	}
+	limitMB := g.heapLimitMB + g.heapLimitMB/8 + 1
+	if g.opts.MaxHeapSizeMB > 0 && limitMB >= g.opts.MaxHeapSizeMB {
+		limitMB = g.opts.MaxHeapSizeMB
+	}
+	// Unlimited again once far above anything the heaps have needed.
+	if g.opts.MaxHeapSizeMB == 0 && limitMB > 1<<14 {
+		limitMB = 0
+	}
+	g.heapLimitMB = limitMB
+}
+
+type byIdle []governedWorker
+
+func (s byIdle) Len() int           { return len(s) }
+func (s byIdle) Swap(i, j int)      { s[i], s[j] = s[j], s[i] }
+func (s byIdle) Less(i, j int) bool { return s[i].idle > s[j].idle }
+
+type byHeapUsed []governedWorker
+
+func (s byHeapUsed) Len() int           { return len(s) }
+func (s byHeapUsed) Swap(i, j int)      { s[i], s[j] = s[j], s[i] }
+func (s byHeapUsed) Less(i, j int) bool { return s[i].heapUsed > s[j].heapUsed }
+
+// processMemoryUsage returns the memory usage and limit of the process's
+// cgroup v2, or its resident set size and the machine's memory outside of a
+// limited cgroup.
+func processMemoryUsage() (current, limit int64) {
+	if dir := cgroupDir(); dir != "" {
+		current = readInt(dir + "/memory.current")
+		limit = readInt(dir + "/memory.max")
+	}
+	if current == 0 {
+		current = residentSetSize()
+	}
+	if limit == 0 {
+		limit = meminfoTotal()
+	}
+	return current, limit
+}
+
+// cgroupDir returns the cgroup v2 directory of the process.
+func cgroupDir() string {
+	data, err := ioutil.ReadFile("/proc/self/cgroup")
+	if err != nil {
+		return ""
+	}
+	for _, line := range strings.Split(string(data), "\n") {
+		if strings.HasPrefix(line, "0::") {
+			return "/sys/fs/cgroup" + strings.TrimSuffix(line[3:], "/")
+		}
+	}
+	return ""
+}
+
+// readInt reads a file holding a single number. It returns 0 for "max" or on
+// error.
+func readInt(path string) int64 {
+	data, err := ioutil.ReadFile(path)
+	if err != nil {
+		return 0
+	}
+	n, _ := strconv.ParseInt(strings.TrimSpace(string(data)), 10, 64)
+	return n
+}
+
+func residentSetSize() int64 {
+	data, err := ioutil.ReadFile("/proc/self/statm")
+	if err != nil {
+		return 0
+	}
+	fields := strings.Fields(string(data))
+	if len(fields) < 2 {
+		return 0
+	}
+	pages, _ := strconv.ParseInt(fields[1], 10, 64)
+	return pages * int64(os.Getpagesize())
+}
+
+func meminfoTotal() int64 {
+	f, err := os.Open("/proc/meminfo")
+	if err != nil {
+		return 0
+	}
+	defer f.Close()
+	scanner := bufio.NewScanner(f)
+	for scanner.Scan() {
+		fields := strings.Fields(scanner.Text())
+		if len(fields) >= 2 && fields[0] == "MemTotal:" {
+			kb, _ := strconv.ParseInt(fields[1], 10, 64)
+			return kb << 10
+		}
+	}
+	return 0
+}
@@ -0,0 +1,714 @@
+package v8worker
+
+/*
+#include "binding.h"
+*/
+import "C"
+import (
+	"errors"
+	"hash/crc32"
+	"runtime"
+	"sort"
+	"strconv"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// Number of points each shard gets on the hash ring. More points spread keys
+// more evenly at the cost of a larger ring.
+const virtualNodesPerShard = 128
+
+// WorkerFactory creates and loads the worker for a shard of a WorkerGroup. It
+// is called on a locked OS thread pinned to the shard's CPU: the shard's own
+// thread, or for Reload a temporary thread that exits once the worker is
+// built. The shard's thread then runs the worker, so a factory must not
+// leave state the worker relies on in thread-local storage.
+type WorkerFactory func(shard int) (*Worker, error)
+
+// WorkerGroup runs one worker per shard, each on its own OS thread pinned to
+// a CPU core, and routes messages to shards by key with consistent hashing.
+// All messages for a key are handled by the same worker, so per-key state
+// stays hot in that worker and in that core's caches. Resizing the group only
+// moves the keys of the shards added or removed.
+//
+// Shards are spread round-robin over NUMA nodes. A worker created by the
+// factory allocates its heap and large array buffers on its shard's node.
+type WorkerGroup struct {
+	// Held by Resize and Reload, which both build workers without blocking
+	// messages to the current ones.
+	rebuild sync.Mutex
+
+	// Guards factory, generation and closed.
+	mu         sync.Mutex
+	factory    WorkerFactory
+	generation int
+	closed     bool
+
+	// The current *routing, read without locks by every message. Replaced
+	// as a whole, under mu, by Resize and Close.
+	routing atomic.Value
+}
+
+// routing maps keys to shards. Never modified once published.
+type routing struct {
+	shards map[int]*shard
+	ring   hashRing
+	closed bool
+}
+
+// ReloadStats describes a Reload.
+type ReloadStats struct {
+	// Generation of the new workers. The workers of NewWorkerGroup are the
+	// first generation.
+	Generation int
+	// Time to build and load the new workers, during which the old ones kept
+	// handling messages.
+	Build time.Duration
+	// Time to queue the switch to the new workers on every shard.
+	Switch time.Duration
+	// Time for the last of the old workers to handle the messages queued
+	// before the switch.
+	Drain time.Duration
+}
+
+// Priority orders the messages waiting for a shard of a WorkerGroup.
+// Messages of a higher priority are handled first, such as control messages
+// that should not wait behind bulk work. Lower priorities are still handled
+// at least once every starvationLimit+1 messages.
+//
+// Priorities only order the shard queues of a WorkerGroup. Worker.Send,
+// SendMessages and a Batcher run on the caller's goroutine or in arrival
+// order with no priority, so messages that must not wait behind others
+// should go through a WorkerGroup.
+type Priority int
+
+const (
+	PriorityLow    Priority = -1
+	PriorityNormal Priority = 0
+	PriorityHigh   Priority = 1
+)
+
+const numPriorities = 3
+
+// Number of messages a waiting lane lets the higher lanes go first.
+const starvationLimit = 8
+
+// Number of messages a shard queues, over all lanes, before callers of
+// DoWithPriority block. Producers cannot run ahead of a shard by more.
+const shardQueueCapacity = 64
+
+// A shard owns one worker and the pinned thread that runs it. The worker
+// only runs on that thread, though Reload builds its replacement on another
+// thread pinned to the same CPU before handing it over.
+type shard struct {
+	id     int
+	cpu    int
+	worker *Worker
+
+	mu sync.Mutex
+	// Signalled when a job is queued or the shard is stopped.
+	ready chan struct{}
+	// Holds a token for each job in the lanes, so that enqueue blocks once
+	// shardQueueCapacity are waiting. Barriers are not counted.
+	slots chan struct{}
+	// One lane per priority, highest first, and the barriers, each in the
+	// order they were queued.
+	lanes    [numPriorities][]job
+	barriers []job
+	// Times each lane was passed over for a higher one while not empty.
+	skipped [numPriorities]int
+	seq     uint64
+	stopped bool
+}
+
+type job struct {
+	seq uint64
+	fn  func()
+}
+
+type hashRing struct {
+	points []uint32
+	owners []int
+}
+
+// NewWorkerGroup creates a group of size shards, one per CPU core if size is
+// zero or negative.
+func NewWorkerGroup(size int, factory WorkerFactory) (*WorkerGroup, error) {
+	if size <= 0 {
+		size = runtime.NumCPU()
+	}
+	g := &WorkerGroup{
+		factory:    factory,
+		generation: 1,
+	}
+	g.routing.Store(&routing{shards: map[int]*shard{}})
+	if err := g.Resize(size); err != nil {
+		g.Close()
+		return nil, err
+	}
+	return g, nil
+}
+
+// Send sends a message to the worker owning key. See Worker.Send.
+func (g *WorkerGroup) Send(key string, msg string) error {
+	var err error
+	if !g.Do(key, func(w *Worker) { err = w.Send(msg) }) {
+		return errors.New("worker group closed")
+	}
+	return err
+}
+
+// SendSync sends a message to the worker owning key and returns the result of
+// its $recvSync callback. See Worker.SendSync.
+func (g *WorkerGroup) SendSync(key string, msg string) string {
+	var res string
+	if !g.Do(key, func(w *Worker) { res = w.SendSync(msg) }) {
+		return "err: worker group closed"
+	}
+	return res
+}
+
+// SendWithPriority is like Send, ahead of messages of lower priority.
+func (g *WorkerGroup) SendWithPriority(key string, msg string, p Priority) error {
+	var err error
+	if !g.DoWithPriority(key, p, func(w *Worker) { err = w.Send(msg) }) {
+		return errors.New("worker group closed")
+	}
+	return err
+}
+
+// SendSyncWithPriority is like SendSync, ahead of messages of lower
+// priority.
+func (g *WorkerGroup) SendSyncWithPriority(key string, msg string, p Priority) string {
+	var res string
+	if !g.DoWithPriority(key, p, func(w *Worker) { res = w.SendSync(msg) }) {
+		return "err: worker group closed"
+	}
+	return res
+}
+
+// Do runs fn with the worker owning key on that worker's thread and waits for
+// it to return. It returns false if the group is closed.
+func (g *WorkerGroup) Do(key string, fn func(w *Worker)) bool {
+	return g.DoWithPriority(key, PriorityNormal, fn)
+}
+
+// DoWithPriority is like Do, ahead of calls of lower priority. It blocks
+// while shardQueueCapacity calls are already waiting for the shard.
+func (g *WorkerGroup) DoWithPriority(key string, p Priority, fn func(w *Worker)) bool {
+	for {
+		r := g.current()
+		if r.closed {
+			return false
+		}
+		s := r.shards[r.ring.owner(key)]
+		// A shard removed since r was loaded refuses the job, and the new
+		// routing is already published.
+		if done := s.enqueue(p, func() { fn(s.worker) }); done != nil {
+			<-done
+			return true
+		}
+	}
+}
+
+func (g *WorkerGroup) current() *routing {
+	return g.routing.Load().(*routing)
+}
+
+// ShardFor returns the shard that owns key.
+func (g *WorkerGroup) ShardFor(key string) int {
+	return g.current().ring.owner(key)
+}
+
+// Size returns the number of shards.
+func (g *WorkerGroup) Size() int {
+	return len(g.current().shards)
+}
+
+// Recycle replaces the worker of a shard with a fresh one from the factory,
+// for example after it accumulated too much heap. Messages queued for the
+// shard before the call are still handled by the old worker, which is then
+// disposed in the background. The shard keeps its keys.
+func (g *WorkerGroup) Recycle(id int) error {
+	g.mu.Lock()
+	factory := g.factory
+	g.mu.Unlock()
+	s, ok := g.current().shards[id]
+	if !ok {
+		return errors.New("no such shard: " + strconv.Itoa(id))
+	}
+	var err error
+	done := s.barrier(func() {
+		var w *Worker
+		w, err = factory(s.id)
+		if err == nil {
+			s.worker.Dispose()
+			s.worker = w
+		}
+	})
+	if done == nil {
+		return errors.New("no such shard: " + strconv.Itoa(id))
+	}
+	<-done
+	return err
+}
+
+// Reload replaces the workers of every shard with workers from factory, for
+// example to deploy a new version of their scripts, without a pause in
+// handling messages. The new workers are built in the background on
+// threads pinned like their shards', while the old ones keep handling
+// messages. The first shard's worker is built before the others, so that
+// they find its scripts in a CodeCache set in their options. Each shard then
+// switches to its new worker at a barrier: messages queued for the shard
+// before the switch are handled by the old worker, and every later message
+// by the new one. Shards switch one after the other without holding up
+// messages, so a message may reach a new worker while one sent later to
+// another shard still reaches an old one. Old workers are disposed once
+// they have drained.
+//
+// If the factory fails for any shard, the old workers are kept and the new
+// ones disposed. Later calls to Recycle and Resize use factory.
+func (g *WorkerGroup) Reload(factory WorkerFactory) (ReloadStats, error) {
+	g.rebuild.Lock()
+	defer g.rebuild.Unlock()
+
+	var stats ReloadStats
+	r := g.current()
+	if r.closed {
+		return stats, errors.New("worker group closed")
+	}
+	// Resize also holds rebuild, so the shards stay the same until the
+	// switch below.
+	cpus := make(map[int]int, len(r.shards))
+	for id, s := range r.shards {
+		cpus[id] = s.cpu
+	}
+
+	start := time.Now()
+	workers := make(map[int]*Worker, len(cpus))
+	errs := make(map[int]error, len(cpus))
+	var mu sync.Mutex
+	var wg sync.WaitGroup
+	build := func(id int) {
+		defer wg.Done()
+		w, err := buildWorker(cpus[id], func() (*Worker, error) { return factory(id) })
+		mu.Lock()
+		workers[id], errs[id] = w, err
+		mu.Unlock()
+	}
+	if _, ok := cpus[0]; ok {
+		wg.Add(1)
+		build(0)
+	}
+	if errs[0] == nil {
+		for id := range cpus {
+			if id != 0 {
+				wg.Add(1)
+				go build(id)
+			}
+		}
+		wg.Wait()
+	}
+	stats.Build = time.Since(start)
+
+	disposeAll := func() {
+		for _, w := range workers {
+			if w != nil {
+				w.Dispose()
+			}
+		}
+	}
+	for _, err := range errs {
+		if err != nil {
+			disposeAll()
+			return stats, err
+		}
+	}
+
+	g.mu.Lock()
+	if g.closed {
+		g.mu.Unlock()
+		disposeAll()
+		return stats, errors.New("worker group closed")
+	}
+	start = time.Now()
+	dones := make([]<-chan struct{}, 0, len(r.shards))
+	for id, s := range r.shards {
+		s, w := s, workers[id]
+		dones = append(dones, s.barrier(func() {
+			s.worker.Dispose()
+			s.worker = w
+		}))
+	}
+	g.factory = factory
+	g.generation++
+	stats.Generation = g.generation
+	stats.Switch = time.Since(start)
+	g.mu.Unlock()
+
+	for _, done := range dones {
+		<-done
+	}
+	stats.Drain = time.Since(start)
+	return stats, nil
+}
+
+// buildWorker runs factory on a new thread pinned to cpu, so that the
+// worker's memory is placed as if its shard had created it.
+func buildWorker(cpu int, factory func() (*Worker, error)) (*Worker, error) {
+	type result struct {
+		w   *Worker
+		err error
+	}
+	done := make(chan result)
+	go func() {
+		// Never unlocked: the pinned thread exits with the goroutine.
+		runtime.LockOSThread()
+		pinThread(cpu)
+		w, err := factory()
+		done <- result{w, err}
+	}()
+	r := <-done
+	return r.w, r.err
+}
+
+// Generation returns the number of times the workers were replaced by
+// Reload, plus one.
+func (g *WorkerGroup) Generation() int {
+	g.mu.Lock()
+	defer g.mu.Unlock()
+	return g.generation
+}
+
+// Resize grows or shrinks the group to size shards. Only keys owned by the
+// added or removed shards move, about 1/size of them per shard. New shards
+// build their workers while the current ones keep handling messages.
+func (g *WorkerGroup) Resize(size int) error {
+	if size <= 0 {
+		return errors.New("worker group size must be positive")
+	}
+
+	g.rebuild.Lock()
+	defer g.rebuild.Unlock()
+	r := g.current()
+	if r.closed {
+		return errors.New("worker group closed")
+	}
+	g.mu.Lock()
+	factory := g.factory
+	g.mu.Unlock()
+
+	// Shards are numbered densely so the same ids, and so the same ring
+	// points, come back when a group grows again. New shards build their
+	// workers in parallel.
+	var added []*shard
+	var dones []<-chan struct{}
+	errs := make([]error, size)
+	for id := len(r.shards); id < size; id++ {
+		s := &shard{
+			id:    id,
+			cpu:   shardCPU(id),
+			ready: make(chan struct{}, 1),
+			slots: make(chan struct{}, shardQueueCapacity),
+		}
+		go s.run()
+		added = append(added, s)
+		dones = append(dones, s.barrier(func() {
+			s.worker, errs[s.id] = factory(s.id)
+		}))
+	}
+	for _, done := range dones {
+		<-done
+	}
+	stopAdded := func() {
+		for _, s := range added {
+			s.stop()
+		}
+	}
+	for _, s := range added {
+		if errs[s.id] != nil {
+			stopAdded()
+			return errs[s.id]
+		}
+	}
+
+	next := &routing{shards: make(map[int]*shard, size)}
+	var removed []*shard
+	for id, s := range r.shards {
+		if id < size {
+			next.shards[id] = s
+		} else {
+			removed = append(removed, s)
+		}
+	}
+	for _, s := range added {
+		next.shards[s.id] = s
+	}
+	next.ring = newHashRing(len(next.shards))
+
+	g.mu.Lock()
+	if g.closed {
+		g.mu.Unlock()
+		stopAdded()
+		return errors.New("worker group closed")
+	}
+	g.routing.Store(next)
+	g.mu.Unlock()
+
+	// Messages routed to the removed shards before the switch are handled
+	// before their workers are disposed.
+	for _, s := range removed {
+		s.stop()
+	}
+	return nil
+}
+
+// Close stops all shards and disposes their workers.
+func (g *WorkerGroup) Close() {
+	g.mu.Lock()
+	if g.closed {
+		g.mu.Unlock()
+		return
+	}
+	g.closed = true
+	r := g.current()
+	g.routing.Store(&routing{shards: map[int]*shard{}, closed: true})
+	g.mu.Unlock()
+
+	for _, s := range r.shards {
+		s.stop()
+	}
+}
+
+func (s *shard) run() {
+	runtime.LockOSThread()
+	// Pinning fails if the CPU is outside the process's cpuset. The shard
+	// still works, just without the locality.
+	pinThread(s.cpu)
+	for {
+		fn := s.next()
+		if fn == nil {
+			return
+		}
+		fn()
+	}
+}
+
+// stop disposes the shard's worker after the jobs already queued and ends
+// its thread. Jobs queued later are refused.
+func (s *shard) stop() {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if s.stopped {
+		return
+	}
+	s.stopped = true
+	s.seq++
+	s.barriers = append(s.barriers, job{s.seq, func() {
+		if s.worker != nil {
+			s.worker.Dispose()
+		}
+	}})
+	s.signal()
+}
+
+// enqueue queues fn on the shard's thread in the lane of p, waiting for a
+// free slot while the lanes are full. The returned channel is closed once fn
+// has run. It returns nil if the shard is stopped.
+func (s *shard) enqueue(p Priority, fn func()) <-chan struct{} {
+	if p < PriorityLow {
+		p = PriorityLow
+	} else if p > PriorityHigh {
+		p = PriorityHigh
+	}
+	s.slots <- struct{}{}
+	done := s.push(int(PriorityHigh-p), fn)
+	if done == nil {
+		<-s.slots
+	}
+	return done
+}
+
+// barrier queues fn to run after every job queued before it, whatever its
+// priority, and before every job queued after it. It returns nil if the
+// shard is stopped.
+func (s *shard) barrier(fn func()) <-chan struct{} {
+	return s.push(-1, fn)
+}
+
+func (s *shard) push(lane int, fn func()) <-chan struct{} {
+	done := make(chan struct{})
+	s.mu.Lock()
+	if s.stopped {
+		s.mu.Unlock()
+		return nil
+	}
+	s.seq++
+	j := job{s.seq, func() {
+		fn()
+		close(done)
+	}}
+	if lane < 0 {
+		s.barriers = append(s.barriers, j)
+	} else {
+		s.lanes[lane] = append(s.lanes[lane], j)
+	}
+	s.mu.Unlock()
+	s.signal()
+	return done
+}
+
+func (s *shard) signal() {
+	select {
+	case s.ready <- struct{}{}:
+	default:
+	}
+}
+
+// next waits for the next job to run, or returns nil once the shard is
+// stopped and drained. Only jobs queued before the first barrier are
+// eligible, taken from the highest lane unless a lower one has been passed
+// over starvationLimit times.
+func (s *shard) next() func() {
+	for {
+		s.mu.Lock()
+		limit := ^uint64(0)
+		if len(s.barriers) > 0 {
+			limit = s.barriers[0].seq
+		}
+		lane := -1
+		for i := 0; i < numPriorities; i++ {
+			if len(s.lanes[i]) == 0 || s.lanes[i][0].seq > limit {
+				continue
+			}
+			if lane < 0 {
+				lane = i
+			} else {
+				s.skipped[i]++
+			}
+		}
+		for i := lane + 1; i < numPriorities && lane >= 0; i++ {
+			if s.skipped[i] > starvationLimit {
+				lane = i
+				break
+			}
+		}
+
+		var fn func()
+		if lane >= 0 {
+			fn = s.lanes[lane][0].fn
+			s.lanes[lane] = s.lanes[lane][1:]
+			s.skipped[lane] = 0
+			<-s.slots
+		} else if len(s.barriers) > 0 {
+			fn = s.barriers[0].fn
+			s.barriers = s.barriers[1:]
+		}
+		stopped := s.stopped
+		s.mu.Unlock()
+
+		if fn != nil || stopped {
+			return fn
+		}
+		<-s.ready
+	}
+}
+
+var (
+	cpuOrderOnce sync.Once
+	cpuOrder     []int
+)
+
+// NUMANodes returns the number of NUMA nodes, 1 on machines without NUMA.
+func NUMANodes() int {
+	return int(C.numa_node_count())
+}
+
+// nodeCPUs returns the CPUs of each NUMA node.
+func nodeCPUs() [][]int {
+	nodes := make([][]int, NUMANodes())
+	for cpu := 0; cpu < runtime.NumCPU(); cpu++ {
+		node := int(C.numa_node_of_cpu(C.int(cpu)))
+		if node >= len(nodes) {
+			node = 0
+		}
+		nodes[node] = append(nodes[node], cpu)
+	}
+	return nodes
+}
+
+// shardCPU returns the CPU for a shard. CPUs are taken round-robin from the
+// NUMA nodes so that a group smaller than the machine still uses all of its
+// sockets and their memory bandwidth.
+func shardCPU(id int) int {
+	cpuOrderOnce.Do(func() {
+		nodes := nodeCPUs()
+		for i := 0; len(cpuOrder) < runtime.NumCPU(); i++ {
+			for _, cpus := range nodes {
+				if i < len(cpus) {
+					cpuOrder = append(cpuOrder, cpus[i])
+				}
+			}
+		}
+	})
+	return cpuOrder[id%len(cpuOrder)]
+}
+
+// pinThread pins the calling goroutine's thread to cpu and, on NUMA
+// machines, to the memory of cpu's node. The caller must have locked the
+// goroutine to its thread and must never unlock it, so that the thread exits
+// with the goroutine instead of returning pinned to the scheduler.
+func pinThread(cpu int) bool {
+	return C.pin_thread_to_cpu(C.int(cpu)) == 0
+}
+
+type ringPoint struct {
+	hash  uint32
+	shard int
+}
+
+func newHashRing(shards int) hashRing {
+	points := make([]ringPoint, 0, shards*virtualNodesPerShard)
+	for id := 0; id < shards; id++ {
+		for v := 0; v < virtualNodesPerShard; v++ {
+			h := crc32.ChecksumIEEE([]byte(strconv.Itoa(id) + "#" + strconv.Itoa(v)))
+			points = append(points, ringPoint{h, id})
+		}
+	}
+	sort.Sort(ringPoints(points))
+
+	var r hashRing
+	for i, p := range points {
+		// On a collision the lower shard id wins, whatever the order shards
+		// were added in.
+		if i > 0 && p.hash == points[i-1].hash {
+			continue
+		}
+		r.points = append(r.points, p.hash)
+		r.owners = append(r.owners, p.shard)
+	}
+	return r
+}
+
+// owner returns the shard owning key: the first point clockwise from the
+// key's hash.
+func (r hashRing) owner(key string) int {
+	h := crc32.ChecksumIEEE([]byte(key))
+	i := sort.Search(len(r.points), func(i int) bool { return r.points[i] >= h })
+	if i == len(r.points) {
+		i = 0
+	}
+	return r.owners[i]
+}
+
+type ringPoints []ringPoint
+
+func (p ringPoints) Len() int      { return len(p) }
+func (p ringPoints) Swap(i, j int) { p[i], p[j] = p[j], p[i] }
+func (p ringPoints) Less(i, j int) bool {
+	if p[i].hash != p[j].hash {
+		return p[i].hash < p[j].hash
+	}
+	return p[i].shard < p[j].shard
+}
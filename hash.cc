@@ -0,0 +1,483 @@
+#include <string.h>
+#include "hash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define V8WORKER_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+
+uint32_t Read32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint64_t Read64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint64_t Rotl64(uint64_t v, int n) {
+  return (v << n) | (v >> (64 - n));
+}
+
+uint32_t Rotr32(uint32_t v, int n) {
+  return (v >> n) | (v << (32 - n));
+}
+
+#ifdef V8WORKER_X86
+
+struct CpuFeatures {
+  bool sse42;
+  bool sha;
+
+  CpuFeatures() : sse42(false), sha(false) {
+    unsigned int eax, ebx, ecx, edx;
+    bool sse41 = false, ssse3 = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+      ssse3 = (ecx & bit_SSSE3) != 0;
+      sse41 = (ecx & bit_SSE4_1) != 0;
+      sse42 = (ecx & bit_SSE4_2) != 0;
+    }
+    if (__get_cpuid_max(0, NULL) >= 7) {
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+      sha = ssse3 && sse41 && (ebx & (1 << 29)) != 0;
+    }
+  }
+};
+
+const CpuFeatures cpu;
+
+#endif  // V8WORKER_X86
+
+// xxHash, see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+const uint64_t kPrime64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime64_3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kPrime64_5 = 0x27D4EB2F165667C5ULL;
+const uint32_t kPrime32_1 = 0x9E3779B1U;
+const uint32_t kPrime32_2 = 0x85EBCA77U;
+const uint32_t kPrime32_3 = 0xC2B2AE3DU;
+
+uint64_t Xxh64Round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime64_2;
+  return Rotl64(acc, 31) * kPrime64_1;
+}
+
+uint64_t Xxh64Merge(uint64_t acc, uint64_t v) {
+  acc ^= Xxh64Round(0, v);
+  return acc * kPrime64_1 + kPrime64_4;
+}
+
+uint64_t Xxh64Avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= kPrime64_2;
+  h ^= h >> 29;
+  h *= kPrime64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+const uint8_t kXxh3Secret[192] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+  0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+  0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+  0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+  0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+  0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+  0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+  0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+  0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+const size_t kStripeLength = 64;
+const size_t kSecretConsumeRate = 8;
+
+uint64_t Mul128Fold64(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  unsigned __int128 product = (unsigned __int128)a * b;
+  return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+  uint64_t lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+  uint64_t hi_lo = (a >> 32) * (b & 0xffffffff);
+  uint64_t lo_hi = (a & 0xffffffff) * (b >> 32);
+  uint64_t hi_hi = (a >> 32) * (b >> 32);
+  uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+  uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  uint64_t lower = (cross << 32) | (lo_lo & 0xffffffff);
+  return lower ^ upper;
+#endif
+}
+
+uint64_t Xxh3Avalanche(uint64_t h) {
+  h ^= h >> 37;
+  h *= 0x165667919E3779F9ULL;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t Xxh3Rrmxmx(uint64_t h, uint64_t length) {
+  h ^= Rotl64(h, 49) ^ Rotl64(h, 24);
+  h *= 0x9FB21C651E98DF25ULL;
+  h ^= (h >> 35) + length;
+  h *= 0x9FB21C651E98DF25ULL;
+  h ^= h >> 28;
+  return h;
+}
+
+uint64_t Xxh3Mix16(const uint8_t* p, const uint8_t* secret, uint64_t seed) {
+  return Mul128Fold64(Read64(p) ^ (Read64(secret) + seed),
+                      Read64(p + 8) ^ (Read64(secret + 8) - seed));
+}
+
+uint64_t Xxh3Short(const uint8_t* p, size_t length, uint64_t seed) {
+  const uint8_t* s = kXxh3Secret;
+  if (length > 8) {
+    uint64_t lo = Read64(p) ^ ((Read64(s + 24) ^ Read64(s + 32)) + seed);
+    uint64_t hi = Read64(p + length - 8) ^ ((Read64(s + 40) ^ Read64(s + 48)) - seed);
+    uint64_t acc = length + __builtin_bswap64(lo) + hi + Mul128Fold64(lo, hi);
+    return Xxh3Avalanche(acc);
+  }
+  if (length >= 4) {
+    seed ^= (uint64_t)__builtin_bswap32((uint32_t)seed) << 32;
+    uint64_t input = Read32(p + length - 4) + ((uint64_t)Read32(p) << 32);
+    uint64_t bitflip = (Read64(s + 8) ^ Read64(s + 16)) - seed;
+    return Xxh3Rrmxmx(input ^ bitflip, length);
+  }
+  if (length > 0) {
+    uint32_t combined = (uint32_t)p[0] << 16 | (uint32_t)p[length >> 1] << 24 |
+                        (uint32_t)p[length - 1] | (uint32_t)length << 8;
+    uint64_t bitflip = (Read32(s) ^ Read32(s + 4)) + seed;
+    return Xxh64Avalanche(combined ^ bitflip);
+  }
+  return Xxh64Avalanche(seed ^ Read64(s + 56) ^ Read64(s + 64));
+}
+
+uint64_t Xxh3Medium(const uint8_t* p, size_t length, uint64_t seed) {
+  const uint8_t* s = kXxh3Secret;
+  uint64_t acc = length * kPrime64_1;
+  if (length <= 128) {
+    if (length > 32) {
+      if (length > 64) {
+        if (length > 96) {
+          acc += Xxh3Mix16(p + 48, s + 96, seed);
+          acc += Xxh3Mix16(p + length - 64, s + 112, seed);
+        }
+        acc += Xxh3Mix16(p + 32, s + 64, seed);
+        acc += Xxh3Mix16(p + length - 48, s + 80, seed);
+      }
+      acc += Xxh3Mix16(p + 16, s + 32, seed);
+      acc += Xxh3Mix16(p + length - 32, s + 48, seed);
+    }
+    acc += Xxh3Mix16(p, s, seed);
+    acc += Xxh3Mix16(p + length - 16, s + 16, seed);
+    return Xxh3Avalanche(acc);
+  }
+
+  size_t rounds = length / 16;
+  for (size_t i = 0; i < 8; i++) acc += Xxh3Mix16(p + 16 * i, s + 16 * i, seed);
+  acc = Xxh3Avalanche(acc);
+  for (size_t i = 8; i < rounds; i++) {
+    acc += Xxh3Mix16(p + 16 * i, s + 16 * (i - 8) + 3, seed);
+  }
+  acc += Xxh3Mix16(p + length - 16, s + 136 - 17, seed);
+  return Xxh3Avalanche(acc);
+}
+
+void Xxh3Accumulate512(uint64_t acc[8], const uint8_t* p, const uint8_t* secret) {
+  for (int i = 0; i < 8; i++) {
+    uint64_t value = Read64(p + 8 * i);
+    uint64_t key = value ^ Read64(secret + 8 * i);
+    acc[i ^ 1] += value;
+    acc[i] += (key & 0xffffffff) * (key >> 32);
+  }
+}
+
+void Xxh3Scramble(uint64_t acc[8], const uint8_t* secret) {
+  for (int i = 0; i < 8; i++) {
+    uint64_t a = acc[i];
+    a ^= a >> 47;
+    a ^= Read64(secret + 8 * i);
+    acc[i] = a * kPrime32_1;
+  }
+}
+
+uint64_t Xxh3Long(const uint8_t* p, size_t length, uint64_t seed) {
+  uint8_t derived[sizeof(kXxh3Secret)];
+  const uint8_t* s = kXxh3Secret;
+  const size_t secret_length = sizeof(kXxh3Secret);
+  if (seed != 0) {
+    for (size_t i = 0; i < secret_length; i += 16) {
+      uint64_t lo = Read64(kXxh3Secret + i) + seed;
+      uint64_t hi = Read64(kXxh3Secret + i + 8) - seed;
+      memcpy(derived + i, &lo, 8);
+      memcpy(derived + i + 8, &hi, 8);
+    }
+    s = derived;
+  }
+
+  uint64_t acc[8] = {kPrime32_3, kPrime64_1, kPrime64_2, kPrime64_3,
+                     kPrime64_4, kPrime32_2, kPrime64_5, kPrime32_1};
+  const size_t stripes_per_block = (secret_length - kStripeLength) / kSecretConsumeRate;
+  const size_t block_length = kStripeLength * stripes_per_block;
+  const size_t blocks = (length - 1) / block_length;
+  for (size_t n = 0; n < blocks; n++) {
+    for (size_t i = 0; i < stripes_per_block; i++) {
+      Xxh3Accumulate512(acc, p + n * block_length + i * kStripeLength,
+                        s + i * kSecretConsumeRate);
+    }
+    Xxh3Scramble(acc, s + secret_length - kStripeLength);
+  }
+  size_t stripes = ((length - 1) - block_length * blocks) / kStripeLength;
+  for (size_t i = 0; i < stripes; i++) {
+    Xxh3Accumulate512(acc, p + blocks * block_length + i * kStripeLength,
+                      s + i * kSecretConsumeRate);
+  }
+  Xxh3Accumulate512(acc, p + length - kStripeLength,
+                    s + secret_length - kStripeLength - 7);
+
+  uint64_t result = length * kPrime64_1;
+  for (int i = 0; i < 4; i++) {
+    result += Mul128Fold64(acc[2 * i] ^ Read64(s + 11 + 16 * i),
+                           acc[2 * i + 1] ^ Read64(s + 11 + 16 * i + 8));
+  }
+  return Xxh3Avalanche(result);
+}
+
+// SHA-256, as in FIPS 180-4.
+
+const uint32_t kSha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+void Sha256BlocksScalar(uint32_t state[8], const uint8_t* p, size_t blocks) {
+  for (; blocks > 0; blocks--, p += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) w[i] = __builtin_bswap32(Read32(p + 4 * i));
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = Rotr32(w[i - 15], 7) ^ Rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = Rotr32(w[i - 2], 17) ^ Rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t s1 = Rotr32(e, 6) ^ Rotr32(e, 11) ^ Rotr32(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + ch + kSha256K[i] + w[i];
+      uint32_t s0 = Rotr32(a, 2) ^ Rotr32(a, 13) ^ Rotr32(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#ifdef V8WORKER_X86
+
+// The SHA extensions keep the state as ABEF and CDGH, and run two rounds
+// per instruction.
+__attribute__((target("sha,sse4.1")))
+void Sha256BlocksShaNi(uint32_t state[8], const uint8_t* p, size_t blocks) {
+  const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xb1);
+  __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1b);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  for (; blocks > 0; blocks--, p += 64) {
+    __m128i abef = state0;
+    __m128i cdgh = state1;
+    __m128i w[4];
+    for (int i = 0; i < 16; i++) {
+      __m128i& msg = w[i & 3];
+      if (i < 4) {
+        msg = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i)), byteswap);
+      } else {
+        msg = _mm_sha256msg2_epu32(
+            _mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]),
+                          _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4)),
+            w[(i + 3) & 3]);
+      }
+      __m128i k = _mm_add_epi32(msg, _mm_loadu_si128(reinterpret_cast<const __m128i*>(kSha256K + 4 * i)));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, k);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(k, 0x0e));
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+#endif  // V8WORKER_X86
+
+void Sha256Blocks(uint32_t state[8], const uint8_t* p, size_t blocks) {
+#ifdef V8WORKER_X86
+  if (cpu.sha) {
+    Sha256BlocksShaNi(state, p, blocks);
+    return;
+  }
+#endif
+  Sha256BlocksScalar(state, p, blocks);
+}
+
+// CRC-32C, reflected, polynomial 0x82f63b78.
+
+struct Crc32cTable {
+  uint32_t entries[256];
+
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; j++) crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+      entries[i] = crc;
+    }
+  }
+};
+
+const Crc32cTable crc32c_table;
+
+uint32_t Crc32cScalar(uint32_t crc, const uint8_t* p, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    crc = crc32c_table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef V8WORKER_X86
+
+__attribute__((target("sse4.2")))
+uint32_t Crc32cSse42(uint32_t crc, const uint8_t* p, size_t length) {
+  size_t i = 0;
+#ifdef __x86_64__
+  uint64_t crc64 = crc;
+  for (; length - i >= 8; i += 8) crc64 = _mm_crc32_u64(crc64, Read64(p + i));
+  crc = (uint32_t)crc64;
+#endif
+  for (; length - i >= 4; i += 4) crc = _mm_crc32_u32(crc, Read32(p + i));
+  for (; i < length; i++) crc = _mm_crc32_u8(crc, p[i]);
+  return crc;
+}
+
+#endif  // V8WORKER_X86
+
+}  // namespace
+
+uint64_t Xxh64(const void* data, size_t length, uint64_t seed) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint8_t* end = p + length;
+  uint64_t h;
+  if (length >= 32) {
+    uint64_t v1 = seed + kPrime64_1 + kPrime64_2;
+    uint64_t v2 = seed + kPrime64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kPrime64_1;
+    for (; end - p >= 32; p += 32) {
+      v1 = Xxh64Round(v1, Read64(p));
+      v2 = Xxh64Round(v2, Read64(p + 8));
+      v3 = Xxh64Round(v3, Read64(p + 16));
+      v4 = Xxh64Round(v4, Read64(p + 24));
+    }
+    h = Rotl64(v1, 1) + Rotl64(v2, 7) + Rotl64(v3, 12) + Rotl64(v4, 18);
+    h = Xxh64Merge(h, v1);
+    h = Xxh64Merge(h, v2);
+    h = Xxh64Merge(h, v3);
+    h = Xxh64Merge(h, v4);
+  } else {
+    h = seed + kPrime64_5;
+  }
+  h += length;
+
+  for (; end - p >= 8; p += 8) {
+    h ^= Xxh64Round(0, Read64(p));
+    h = Rotl64(h, 27) * kPrime64_1 + kPrime64_4;
+  }
+  if (end - p >= 4) {
+    h ^= Read32(p) * kPrime64_1;
+    h = Rotl64(h, 23) * kPrime64_2 + kPrime64_3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    h ^= *p * kPrime64_5;
+    h = Rotl64(h, 11) * kPrime64_1;
+  }
+  return Xxh64Avalanche(h);
+}
+
+uint64_t Xxh3(const void* data, size_t length, uint64_t seed) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  if (length <= 16) return Xxh3Short(p, length, seed);
+  if (length <= 240) return Xxh3Medium(p, length, seed);
+  return Xxh3Long(p, length, seed);
+}
+
+void Sha256(const void* data, size_t length, uint8_t out[kSha256Length]) {
+  uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                       0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  size_t full = length / 64;
+  Sha256Blocks(state, p, full);
+
+  // The rest of the data, 0x80, zeros and the length in bits fill one or two
+  // more blocks.
+  uint8_t tail[128];
+  size_t rest = length - full * 64;
+  memcpy(tail, p + full * 64, rest);
+  tail[rest] = 0x80;
+  size_t tail_length = rest + 9 <= 64 ? 64 : 128;
+  memset(tail + rest + 1, 0, tail_length - rest - 1);
+  uint64_t bits = __builtin_bswap64((uint64_t)length * 8);
+  memcpy(tail + tail_length - 8, &bits, 8);
+  Sha256Blocks(state, tail, tail_length / 64);
+
+  for (int i = 0; i < 8; i++) {
+    uint32_t v = __builtin_bswap32(state[i]);
+    memcpy(out + 4 * i, &v, 4);
+  }
+}
+
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+#ifdef V8WORKER_X86
+  if (cpu.sse42) return ~Crc32cSse42(crc, p, length);
+#endif
+  return ~Crc32cScalar(crc, p, length);
+}
@@ -0,0 +1,20 @@
+#ifndef V8WORKER_HASH_H_
+#define V8WORKER_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hash functions behind the $hash global. SHA-256 and CRC32C use the SHA and
+// SSE4.2 instructions of x86 CPUs that have them.
+
+// XXH64 and the 64-bit XXH3, as in xxHash 0.8.
+uint64_t Xxh64(const void* data, size_t length, uint64_t seed);
+uint64_t Xxh3(const void* data, size_t length, uint64_t seed);
+
+const size_t kSha256Length = 32;
+void Sha256(const void* data, size_t length, uint8_t out[kSha256Length]);
+
+// CRC-32C (Castagnoli). crc is the result for the preceding data, 0 to start.
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length);
+
+#endif  // V8WORKER_HASH_H_
@@ -0,0 +1,425 @@
+package v8worker
+
+/*
+#include <stdlib.h>
+#include "binding.h"
+*/
+import "C"
+import (
+	"bufio"
+	"container/list"
+	"crypto/sha256"
+	"encoding/binary"
+	"encoding/hex"
+	"errors"
+	"io"
+	"os"
+	"path/filepath"
+	"sync"
+	"unsafe"
+)
+
+// Identifies hibernation files. Bump the version when the format changes.
+const (
+	hibernationMagic   = "V8WH"
+	hibernationVersion = 1
+)
+
+type loadedScript struct {
+	origin ScriptOrigin
+	code   string
+}
+
+// Hibernated reports whether the worker is hibernated.
+func (w *Worker) Hibernated() bool {
+	return w.cWorker == nil && w.hibernationPath != ""
+}
+
+// Hibernate writes the worker to the file at path and disposes its isolate,
+// releasing all of its memory. The file holds the scripts loaded into the
+// worker, V8's code cache for each, and the state returned by the save
+// callback the scripts registered with $hibernation(save, restore), as JSON.
+// The worker must have been created with Options.Hibernatable and must not
+// be used until Restore.
+func (w *Worker) Hibernate(path string) error {
+	if !w.hibernatable {
+		return errors.New("worker is not hibernatable")
+	}
+	if w.cWorker == nil {
+		return errors.New("worker is hibernated or disposed")
+	}
+
+	var cState *C.char
+	if C.worker_save_state(w.cWorker, &cState) != 0 {
+		errStr := C.worker_last_exception(w.cWorker)
+		return errors.New(C.GoString(errStr))
+	}
+	hasState := cState != nil
+	state := C.GoString(cState)
+	C.free(unsafe.Pointer(cState))
+
+	caches := make([][]byte, len(w.scripts))
+	for i, s := range w.scripts {
+		caches[i] = w.produceCodeCache(s.origin.ScriptName, s.code)
+	}
+
+	if err := writeHibernationFile(path, w.scripts, caches, hasState, state); err != nil {
+		return err
+	}
+
+	w.cWorkerLocker.Lock()
+	C.worker_dispose(w.cWorker)
+	w.cWorker = nil
+	w.cWorkerLocker.Unlock()
+	w.scripts = nil
+	w.hibernationPath = path
+	return nil
+}
+
+// Restore rebuilds a hibernated worker from its file. The scripts run again,
+// compiled from the code cache where V8 accepts it, then the restore callback
+// registered with $hibernation receives the saved state. The file is removed
+// once the worker is restored.
+//
+// Restore only saves the compilation of the scripts: whatever they do when
+// they run, such as building tables, is done again, so a worker whose
+// scripts spend most of their load time running is restored hardly faster
+// than it is loaded. See BenchmarkLoad and BenchmarkRestore.
+func (w *Worker) Restore() error {
+	if !w.Hibernated() {
+		return errors.New("worker is not hibernated")
+	}
+
+	scripts, caches, hasState, state, err := readHibernationFile(w.hibernationPath)
+	if err != nil {
+		return err
+	}
+
+	w.cWorkerLocker.Lock()
+	w.newCWorker()
+	w.cWorkerLocker.Unlock()
+	w.internedKeys = nil
+	fail := func(err error) error {
+		w.cWorkerLocker.Lock()
+		C.worker_dispose(w.cWorker)
+		w.cWorker = nil
+		w.cWorkerLocker.Unlock()
+		return err
+	}
+
+	for i := range scripts {
+		if err := w.load(&scripts[i].origin, scripts[i].code, caches[i]); err != nil {
+			return fail(err)
+		}
+	}
+	if hasState {
+		cState := C.CString(state)
+		r := C.worker_restore_state(w.cWorker, cState)
+		C.free(unsafe.Pointer(cState))
+		if r != 0 {
+			return fail(errors.New(C.GoString(C.worker_last_exception(w.cWorker))))
+		}
+	}
+
+	os.Remove(w.hibernationPath)
+	w.scripts = scripts
+	w.hibernationPath = ""
+	return nil
+}
+
+func writeHibernationFile(path string, scripts []loadedScript, caches [][]byte, hasState bool, state string) error {
+	tmp := path + ".tmp"
+	f, err := os.Create(tmp)
+	if err != nil {
+		return err
+	}
+
+	bw := bufio.NewWriter(f)
+	hw := &hibernationWriter{w: bw}
+	hw.bytes([]byte(hibernationMagic))
+	hw.uint32(hibernationVersion)
+	hw.string(Version())
+	hw.uint32(uint32(len(scripts)))
+	for i, s := range scripts {
+		hw.string(s.origin.ScriptName)
+		hw.uint32(uint32(s.origin.LineOffset))
+		hw.uint32(uint32(s.origin.ColumnOffset))
+		hw.bool(s.origin.IsSharedCrossOrigin)
+		hw.uint32(uint32(s.origin.ScriptId))
+		hw.bool(s.origin.IsEmbedderDebugScript)
+		hw.string(s.origin.SourceMapURL)
+		hw.bool(s.origin.IsOpaque)
+		hw.string(s.code)
+		hw.bytes(caches[i])
+	}
+	hw.bool(hasState)
+	hw.string(state)
+
+	err = hw.err
+	if err == nil {
+		err = bw.Flush()
+	}
+	if closeErr := f.Close(); err == nil {
+		err = closeErr
+	}
+	if err == nil {
+		err = os.Rename(tmp, path)
+	}
+	if err != nil {
+		os.Remove(tmp)
+	}
+	return err
+}
+
+func readHibernationFile(path string) (scripts []loadedScript, caches [][]byte, hasState bool, state string, err error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, nil, false, "", err
+	}
+	defer f.Close()
+
+	hr := &hibernationReader{r: bufio.NewReader(f)}
+	if string(hr.bytes()) != hibernationMagic || hr.uint32() != hibernationVersion {
+		return nil, nil, false, "", errors.New("not a hibernation file: " + path)
+	}
+	// Caches from another V8 version would be rejected anyway.
+	sameVersion := hr.string() == Version()
+
+	n := hr.uint32()
+	for i := uint32(0); i < n && hr.err == nil; i++ {
+		var s loadedScript
+		s.origin.ScriptName = hr.string()
+		s.origin.LineOffset = int32(hr.uint32())
+		s.origin.ColumnOffset = int32(hr.uint32())
+		s.origin.IsSharedCrossOrigin = hr.bool()
+		s.origin.ScriptId = int32(hr.uint32())
+		s.origin.IsEmbedderDebugScript = hr.bool()
+		s.origin.SourceMapURL = hr.string()
+		s.origin.IsOpaque = hr.bool()
+		s.code = hr.string()
+		cache := hr.bytes()
+		if !sameVersion {
+			cache = nil
+		}
+		scripts = append(scripts, s)
+		caches = append(caches, cache)
+	}
+	hasState = hr.bool()
+	state = hr.string()
+
+	if hr.err != nil {
+		return nil, nil, false, "", hr.err
+	}
+	return scripts, caches, hasState, state, nil
+}
+
+// hibernationWriter writes little endian, length prefixed fields and keeps
+// the first error.
+type hibernationWriter struct {
+	w   io.Writer
+	err error
+}
+
+func (hw *hibernationWriter) uint32(v uint32) {
+	if hw.err == nil {
+		hw.err = binary.Write(hw.w, binary.LittleEndian, v)
+	}
+}
+
+func (hw *hibernationWriter) bool(v bool) {
+	if v {
+		hw.uint32(1)
+	} else {
+		hw.uint32(0)
+	}
+}
+
+func (hw *hibernationWriter) bytes(b []byte) {
+	hw.uint32(uint32(len(b)))
+	if hw.err == nil {
+		_, hw.err = hw.w.Write(b)
+	}
+}
+
+func (hw *hibernationWriter) string(s string) {
+	hw.bytes([]byte(s))
+}
+
+type hibernationReader struct {
+	r   io.Reader
+	err error
+}
+
+func (hr *hibernationReader) uint32() uint32 {
+	var v uint32
+	if hr.err == nil {
+		hr.err = binary.Read(hr.r, binary.LittleEndian, &v)
+	}
+	return v
+}
+
+func (hr *hibernationReader) bool() bool {
+	return hr.uint32() != 0
+}
+
+func (hr *hibernationReader) bytes() []byte {
+	n := hr.uint32()
+	if hr.err != nil {
+		return nil
+	}
+	b := make([]byte, n)
+	_, hr.err = io.ReadFull(hr.r, b)
+	return b
+}
+
+func (hr *hibernationReader) string() string {
+	return string(hr.bytes())
+}
+
+// Hibernator keeps at most maxActive of its workers alive and hibernates the
+// least recently used of the others into a directory, restoring them when
+// they are used again. Workers must be hibernatable and only be used through
+// Do once added.
+type Hibernator struct {
+	dir       string
+	maxActive int
+
+	mu      sync.Mutex
+	workers map[string]*hibernatorEntry
+	// Entries with a live isolate, most recently used first.
+	active *list.List
+}
+
+type hibernatorEntry struct {
+	key    string
+	worker *Worker
+	elem   *list.Element
+	users  int
+	// Held while the worker hibernates or is restored.
+	mu sync.Mutex
+}
+
+// NewHibernator creates a Hibernator that keeps hibernated workers in dir.
+func NewHibernator(dir string, maxActive int) *Hibernator {
+	return &Hibernator{
+		dir:       dir,
+		maxActive: maxActive,
+		workers:   make(map[string]*hibernatorEntry),
+		active:    list.New(),
+	}
+}
+
+// Add puts a worker under the hibernator's control.
+func (h *Hibernator) Add(key string, w *Worker) {
+	h.mu.Lock()
+	e := &hibernatorEntry{key: key, worker: w}
+	if !w.Hibernated() {
+		e.elem = h.active.PushFront(e)
+	}
+	h.workers[key] = e
+	victims := h.victims()
+	h.mu.Unlock()
+
+	h.hibernate(victims)
+}
+
+// Remove takes a worker out of the hibernator's control and returns it,
+// possibly hibernated.
+func (h *Hibernator) Remove(key string) *Worker {
+	h.mu.Lock()
+	defer h.mu.Unlock()
+	e, ok := h.workers[key]
+	if !ok {
+		return nil
+	}
+	if e.elem != nil {
+		h.active.Remove(e.elem)
+		e.elem = nil
+	}
+	delete(h.workers, key)
+	return e.worker
+}
+
+// Do restores the worker if needed and calls fn with it. The worker cannot
+// be hibernated while fn runs.
+func (h *Hibernator) Do(key string, fn func(w *Worker) error) error {
+	h.mu.Lock()
+	e, ok := h.workers[key]
+	if !ok {
+		h.mu.Unlock()
+		return errors.New("no such worker: " + key)
+	}
+	e.users++
+	h.mu.Unlock()
+
+	e.mu.Lock()
+	var err error
+	if e.worker.Hibernated() {
+		err = e.worker.Restore()
+	}
+	e.mu.Unlock()
+
+	h.mu.Lock()
+	var victims []*hibernatorEntry
+	if err == nil {
+		if e.elem == nil {
+			e.elem = h.active.PushFront(e)
+		} else {
+			h.active.MoveToFront(e.elem)
+		}
+		victims = h.victims()
+	}
+	h.mu.Unlock()
+	h.hibernate(victims)
+
+	if err == nil {
+		err = fn(e.worker)
+	}
+
+	h.mu.Lock()
+	e.users--
+	h.mu.Unlock()
+	return err
+}
+
+// victims takes idle entries off the end of the active list until at most
+// maxActive remain active. Must be called with h.mu held.
+func (h *Hibernator) victims() []*hibernatorEntry {
+	var victims []*hibernatorEntry
+	excess := h.active.Len() - h.maxActive
+	for elem := h.active.Back(); elem != nil && excess > 0; {
+		prev := elem.Prev()
+		e := elem.Value.(*hibernatorEntry)
+		if e.users == 0 {
+			h.active.Remove(elem)
+			e.elem = nil
+			victims = append(victims, e)
+			excess--
+		}
+		elem = prev
+	}
+	return victims
+}
+
+func (h *Hibernator) hibernate(victims []*hibernatorEntry) {
+	for _, e := range victims {
+		e.mu.Lock()
+		h.mu.Lock()
+		// Used or removed again since it was picked.
+		idle := e.users == 0 && e.elem == nil && h.workers[e.key] == e
+		h.mu.Unlock()
+		if idle && !e.worker.Hibernated() {
+			sum := sha256.Sum256([]byte(e.key))
+			path := filepath.Join(h.dir, hex.EncodeToString(sum[:])+".hib")
+			if err := e.worker.Hibernate(path); err != nil {
+				// Keep it alive rather than lose it.
+				h.mu.Lock()
+				if h.workers[e.key] == e && e.elem == nil {
+					e.elem = h.active.PushBack(e)
+				}
+				h.mu.Unlock()
+			}
+		}
+		e.mu.Unlock()
+	}
+}
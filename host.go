@@ -0,0 +1,494 @@
+package v8worker
+
+/*
+#include <stdlib.h>
+#include "binding.h"
+#include "ipc.h"
+*/
+import "C"
+import (
+	"errors"
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"runtime"
+	"sync"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+// Default capacity of each ring between a Host and its process.
+const defaultHostRingSize = 1 << 20
+
+var (
+	errHostClosed = errors.New("worker host closed")
+	errRemote     = errors.New("not supported by workers in a host process")
+)
+
+// HostOptions configures a Host.
+type HostOptions struct {
+	// Path of the host binary, built with `make host`. Defaults to
+	// v8worker-host in PATH.
+	Path string
+	// Capacity in bytes of each of the two rings, rounded up to a power of
+	// two. Messages larger than a ring are split. Defaults to 1 MB.
+	RingSize int
+}
+
+// Host runs workers in a child process, so that a crash in V8 only takes down
+// the workers of that process, and V8's threads and garbage collector do not
+// compete with the Go runtime. Requests and messages travel over two rings in
+// shared memory, one in each direction, with futex wakeups.
+//
+// Workers created by a host are used like any other Worker. Load, Send,
+// SendSync, SendCompressed, TerminateExecution, GetHeapStatistics,
+// LowMemoryNotification and Dispose are supported. Streams, array buffers,
+// hibernation and the other options are not. A host runs one script at a
+// time; spread load over several hosts. Callbacks run on a goroutine of the
+// host, in the order the scripts sent their messages, and must not block on
+// calls into workers of the same host from $recvSync callbacks.
+type Host struct {
+	// Forked hosts are children of their zygote rather than of this
+	// process, see Zygote.
+	forked   bool
+	cmd      *exec.Cmd
+	pid      int
+	shmPath  string
+	exited   chan struct{}
+	exitOnce sync.Once
+
+	// Held for reading while the shared memory is used, and for writing to
+	// unmap it.
+	memMu    sync.RWMutex
+	mem      []byte
+	shm      *C.ipc_shm
+	toHost   *C.ipc_ring
+	toParent *C.ipc_ring
+	writeMu  sync.Mutex
+
+	mu      sync.Mutex
+	seq     uint32
+	pending map[uint32]chan hostResult
+	closed  bool
+	err     error
+
+	callbacks callbackQueue
+}
+
+type hostResult struct {
+	status  uint32
+	payload []byte
+}
+
+// StartHost starts a host process.
+func StartHost(opts *HostOptions) (*Host, error) {
+	return startHost(opts)
+}
+
+func startHost(opts *HostOptions, args ...string) (*Host, error) {
+	if opts == nil {
+		opts = new(HostOptions)
+	}
+	path := opts.Path
+	if path == "" {
+		path = "v8worker-host"
+	}
+	bin, err := exec.LookPath(path)
+	if err != nil {
+		return nil, err
+	}
+	ringSize := hostRingSize(opts)
+	mem, shmPath, err := createSharedMemory(int(C.ipc_shm_size(C.uint32_t(ringSize))))
+	if err != nil {
+		return nil, err
+	}
+	h := newHost(mem, shmPath, ringSize, false)
+	h.cmd = exec.Command(bin, append(args, shmPath)...)
+	h.cmd.Stdout = os.Stdout
+	h.cmd.Stderr = os.Stderr
+	if err := h.cmd.Start(); err != nil {
+		h.shutdown()
+		return nil, err
+	}
+	h.pid = h.cmd.Process.Pid
+	go func() {
+		err := h.cmd.Wait()
+		if err == nil {
+			err = errHostClosed
+		}
+		h.exit(err)
+	}()
+	return h, nil
+}
+
+func hostRingSize(opts *HostOptions) int {
+	want := opts.RingSize
+	if want <= 0 {
+		want = defaultHostRingSize
+	}
+	ringSize := 4096
+	for ringSize < want {
+		ringSize <<= 1
+	}
+	return ringSize
+}
+
+func newHost(mem []byte, shmPath string, ringSize int, forked bool) *Host {
+	h := &Host{
+		forked:  forked,
+		shmPath: shmPath,
+		exited:  make(chan struct{}),
+		mem:     mem,
+		shm:     (*C.ipc_shm)(unsafe.Pointer(&mem[0])),
+		pending: make(map[uint32]chan hostResult),
+	}
+	C.ipc_shm_init(h.shm, C.uint32_t(ringSize))
+	h.toHost = C.ipc_to_host(h.shm)
+	h.toParent = C.ipc_to_parent(h.shm)
+	h.callbacks.cond = sync.NewCond(&h.callbacks.mu)
+	go h.read()
+	go h.callbacks.run()
+	return h
+}
+
+// createSharedMemory creates a file of size bytes in /dev/shm, or the
+// temporary directory if there is none, and maps it.
+func createSharedMemory(size int) ([]byte, string, error) {
+	dir := "/dev/shm"
+	if _, err := os.Stat(dir); err != nil {
+		dir = os.TempDir()
+	}
+	f, err := ioutil.TempFile(dir, "v8worker-")
+	if err != nil {
+		return nil, "", err
+	}
+	defer f.Close()
+	if err := f.Truncate(int64(size)); err != nil {
+		os.Remove(f.Name())
+		return nil, "", err
+	}
+	mem, err := syscall.Mmap(int(f.Fd()), 0, size, syscall.PROT_READ|syscall.PROT_WRITE, syscall.MAP_SHARED)
+	if err != nil {
+		os.Remove(f.Name())
+		return nil, "", err
+	}
+	return mem, f.Name(), nil
+}
+
+// New creates a worker in the host process. See New.
+func (h *Host) New(cb ReceiveMessageCallback, syncCB ReceiveSyncMessageCallback) (*Worker, error) {
+	return h.NewWithOptions(cb, syncCB, nil)
+}
+
+// NewWithOptions creates a worker in the host process configured by opts.
+// Only HugePages, MaxHeapSizeMB, Codecs, SyncCache and Memoize apply.
+func (h *Host) NewWithOptions(cb ReceiveMessageCallback, syncCB ReceiveSyncMessageCallback, opts *Options) (*Worker, error) {
+	if opts == nil {
+		opts = new(Options)
+	}
+	id := registerCallbacks(cb, opts.SyncCache.wrap(syncCB))
+	cOptions := newCOptions(opts)
+	payload := C.GoBytes(unsafe.Pointer(&cOptions), C.int(unsafe.Sizeof(cOptions)))
+	if _, err := h.call(C.IPC_NEW, id, payload); err != nil {
+		callbacksMapLocker.Lock()
+		delete(callbacksMap, id)
+		callbacksMapLocker.Unlock()
+		return nil, err
+	}
+
+	worker := &Worker{
+		lastActive: time.Now().UnixNano(),
+		id:         id,
+		cOptions:   cOptions,
+		remote:     h,
+	}
+	runtime.SetFinalizer(worker, func(final_worker *Worker) {
+		final_worker.Dispose()
+	})
+	return worker, nil
+}
+
+// Exited is closed once the host process has exited.
+func (h *Host) Exited() <-chan struct{} {
+	return h.exited
+}
+
+// Err returns why the host process exited, or nil while it runs.
+func (h *Host) Err() error {
+	h.mu.Lock()
+	defer h.mu.Unlock()
+	return h.err
+}
+
+// Close stops the host process and with it all of its workers.
+func (h *Host) Close() error {
+	h.write(C.IPC_EXIT, 0, 0, nil)
+	select {
+	case <-h.exited:
+	case <-time.After(5 * time.Second):
+		syscall.Kill(h.pid, syscall.SIGKILL)
+		<-h.exited
+	}
+	return nil
+}
+
+// exit records why the host process exited and releases its resources.
+func (h *Host) exit(err error) {
+	h.exitOnce.Do(func() {
+		h.mu.Lock()
+		h.err = err
+		h.mu.Unlock()
+
+		h.shutdown()
+		close(h.exited)
+	})
+}
+
+// shutdown wakes everything blocked on the rings and releases the shared
+// memory once nothing uses it anymore.
+func (h *Host) shutdown() {
+	h.memMu.RLock()
+	C.ipc_close(h.toHost)
+	C.ipc_close(h.toParent)
+	h.memMu.RUnlock()
+
+	h.memMu.Lock()
+	defer h.memMu.Unlock()
+	if h.mem == nil {
+		return
+	}
+	syscall.Munmap(h.mem)
+	os.Remove(h.shmPath)
+	h.mem = nil
+}
+
+// read dispatches the messages from the host process until it closes its
+// ring.
+func (h *Host) read() {
+	h.memMu.RLock()
+	defer h.memMu.RUnlock()
+	for {
+		var m C.ipc_message
+		p := C.ipc_read(h.toParent, &m)
+		if p == nil {
+			break
+		}
+		payload := C.GoBytes(unsafe.Pointer(p), C.int(m.length))
+		C.free(unsafe.Pointer(p))
+
+		id := int(m.worker_id)
+		switch m.kind {
+		case C.IPC_RESULT:
+			h.mu.Lock()
+			ch := h.pending[uint32(m.seq)]
+			delete(h.pending, uint32(m.seq))
+			h.mu.Unlock()
+			if ch != nil {
+				ch <- hostResult{status: uint32(m.status), payload: payload}
+			}
+		case C.IPC_RECV:
+			h.callbacks.push(func() { recvCb(msgPointer(payload), id) })
+		case C.IPC_RECV_SYNC:
+			seq := uint32(m.seq)
+			h.callbacks.push(func() {
+				res := recvSyncCb(msgPointer(payload), id)
+				h.write(C.IPC_SYNC_RESPONSE, id, seq, []byte(C.GoString(res)))
+				C.free(unsafe.Pointer(res))
+			})
+		}
+	}
+
+	h.mu.Lock()
+	h.closed = true
+	for seq, ch := range h.pending {
+		ch <- hostResult{status: 1, payload: []byte(errHostClosed.Error())}
+		delete(h.pending, seq)
+	}
+	h.mu.Unlock()
+	h.callbacks.close()
+
+	// A forked host closes its ring when it exits, or its zygote does for
+	// it if it dies.
+	if h.forked {
+		go h.exit(errHostClosed)
+	}
+}
+
+// call sends a request to the host process and waits for its result.
+func (h *Host) call(kind C.uint32_t, id int, payload []byte) ([]byte, error) {
+	ch := make(chan hostResult, 1)
+	h.mu.Lock()
+	if h.closed {
+		h.mu.Unlock()
+		return nil, errHostClosed
+	}
+	// 0 is for requests without a result.
+	h.seq++
+	if h.seq == 0 {
+		h.seq++
+	}
+	seq := h.seq
+	h.pending[seq] = ch
+	h.mu.Unlock()
+
+	if err := h.write(kind, id, seq, payload); err != nil {
+		h.mu.Lock()
+		delete(h.pending, seq)
+		h.mu.Unlock()
+		return nil, err
+	}
+	r := <-ch
+	if r.status != 0 {
+		return nil, errors.New(string(r.payload))
+	}
+	return r.payload, nil
+}
+
+// write queues a message for the host process. It blocks while the ring is
+// full.
+func (h *Host) write(kind C.uint32_t, id int, seq uint32, payload []byte) error {
+	h.memMu.RLock()
+	defer h.memMu.RUnlock()
+	if h.mem == nil {
+		return errHostClosed
+	}
+
+	m := C.ipc_message{
+		kind:      kind,
+		worker_id: C.uint32_t(id),
+		seq:       C.uint32_t(seq),
+		length:    C.size_t(len(payload)),
+	}
+	var p unsafe.Pointer
+	if len(payload) > 0 {
+		p = unsafe.Pointer(&payload[0])
+	}
+	h.writeMu.Lock()
+	r := C.ipc_write(h.toHost, &m, p)
+	h.writeMu.Unlock()
+	if r != 0 {
+		return errHostClosed
+	}
+	return nil
+}
+
+func (h *Host) load(id int, origin *ScriptOrigin, code string) error {
+	cOrigin := C.ipc_load{
+		line_offset:   C.int32_t(origin.LineOffset),
+		column_offset: C.int32_t(origin.ColumnOffset),
+		script_id:     C.int32_t(origin.ScriptId),
+	}
+	if origin.IsSharedCrossOrigin {
+		cOrigin.is_shared_cross_origin = 1
+	}
+	if origin.IsEmbedderDebugScript {
+		cOrigin.is_embedder_debug_script = 1
+	}
+	if origin.IsOpaque {
+		cOrigin.is_opaque = 1
+	}
+	size := int(unsafe.Sizeof(cOrigin))
+	payload := make([]byte, 0, size+len(origin.ScriptName)+len(origin.SourceMapURL)+2+len(code))
+	payload = append(payload, C.GoBytes(unsafe.Pointer(&cOrigin), C.int(size))...)
+	payload = append(payload, origin.ScriptName...)
+	payload = append(payload, 0)
+	payload = append(payload, origin.SourceMapURL...)
+	payload = append(payload, 0)
+	payload = append(payload, code...)
+	_, err := h.call(C.IPC_LOAD, id, payload)
+	return err
+}
+
+func (h *Host) send(id int, msg []byte) error {
+	_, err := h.call(C.IPC_SEND, id, msg)
+	return err
+}
+
+func (h *Host) sendSync(id int, msg string) string {
+	res, err := h.call(C.IPC_SEND_SYNC, id, []byte(msg))
+	if err != nil {
+		return "err: " + err.Error()
+	}
+	return string(res)
+}
+
+func (h *Host) heapStatistics(id int, hs *C.struct_heap_statistics_s) {
+	res, err := h.call(C.IPC_HEAP_STATISTICS, id, nil)
+	if err == nil && len(res) == int(unsafe.Sizeof(*hs)) {
+		*hs = *(*C.struct_heap_statistics_s)(unsafe.Pointer(&res[0]))
+	}
+}
+
+func (h *Host) lowMemoryNotification(id int) {
+	h.call(C.IPC_LOW_MEMORY, id, nil)
+}
+
+// terminate asks the host's watchdog thread to stop the script running in
+// worker id. The host's main thread may be busy running it.
+func (h *Host) terminate(id int) {
+	h.memMu.RLock()
+	if h.mem != nil {
+		C.ipc_terminate(h.shm, C.uint32_t(id))
+	}
+	h.memMu.RUnlock()
+}
+
+// dispose releases a worker without waiting, so that it is safe from
+// finalizers. A forked host exits with its worker.
+func (h *Host) dispose(id int) {
+	if h.forked {
+		go h.Close()
+		return
+	}
+	go h.write(C.IPC_DISPOSE, id, 0, nil)
+}
+
+// msgPointer returns payload as a C string for the callbacks shared with the
+// binding. The ring NUL terminates payloads, and so does this.
+func msgPointer(payload []byte) *C.char {
+	payload = append(payload, 0)
+	return (*C.char)(unsafe.Pointer(&payload[0]))
+}
+
+// callbackQueue runs callbacks one at a time, in order, on its own
+// goroutine. It is unbounded so that the reader of the ring never blocks on
+// a callback that waits for a result from the same ring.
+type callbackQueue struct {
+	mu     sync.Mutex
+	cond   *sync.Cond
+	fns    []func()
+	closed bool
+}
+
+func (q *callbackQueue) push(fn func()) {
+	q.mu.Lock()
+	q.fns = append(q.fns, fn)
+	q.cond.Signal()
+	q.mu.Unlock()
+}
+
+func (q *callbackQueue) close() {
+	q.mu.Lock()
+	q.closed = true
+	q.cond.Signal()
+	q.mu.Unlock()
+}
+
+func (q *callbackQueue) run() {
+	for {
+		q.mu.Lock()
+		for len(q.fns) == 0 && !q.closed {
+			q.cond.Wait()
+		}
+		if len(q.fns) == 0 {
+			q.mu.Unlock()
+			return
+		}
+		fn := q.fns[0]
+		q.fns[0] = nil
+		q.fns = q.fns[1:]
+		q.mu.Unlock()
+		fn()
+	}
+}
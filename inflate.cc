@@ -0,0 +1,319 @@
+// A small raw DEFLATE decoder, modelled after zlib's contrib/puff, so that
+// compressed messages can be handled without linking zlib.
+#include <stdint.h>
+#include <string.h>
+#include "inflate.h"
+
+namespace {
+
+const int kMaxBits = 15;       // maximum bits in a code
+const int kMaxLCodes = 286;    // maximum number of literal/length codes
+const int kMaxDCodes = 30;     // maximum number of distance codes
+const int kMaxCodes = kMaxLCodes + kMaxDCodes;
+const int kFixLCodes = 288;    // number of fixed literal/length codes
+
+struct State {
+  const unsigned char* in;
+  size_t in_len;
+  size_t in_pos;
+  unsigned long bitbuf;
+  int bitcnt;
+  bool error;
+  InflateOutput* out;
+};
+
+struct Huffman {
+  short* count;   // number of symbols of each length
+  short* symbol;  // canonically ordered symbols
+};
+
+// Returns need bits from the input stream. Sets s->error on end of input.
+int Bits(State* s, int need) {
+  unsigned long val = s->bitbuf;
+  while (s->bitcnt < need) {
+    if (s->in_pos == s->in_len) {
+      s->error = true;
+      return 0;
+    }
+    val |= (unsigned long)s->in[s->in_pos++] << s->bitcnt;
+    s->bitcnt += 8;
+  }
+  s->bitbuf = val >> need;
+  s->bitcnt -= need;
+  return (int)(val & ((1UL << need) - 1));
+}
+
+// Makes room for n more bytes of output. Returns zero, kInflateTooLarge past
+// the output's limit, or -1 if it cannot be allocated.
+int Grow(State* s, size_t n) {
+  if (n > s->out->limit - s->out->length) return kInflateTooLarge;
+  return s->out->Reserve(n) ? 0 : -1;
+}
+
+int Put(State* s, const unsigned char* p, size_t n) {
+  if (n == 0) return 0;
+  int err = Grow(s, n);
+  if (err != 0) return err;
+  memcpy(s->out->data + s->out->length, p, n);
+  s->out->length += n;
+  return 0;
+}
+
+int Stored(State* s) {
+  // discard leftover bits from the current byte
+  s->bitbuf = 0;
+  s->bitcnt = 0;
+
+  if (s->in_len - s->in_pos < 4) return -2;
+  unsigned len = s->in[s->in_pos] | (s->in[s->in_pos + 1] << 8);
+  unsigned nlen = s->in[s->in_pos + 2] | (s->in[s->in_pos + 3] << 8);
+  s->in_pos += 4;
+  if (len != (~nlen & 0xffff)) return -2;
+  if (s->in_len - s->in_pos < len) return -2;
+
+  int err = Put(s, s->in + s->in_pos, len);
+  if (err != 0) return err;
+  s->in_pos += len;
+  return 0;
+}
+
+int Decode(State* s, const Huffman* h) {
+  int code = 0;   // bits being decoded
+  int first = 0;  // first code of length len
+  int index = 0;  // index of first code of length len in symbol table
+  for (int len = 1; len <= kMaxBits; len++) {
+    code |= Bits(s, 1);
+    if (s->error) return -2;
+    int count = h->count[len];
+    if (code - count < first) return h->symbol[index + (code - first)];
+    index += count;
+    first += count;
+    first <<= 1;
+    code <<= 1;
+  }
+  return -10;  // ran out of codes
+}
+
+// Builds a canonical decoding table from code lengths. Returns zero for a
+// complete code, positive for an incomplete code and negative if the lengths
+// are over-subscribed.
+int Construct(Huffman* h, const short* length, int n) {
+  for (int len = 0; len <= kMaxBits; len++) h->count[len] = 0;
+  for (int symbol = 0; symbol < n; symbol++) h->count[length[symbol]]++;
+  if (h->count[0] == n) return 0;
+
+  int left = 1;
+  for (int len = 1; len <= kMaxBits; len++) {
+    left <<= 1;
+    left -= h->count[len];
+    if (left < 0) return left;
+  }
+
+  short offs[kMaxBits + 1];
+  offs[1] = 0;
+  for (int len = 1; len < kMaxBits; len++) {
+    offs[len + 1] = offs[len] + h->count[len];
+  }
+  for (int symbol = 0; symbol < n; symbol++) {
+    if (length[symbol] != 0) h->symbol[offs[length[symbol]]++] = symbol;
+  }
+  return left;
+}
+
+const short kLengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const short kLengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const short kDistBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+const short kDistExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+int Codes(State* s, const Huffman* lencode, const Huffman* distcode) {
+  int symbol;
+  do {
+    symbol = Decode(s, lencode);
+    if (symbol < 0) return symbol;
+    if (symbol < 256) {
+      unsigned char c = (unsigned char)symbol;
+      int err = Put(s, &c, 1);
+      if (err != 0) return err;
+    } else if (symbol > 256) {
+      symbol -= 257;
+      if (symbol >= 29) return -10;
+      size_t len = kLengthBase[symbol] + Bits(s, kLengthExtra[symbol]);
+      symbol = Decode(s, distcode);
+      if (symbol < 0) return symbol;
+      size_t dist = kDistBase[symbol] + Bits(s, kDistExtra[symbol]);
+      if (s->error) return -2;
+      if (dist > s->out->length) return -11;
+
+      int err = Grow(s, len);
+      if (err != 0) return err;
+      // Byte by byte since the source and destination may overlap.
+      unsigned char* to = s->out->data + s->out->length;
+      const unsigned char* from = to - dist;
+      for (size_t i = 0; i < len; i++) to[i] = from[i];
+      s->out->length += len;
+    }
+  } while (symbol != 256);
+  return 0;
+}
+
+struct FixedTables {
+  short lencnt[kMaxBits + 1], lensym[kFixLCodes];
+  short distcnt[kMaxBits + 1], distsym[kMaxDCodes];
+  Huffman lencode, distcode;
+
+  FixedTables() {
+    short lengths[kFixLCodes];
+    lencode.count = lencnt;
+    lencode.symbol = lensym;
+    distcode.count = distcnt;
+    distcode.symbol = distsym;
+
+    int symbol = 0;
+    for (; symbol < 144; symbol++) lengths[symbol] = 8;
+    for (; symbol < 256; symbol++) lengths[symbol] = 9;
+    for (; symbol < 280; symbol++) lengths[symbol] = 7;
+    for (; symbol < kFixLCodes; symbol++) lengths[symbol] = 8;
+    Construct(&lencode, lengths, kFixLCodes);
+
+    for (symbol = 0; symbol < kMaxDCodes; symbol++) lengths[symbol] = 5;
+    Construct(&distcode, lengths, kMaxDCodes);
+  }
+};
+
+int Fixed(State* s) {
+  static const FixedTables tables;
+  return Codes(s, &tables.lencode, &tables.distcode);
+}
+
+int Dynamic(State* s) {
+  static const short order[19] = {
+      16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+  short lengths[kMaxCodes];
+  short lencnt[kMaxBits + 1], lensym[kMaxLCodes];
+  short distcnt[kMaxBits + 1], distsym[kMaxDCodes];
+  Huffman lencode = {lencnt, lensym};
+  Huffman distcode = {distcnt, distsym};
+
+  int nlen = Bits(s, 5) + 257;
+  int ndist = Bits(s, 5) + 1;
+  int ncode = Bits(s, 4) + 4;
+  if (s->error) return -2;
+  if (nlen > kMaxLCodes || ndist > kMaxDCodes) return -3;
+
+  int index;
+  for (index = 0; index < ncode; index++) lengths[order[index]] = Bits(s, 3);
+  for (; index < 19; index++) lengths[order[index]] = 0;
+  if (s->error) return -2;
+
+  // The code length code must be complete.
+  if (Construct(&lencode, lengths, 19) != 0) return -4;
+
+  index = 0;
+  while (index < nlen + ndist) {
+    int symbol = Decode(s, &lencode);
+    if (symbol < 0) return symbol;
+    if (symbol < 16) {
+      lengths[index++] = symbol;
+    } else {
+      short len = 0;
+      if (symbol == 16) {
+        if (index == 0) return -5;
+        len = lengths[index - 1];
+        symbol = 3 + Bits(s, 2);
+      } else if (symbol == 17) {
+        symbol = 3 + Bits(s, 3);
+      } else {
+        symbol = 11 + Bits(s, 7);
+      }
+      if (s->error) return -2;
+      if (index + symbol > nlen + ndist) return -6;
+      while (symbol--) lengths[index++] = len;
+    }
+  }
+
+  if (lengths[256] == 0) return -9;
+
+  // Incomplete codes are only allowed if they consist of a single code.
+  int err = Construct(&lencode, lengths, nlen);
+  if (err && (err < 0 || nlen != lencode.count[0] + lencode.count[1])) {
+    return -7;
+  }
+  err = Construct(&distcode, lengths + nlen, ndist);
+  if (err && (err < 0 || ndist != distcode.count[0] + distcode.count[1])) {
+    return -8;
+  }
+
+  return Codes(s, &lencode, &distcode);
+}
+
+}  // namespace
+
+bool InflateOutput::Reserve(size_t n) {
+  if (capacity - length >= n) return true;
+  if (n > SIZE_MAX - length) return false;
+  size_t need = length + n;
+
+  size_t want = capacity == 0 ? 4096 : capacity;
+  while (want < need) {
+    if (want > SIZE_MAX / 2) {
+      want = need;
+      break;
+    }
+    want *= 2;
+  }
+  return Resize(want);
+}
+
+bool InflateOutput::ReserveExact(size_t n) {
+  if (capacity - length >= n) return true;
+  if (n > SIZE_MAX - length) return false;
+  return Resize(length + n);
+}
+
+bool InflateOutput::Resize(size_t want) {
+  unsigned char* grown = static_cast<unsigned char*>(Allocate(want));
+  if (grown == NULL) return false;
+  if (data != NULL) {
+    memcpy(grown, data, length);
+    Free(data, capacity);
+  }
+  data = grown;
+  capacity = want;
+  return true;
+}
+
+int Inflate(const unsigned char* in, size_t in_len, InflateOutput* out) {
+  State s;
+  s.in = in;
+  s.in_len = in_len;
+  s.in_pos = 0;
+  s.bitbuf = 0;
+  s.bitcnt = 0;
+  s.error = false;
+  s.out = out;
+
+  int last, err;
+  do {
+    last = Bits(&s, 1);
+    int type = Bits(&s, 2);
+    if (s.error) return -2;
+    switch (type) {
+      case 0: err = Stored(&s); break;
+      case 1: err = Fixed(&s); break;
+      case 2: err = Dynamic(&s); break;
+      default: err = -1; break;
+    }
+    if (err != 0) return err < 0 ? err : -1;
+  } while (!last);
+
+  return 0;
+}
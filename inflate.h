@@ -0,0 +1,52 @@
+#ifndef V8WORKER_INFLATE_H_
+#define V8WORKER_INFLATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Returned by Inflate when the output would exceed InflateOutput::limit.
+const int kInflateTooLarge = -12;
+
+// Growable output buffer for Inflate. Memory is obtained through the virtual
+// Allocate/Free hooks so the binding can decompress straight into memory owned
+// by a worker's ArrayBuffer allocator and hand it to V8 without another copy.
+// Subclasses own the buffer until Release and must free it in their destructor.
+class InflateOutput {
+ public:
+  InflateOutput() : data(NULL), length(0), capacity(0), limit(SIZE_MAX) {}
+  virtual ~InflateOutput() {}
+
+  virtual void* Allocate(size_t size) { return malloc(size); }
+  virtual void Free(void* ptr, size_t) { free(ptr); }
+
+  // Makes room for at least n more bytes, doubling the buffer as needed.
+  // Returns false on allocation failure or if the size overflows.
+  bool Reserve(size_t n);
+  // Makes room for exactly n more bytes, for an output of known size.
+  bool ReserveExact(size_t n);
+
+  // Gives up ownership of the buffer. The caller must release it with Free.
+  unsigned char* Release() {
+    unsigned char* out = data;
+    data = NULL;
+    length = capacity = 0;
+    return out;
+  }
+
+  unsigned char* data;
+  size_t length;
+  size_t capacity;
+  // Inflate fails with kInflateTooLarge rather than grow length past this.
+  size_t limit;
+
+ private:
+  bool Resize(size_t want);
+};
+
+// Decompresses a raw DEFLATE (RFC 1951) stream into out. Returns zero on
+// success, kInflateTooLarge if the output would exceed out->limit, and
+// another negative value if the input is truncated or corrupt.
+int Inflate(const unsigned char* in, size_t in_len, InflateOutput* out);
+
+#endif  // V8WORKER_INFLATE_H_
@@ -0,0 +1,75 @@
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "codec.h"
+#include "hash.h"
+#include "intern.h"
+
+struct InternedEntry {
+  uint64_t hash;
+  std::string data;
+  // Strings using data, in any isolate.
+  size_t refs;
+};
+
+namespace {
+
+std::mutex intern_mutex;
+std::unordered_map<uint64_t, InternedEntry*>* interned;
+size_t interned_bytes;
+
+}  // namespace
+
+InternedSource* InternedSource::New(const char* data, size_t length) {
+  if (!IsAsciiBytes(reinterpret_cast<const uint8_t*>(data), length)) {
+    return NULL;
+  }
+  uint64_t hash = Xxh3(data, length, 0);
+
+  std::lock_guard<std::mutex> lock(intern_mutex);
+  // Allocated on first use and never freed, as the last strings may be
+  // released by isolates torn down during exit.
+  if (interned == NULL) {
+    interned = new std::unordered_map<uint64_t, InternedEntry*>();
+  }
+  std::unordered_map<uint64_t, InternedEntry*>::iterator it =
+      interned->find(hash);
+  if (it != interned->end()) {
+    InternedEntry* entry = it->second;
+    if (entry->data.compare(0, std::string::npos, data, length) != 0) {
+      return NULL;
+    }
+    entry->refs++;
+    return new InternedSource(entry);
+  }
+
+  InternedEntry* entry = new InternedEntry;
+  entry->hash = hash;
+  entry->data.assign(data, length);
+  entry->refs = 1;
+  (*interned)[hash] = entry;
+  interned_bytes += length;
+  return new InternedSource(entry);
+}
+
+InternedSource::~InternedSource() {
+  std::lock_guard<std::mutex> lock(intern_mutex);
+  if (--entry_->refs > 0) return;
+  interned->erase(entry_->hash);
+  interned_bytes -= entry_->data.size();
+  delete entry_;
+}
+
+const char* InternedSource::data() const {
+  return entry_->data.data();
+}
+
+size_t InternedSource::length() const {
+  return entry_->data.size();
+}
+
+void InternedSource::GetStatistics(size_t* sources, size_t* bytes) {
+  std::lock_guard<std::mutex> lock(intern_mutex);
+  *sources = interned == NULL ? 0 : interned->size();
+  *bytes = interned_bytes;
+}
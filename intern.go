@@ -0,0 +1,16 @@
+package v8worker
+
+/*
+#include "binding.h"
+*/
+import "C"
+
+// InternedSourceStatistics returns the number of distinct sources loaded by
+// the workers of this process and the bytes they use. A source is kept once
+// however many workers load it, as long as it is ASCII and at least 1 KB
+// long. Workers running in a Host share theirs there.
+func InternedSourceStatistics() (sources, bytes int) {
+	var cs, cb C.size_t
+	C.interned_sources_get_statistics(&cs, &cb)
+	return int(cs), int(cb)
+}
@@ -0,0 +1,37 @@
+#ifndef V8WORKER_INTERN_H_
+#define V8WORKER_INTERN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "v8.h"
+
+struct InternedEntry;
+
+// Sources loaded into workers, kept once per process however many isolates
+// load them. V8 holds on to the source of every script for lazy compilation
+// and stack traces, so a bundle loaded by hundreds of workers would
+// otherwise be copied into each of their heaps. Only ASCII sources can be
+// shared, as one-byte external strings.
+class InternedSource : public v8::String::ExternalOneByteStringResource {
+ public:
+  // Returns a resource for a new external string with the interned copy of
+  // data, or NULL if data is not ASCII or collides with another source.
+  // V8 deletes the resource with the string, releasing the copy once no
+  // string uses it anymore.
+  static InternedSource* New(const char* data, size_t length);
+
+  virtual ~InternedSource();
+
+  virtual const char* data() const;
+  virtual size_t length() const;
+
+  // Number of distinct sources and their bytes.
+  static void GetStatistics(size_t* sources, size_t* bytes);
+
+ private:
+  explicit InternedSource(InternedEntry* entry) : entry_(entry) {}
+
+  InternedEntry* entry_;
+};
+
+#endif  // V8WORKER_INTERN_H_
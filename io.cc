@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <thread>
+#include "io.h"
+
+IoPool::IoPool(int threads) : threads_(threads), started_(false) {}
+
+void IoPool::Post(const std::function<void()>& job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!started_) {
+    // The threads live as long as the process, like the reaper.
+    for (int i = 0; i < threads_; i++) std::thread(&IoPool::Run, this).detach();
+    started_ = true;
+  }
+  jobs_.push_back(job);
+  ready_.notify_one();
+}
+
+void IoPool::BeforeFork() {
+  mutex_.lock();
+}
+
+void IoPool::AfterForkInParent() {
+  mutex_.unlock();
+}
+
+void IoPool::AfterForkInChild() {
+  jobs_.clear();
+  started_ = false;
+  mutex_.unlock();
+}
+
+void IoPool::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    ready_.wait(lock, [&] { return !jobs_.empty(); });
+    std::function<void()> job = jobs_.front();
+    jobs_.pop_front();
+    lock.unlock();
+    job();
+    lock.lock();
+  }
+}
+
+namespace {
+
+bool Fail(const std::string& path, int err, std::string* error) {
+  *error = path + ": " + strerror(err);
+  return false;
+}
+
+bool RealPath(const std::string& path, std::string* resolved) {
+  char* p = realpath(path.c_str(), NULL);
+  if (p == NULL) return false;
+  resolved->assign(p);
+  free(p);
+  return true;
+}
+
+bool IsUnder(const std::string& root, const std::string& resolved) {
+  return resolved == root ||
+      resolved.compare(0, root.size() + 1, root + "/") == 0;
+}
+
+// Whether path, relative to a directory, leads out of it through "..",
+// without looking at the file system.
+bool EscapesLexically(const std::string& path) {
+  int depth = 0;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) end = path.size();
+    std::string part = path.substr(start, end - start);
+    if (part == "..") {
+      if (--depth < 0) return true;
+    } else if (!part.empty() && part != ".") {
+      depth++;
+    }
+    start = end + 1;
+  }
+  return false;
+}
+
+// Whether path, under root, is simply missing: the closest ancestor that
+// exists resolves under root, and nothing on the way is a dangling symlink.
+bool MissingUnder(const std::string& root, std::string path) {
+  for (;;) {
+    struct stat st;
+    // Present but not resolved: a dangling symlink.
+    if (lstat(path.c_str(), &st) == 0) return false;
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos || slash < root.size()) return false;
+    path.resize(slash);
+    std::string resolved;
+    if (RealPath(path, &resolved)) return IsUnder(root, resolved);
+  }
+}
+
+}  // namespace
+
+bool ResolveFileRoot(const char* root, std::string* resolved, std::string* error) {
+  struct stat st;
+  if (!RealPath(root, resolved) || stat(resolved->c_str(), &st) != 0) {
+    return Fail(root, errno, error);
+  }
+  if (!S_ISDIR(st.st_mode)) return Fail(root, ENOTDIR, error);
+  return true;
+}
+
+bool ReadFileUnder(const std::string& root, const std::string& path,
+                   uint64_t offset, size_t length, bool to_end,
+                   v8::ArrayBuffer::Allocator* allocator, void** data,
+                   size_t* read, std::string* error) {
+  *data = NULL;
+  *read = 0;
+
+  // realpath follows every symlink and "..", so checking the result against
+  // root is enough. A file swapped for a symlink between the check and the
+  // open can still escape; roots are not meant to be writable by scripts.
+  // Paths that cannot be resolved fail as refused unless their directory is
+  // under root and they do not exist, so that scripts cannot tell which
+  // files exist outside of it.
+  if (EscapesLexically(path)) return Fail(path, EACCES, error);
+  std::string full = root + "/" + path;
+  std::string resolved;
+  if (!RealPath(full, &resolved)) {
+    int err = errno;
+    if (err != ENOENT || !MissingUnder(root, full)) err = EACCES;
+    return Fail(path, err, error);
+  }
+  if (!IsUnder(root, resolved)) return Fail(path, EACCES, error);
+
+  int fd = open(resolved.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return Fail(path, errno, error);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int err = errno;
+    close(fd);
+    return Fail(path, err, error);
+  }
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    return Fail(path, S_ISDIR(st.st_mode) ? EISDIR : EINVAL, error);
+  }
+
+  uint64_t size = st.st_size;
+  uint64_t rest = offset < size ? size - offset : 0;
+  if (to_end || length > rest) length = rest;
+  if (length == 0) {
+    close(fd);
+    return true;
+  }
+
+  char* buffer = static_cast<char*>(allocator->AllocateUninitialized(length));
+  if (buffer == NULL) {
+    close(fd);
+    return Fail(path, ENOMEM, error);
+  }
+  size_t n = 0;
+  while (n < length) {
+    ssize_t r = pread(fd, buffer + n, length - n, offset + n);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) {
+      int err = errno;
+      close(fd);
+      allocator->Free(buffer, length);
+      return Fail(path, err, error);
+    }
+    if (r == 0) break;
+    n += r;
+  }
+  close(fd);
+
+  if (n == 0) {
+    allocator->Free(buffer, length);
+    return true;
+  }
+  if (n < length) {
+    // The file shrank. Whoever frees the buffer only knows n.
+    char* shorter = static_cast<char*>(allocator->AllocateUninitialized(n));
+    if (shorter == NULL) {
+      allocator->Free(buffer, length);
+      return Fail(path, ENOMEM, error);
+    }
+    memcpy(shorter, buffer, n);
+    allocator->Free(buffer, length);
+    buffer = shorter;
+  }
+  *data = buffer;
+  *read = n;
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef V8WORKER_IO_H_
+#define V8WORKER_IO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include "v8.h"
+
+// Threads running the blocking reads behind $readFile, so that javascript
+// is never held up by the disk. Unlike the reaper the queue is unbounded:
+// a job only holds a few strings until it runs.
+class IoPool {
+ public:
+  explicit IoPool(int threads);
+
+  // Queues job, starting the threads on first use.
+  void Post(const std::function<void()>& job);
+
+  // Fork handlers, see pthread_atfork and Reaper. The child drops the jobs
+  // of the parent and starts its own threads on the next Post, so reads
+  // pending at fork never complete there.
+  void BeforeFork();
+  void AfterForkInParent();
+  void AfterForkInChild();
+
+ private:
+  void Run();
+
+  int threads_;
+  bool started_;
+  std::deque<std::function<void()> > jobs_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+};
+
+// Resolves root to an absolute path without symlinks. Returns false with
+// error set if it is not a directory.
+bool ResolveFileRoot(const char* root, std::string* resolved, std::string* error);
+
+// Reads length bytes of the file at path, from offset on, or the rest of the
+// file if to_end is set. path is relative to root, which must have been
+// resolved by ResolveFileRoot; paths leading outside of it, through ".." or
+// symlinks, are refused. The bytes are read into memory from allocator,
+// which the caller owns; *data is NULL if none were read. Fewer bytes than
+// length are read at the end of the file. Returns false with error set on
+// failure.
+bool ReadFileUnder(const std::string& root, const std::string& path,
+                   uint64_t offset, size_t length, bool to_end,
+                   v8::ArrayBuffer::Allocator* allocator, void** data,
+                   size_t* read, std::string* error);
+
+#endif  // V8WORKER_IO_H_
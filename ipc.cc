@@ -0,0 +1,239 @@
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ipc.h"
+
+namespace {
+
+// Header of each record in a ring. A message larger than half the ring is
+// split into records flagged kMore but the last.
+struct Record {
+  uint32_t size;  // including the header and padding
+  uint32_t flags;
+  uint32_t kind;
+  uint32_t worker_id;
+  uint32_t seq;
+  uint32_t status;
+  uint32_t length;  // of the payload
+  uint32_t reserved;
+};
+
+// Fills the end of the ring when a record does not fit before wrapping.
+const uint32_t kPad = 1;
+const uint32_t kMore = 2;
+
+size_t Align(size_t n, size_t alignment) {
+  return (n + alignment - 1) & ~(alignment - 1);
+}
+
+uint32_t Load(uint32_t* p) {
+  return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+void Store(uint32_t* p, uint32_t v) {
+  __atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+// The futexes live in memory shared between processes, so they must not use
+// FUTEX_PRIVATE_FLAG.
+void FutexWait(uint32_t* futex, uint32_t value) {
+#ifdef __linux__
+  syscall(SYS_futex, futex, FUTEX_WAIT, value, NULL, NULL, 0);
+#else
+  if (Load(futex) == value) usleep(50);
+#endif
+}
+
+void FutexWakeAll(uint32_t* futex) {
+#ifdef __linux__
+  syscall(SYS_futex, futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+// Wakes the other side if it waits on futex. Waking costs a syscall, so it
+// is skipped while nobody waits.
+void Signal(uint32_t* futex, uint32_t* waiters) {
+  __atomic_add_fetch(futex, 1, __ATOMIC_SEQ_CST);
+  if (Load(waiters) > 0) FutexWakeAll(futex);
+}
+
+// Sleeps on futex unless ready() already holds. Registering as a waiter
+// before checking ready() means a Signal in between is never missed: either
+// it sees the waiter or ready() sees its update.
+template <class Ready>
+void Wait(uint32_t* futex, uint32_t* waiters, Ready ready) {
+  uint32_t value = Load(futex);
+  __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  if (!ready()) FutexWait(futex, value);
+  __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+char* RingData(ipc_ring* r) {
+  return reinterpret_cast<char*>(r) + Align(sizeof(ipc_ring), 64);
+}
+
+bool WriteRecord(ipc_ring* r, const ipc_message* m, const char* payload,
+                 size_t length, uint32_t flags) {
+  uint32_t capacity = r->capacity;
+  uint32_t need = Align(sizeof(Record) + length, 8);
+  uint32_t tail = r->tail;
+  uint32_t offset = tail & (capacity - 1);
+  uint32_t contiguous = capacity - offset;
+  uint32_t total = contiguous < need ? contiguous + need : need;
+
+  for (;;) {
+    if (Load(&r->closed)) return false;
+    if (capacity - (tail - Load(&r->head)) >= total) break;
+    Wait(&r->space_futex, &r->space_waiters, [&] {
+      return Load(&r->closed) || capacity - (tail - Load(&r->head)) >= total;
+    });
+  }
+
+  char* data = RingData(r);
+  if (contiguous < need) {
+    // Too short for a header is skipped by the reader without one.
+    if (contiguous >= sizeof(Record)) {
+      Record pad = {contiguous, kPad, 0, 0, 0, 0, 0, 0};
+      memcpy(data + offset, &pad, sizeof(pad));
+    }
+    tail += contiguous;
+    offset = 0;
+  }
+
+  Record rec = {need, flags, m->kind, m->worker_id, m->seq, m->status,
+                static_cast<uint32_t>(length), 0};
+  memcpy(data + offset, &rec, sizeof(rec));
+  if (length > 0) memcpy(data + offset + sizeof(rec), payload, length);
+  Store(&r->tail, tail + need);
+  Signal(&r->data_futex, &r->data_waiters);
+  return true;
+}
+
+// Appends the payload of the next record to *out and returns its header.
+bool ReadRecord(ipc_ring* r, Record* rec, char** out, size_t* length) {
+  uint32_t capacity = r->capacity;
+  char* data = RingData(r);
+
+  for (;;) {
+    uint32_t head = r->head;
+    if (head == Load(&r->tail)) {
+      if (Load(&r->closed)) return false;
+      Wait(&r->data_futex, &r->data_waiters, [&] {
+        return Load(&r->closed) || Load(&r->tail) != head;
+      });
+      continue;
+    }
+
+    uint32_t offset = head & (capacity - 1);
+    uint32_t skip = capacity - offset;
+    if (skip >= sizeof(Record)) {
+      memcpy(rec, data + offset, sizeof(*rec));
+      if (!(rec->flags & kPad)) {
+        size_t n = rec->length;
+        *out = static_cast<char*>(realloc(*out, *length + n + 1));
+        memcpy(*out + *length, data + offset + sizeof(*rec), n);
+        *length += n;
+        Store(&r->head, head + rec->size);
+        Signal(&r->space_futex, &r->space_waiters);
+        return true;
+      }
+      skip = rec->size;
+    }
+    Store(&r->head, head + skip);
+    Signal(&r->space_futex, &r->space_waiters);
+  }
+}
+
+}  // namespace
+
+extern "C" {
+
+size_t ipc_shm_size(uint32_t ring_capacity) {
+  size_t ring_size = Align(sizeof(ipc_ring), 64) + ring_capacity;
+  return Align(sizeof(ipc_shm), 64) + 2 * ring_size;
+}
+
+void ipc_shm_init(ipc_shm* shm, uint32_t ring_capacity) {
+  memset(shm, 0, ipc_shm_size(ring_capacity));
+  shm->magic = IPC_MAGIC;
+  shm->ring_capacity = ring_capacity;
+  ipc_to_host(shm)->capacity = ring_capacity;
+  ipc_to_parent(shm)->capacity = ring_capacity;
+}
+
+ipc_ring* ipc_to_host(ipc_shm* shm) {
+  char* base = reinterpret_cast<char*>(shm);
+  return reinterpret_cast<ipc_ring*>(base + Align(sizeof(ipc_shm), 64));
+}
+
+ipc_ring* ipc_to_parent(ipc_shm* shm) {
+  char* to_host = reinterpret_cast<char*>(ipc_to_host(shm));
+  size_t ring_size = Align(sizeof(ipc_ring), 64) + shm->ring_capacity;
+  return reinterpret_cast<ipc_ring*>(to_host + ring_size);
+}
+
+int ipc_write(ipc_ring* r, const ipc_message* m, const void* payload) {
+  // Records of up to half the ring always fit once it drains, padding
+  // included.
+  size_t max_chunk = r->capacity / 2 - sizeof(Record);
+  const char* p = static_cast<const char*>(payload);
+  size_t left = m->length;
+  do {
+    size_t n = left < max_chunk ? left : max_chunk;
+    left -= n;
+    if (!WriteRecord(r, m, p, n, left > 0 ? kMore : 0)) return 1;
+    p += n;
+  } while (left > 0);
+  return 0;
+}
+
+char* ipc_read(ipc_ring* r, ipc_message* m) {
+  char* out = NULL;
+  size_t length = 0;
+  Record rec;
+  do {
+    if (!ReadRecord(r, &rec, &out, &length)) {
+      free(out);
+      return NULL;
+    }
+  } while (rec.flags & kMore);
+
+  m->kind = rec.kind;
+  m->worker_id = rec.worker_id;
+  m->seq = rec.seq;
+  m->status = rec.status;
+  m->length = length;
+  if (out == NULL) out = static_cast<char*>(malloc(1));
+  out[length] = '\0';
+  return out;
+}
+
+void ipc_close(ipc_ring* r) {
+  Store(&r->closed, 1);
+  __atomic_add_fetch(&r->data_futex, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&r->space_futex, 1, __ATOMIC_SEQ_CST);
+  FutexWakeAll(&r->data_futex);
+  FutexWakeAll(&r->space_futex);
+}
+
+void ipc_terminate(ipc_shm* shm, uint32_t worker_id) {
+  Store(&shm->terminate_id, worker_id);
+  __atomic_add_fetch(&shm->terminate_futex, 1, __ATOMIC_SEQ_CST);
+  FutexWakeAll(&shm->terminate_futex);
+}
+
+uint32_t ipc_wait_terminate(ipc_shm* shm, uint32_t seen, uint32_t* worker_id) {
+  uint32_t v;
+  while ((v = Load(&shm->terminate_futex)) == seen) {
+    FutexWait(&shm->terminate_futex, seen);
+  }
+  *worker_id = Load(&shm->terminate_id);
+  return v;
+}
+
+}
@@ -0,0 +1,116 @@
+#ifndef V8WORKER_IPC_H_
+#define V8WORKER_IPC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared memory between the Go process and a worker host process. It holds
+// two single producer, single consumer rings of messages, one in each
+// direction, and a control block for the host's watchdog. Waiting is done on
+// futexes in the shared memory, so neither side polls.
+
+#define IPC_MAGIC 0x56385748  // "V8WH"
+
+// Message kinds.
+enum {
+  // parent to host
+  IPC_NEW = 1,
+  IPC_LOAD = 2,
+  IPC_SEND = 3,
+  IPC_SEND_SYNC = 4,
+  IPC_DISPOSE = 5,
+  IPC_HEAP_STATISTICS = 6,
+  IPC_LOW_MEMORY = 7,
+  IPC_SYNC_RESPONSE = 8,
+  IPC_EXIT = 9,
+  // zygote only: fork a host process around a worker
+  IPC_FORK = 10,
+  // host to parent
+  IPC_RESULT = 32,
+  IPC_RECV = 33,
+  IPC_RECV_SYNC = 34,
+};
+
+struct ipc_message_s {
+  uint32_t kind;
+  uint32_t worker_id;
+  // Matches a result to its request, or a sync response to its $sendSync.
+  uint32_t seq;
+  // Nonzero on error for IPC_RESULT.
+  uint32_t status;
+  size_t length;
+};
+typedef struct ipc_message_s ipc_message;
+
+// Start of an IPC_LOAD payload: the script origin, followed by its name NUL
+// source map URL NUL source.
+struct ipc_load_s {
+  int32_t line_offset;
+  int32_t column_offset;
+  int32_t script_id;
+  uint8_t is_shared_cross_origin;
+  uint8_t is_embedder_debug_script;
+  uint8_t is_opaque;
+  uint8_t reserved;
+};
+typedef struct ipc_load_s ipc_load;
+
+struct ipc_ring_s {
+  uint32_t head;  // advanced by the consumer
+  uint32_t tail;  // advanced by the producer
+  uint32_t data_futex;
+  uint32_t data_waiters;
+  uint32_t space_futex;
+  uint32_t space_waiters;
+  uint32_t capacity;  // power of two
+  uint32_t closed;
+  // capacity bytes of data follow
+};
+typedef struct ipc_ring_s ipc_ring;
+
+struct ipc_shm_s {
+  uint32_t magic;
+  uint32_t ring_capacity;
+  // Bumped by the parent to ask the watchdog to terminate the script of
+  // worker terminate_id.
+  uint32_t terminate_futex;
+  uint32_t terminate_id;
+  uint32_t reserved[4];
+  // the ring to the host, then the ring to the parent
+};
+typedef struct ipc_shm_s ipc_shm;
+
+size_t ipc_shm_size(uint32_t ring_capacity);
+void ipc_shm_init(ipc_shm* shm, uint32_t ring_capacity);
+ipc_ring* ipc_to_host(ipc_shm* shm);
+ipc_ring* ipc_to_parent(ipc_shm* shm);
+
+// Writes a message, split into several records if it does not fit the ring.
+// Blocks while the ring is full. Only one thread may write to a ring at a
+// time. returns nonzero once the ring is closed.
+int ipc_write(ipc_ring* r, const ipc_message* m, const void* payload);
+
+// Blocks until a message arrives and returns its payload, malloc'd and NUL
+// terminated, with its header in *m. returns NULL once the ring is closed
+// and drained.
+char* ipc_read(ipc_ring* r, ipc_message* m);
+
+// Fails all pending and future writes and, once drained, reads.
+void ipc_close(ipc_ring* r);
+
+// Asks the host's watchdog to terminate the script running in worker_id.
+void ipc_terminate(ipc_shm* shm, uint32_t worker_id);
+
+// Blocks until ipc_terminate is called after seen. Returns the new counter
+// to pass as seen next time, and the worker in *worker_id.
+uint32_t ipc_wait_terminate(ipc_shm* shm, uint32_t seen, uint32_t* worker_id);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif  // V8WORKER_IPC_H_
@@ -0,0 +1,148 @@
+package v8worker
+
+import (
+	"reflect"
+	"strings"
+	"sync"
+)
+
+// fieldPlan locates an exported struct field by the name javascript sees.
+type fieldPlan struct {
+	name string
+	// Id of name in the key table shared with workers, see keyID.
+	key int
+	// Field indices from the outer struct, through embedded structs.
+	index []int
+}
+
+// structPlan lists the fields of a struct type the way encoding/json names
+// them: the json tag name if any, fields tagged "-" and unexported fields
+// left out, and the fields of untagged embedded structs promoted.
+type structPlan struct {
+	fields []fieldPlan
+	byName map[string]int
+}
+
+var (
+	structPlansLocker sync.RWMutex
+	structPlans       = make(map[reflect.Type]*structPlan)
+
+	keysLocker sync.Mutex
+	keyIDs     = make(map[string]int)
+	keyNames   []string
+)
+
+// keyID returns the id of a field name. Workers intern the name once and
+// refer to it by id from then on, see value.go.
+func keyID(name string) int {
+	keysLocker.Lock()
+	defer keysLocker.Unlock()
+	id, ok := keyIDs[name]
+	if !ok {
+		id = len(keyNames)
+		keyIDs[name] = id
+		keyNames = append(keyNames, name)
+	}
+	return id
+}
+
+// planOf returns the plan of struct type t, built once per type.
+func planOf(t reflect.Type) *structPlan {
+	structPlansLocker.RLock()
+	plan := structPlans[t]
+	structPlansLocker.RUnlock()
+	if plan != nil {
+		return plan
+	}
+
+	plan = &structPlan{byName: make(map[string]int)}
+	plan.add(t, nil, make(map[reflect.Type]bool))
+
+	structPlansLocker.Lock()
+	structPlans[t] = plan
+	structPlansLocker.Unlock()
+	return plan
+}
+
+func (p *structPlan) add(t reflect.Type, index []int, seen map[reflect.Type]bool) {
+	if seen[t] {
+		return
+	}
+	seen[t] = true
+	var embedded []reflect.StructField
+	for i := 0; i < t.NumField(); i++ {
+		f := t.Field(i)
+		tag := f.Tag.Get("json")
+		if tag == "-" {
+			continue
+		}
+		name := tag
+		if comma := strings.Index(tag, ","); comma >= 0 {
+			name = tag[:comma]
+		}
+		ft := f.Type
+		if ft.Kind() == reflect.Ptr {
+			ft = ft.Elem()
+		}
+		if f.Anonymous && name == "" && ft.Kind() == reflect.Struct {
+			embedded = append(embedded, f)
+			continue
+		}
+		if f.PkgPath != "" {
+			continue
+		}
+		if name == "" {
+			name = f.Name
+		}
+		// The shallower field wins, as in encoding/json.
+		if _, ok := p.byName[name]; ok {
+			continue
+		}
+		p.byName[name] = len(p.fields)
+		p.fields = append(p.fields, fieldPlan{
+			name:  name,
+			key:   keyID(name),
+			index: appendIndex(index, i),
+		})
+	}
+	for _, f := range embedded {
+		ft := f.Type
+		if ft.Kind() == reflect.Ptr {
+			ft = ft.Elem()
+		}
+		p.add(ft, appendIndex(index, f.Index[0]), seen)
+	}
+}
+
+func appendIndex(index []int, i int) []int {
+	out := make([]int, len(index)+1)
+	copy(out, index)
+	out[len(index)] = i
+	return out
+}
+
+// fieldByIndex returns the field at index, or false if it sits in a nil
+// embedded pointer.
+func fieldByIndex(v reflect.Value, index []int) (reflect.Value, bool) {
+	for i, x := range index {
+		if i > 0 && v.Kind() == reflect.Ptr {
+			if v.IsNil() {
+				return reflect.Value{}, false
+			}
+			v = v.Elem()
+		}
+		v = v.Field(x)
+	}
+	return v, true
+}
+
+// indirect follows pointers and interfaces. The result is invalid for nil.
+func indirect(v reflect.Value) reflect.Value {
+	for v.IsValid() && (v.Kind() == reflect.Ptr || v.Kind() == reflect.Interface) {
+		if v.IsNil() {
+			return reflect.Value{}
+		}
+		v = v.Elem()
+	}
+	return v
+}
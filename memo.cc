@@ -0,0 +1,93 @@
+#include "hash.h"
+#include "memo.h"
+
+MemoCache::MemoCache(size_t capacity) {
+  SetCapacity(capacity);
+}
+
+void MemoCache::SetCapacity(size_t capacity) {
+  for (size_t i = 0; i < kShards; i++) {
+    std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    shards_[i].capacity = capacity / kShards;
+    shards_[i].Evict();
+  }
+}
+
+uint64_t MemoCache::Hash(uint64_t scripts, int channel, const char* msg,
+                         size_t length) {
+  return Xxh3(msg, length, scripts ^ ((uint64_t)channel << 56));
+}
+
+bool MemoCache::Get(uint64_t scripts, int channel, const char* msg,
+                    size_t length, std::vector<std::string>* sends) {
+  uint64_t hash = Hash(scripts, channel, msg, length);
+  Shard& shard = shards_[hash % kShards];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it =
+      shard.index.find(hash);
+  if (it == shard.index.end() || it->second->scripts != scripts ||
+      it->second->channel != channel ||
+      it->second->msg.compare(0, std::string::npos, msg, length) != 0) {
+    shard.misses++;
+    return false;
+  }
+  shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+  *sends = it->second->sends;
+  shard.hits++;
+  return true;
+}
+
+void MemoCache::Put(uint64_t scripts, int channel, const char* msg,
+                    size_t length, const std::vector<std::string>& sends) {
+  size_t bytes = sizeof(Entry) + length;
+  for (size_t i = 0; i < sends.size(); i++) {
+    bytes += sizeof(std::string) + sends[i].size();
+  }
+  uint64_t hash = Hash(scripts, channel, msg, length);
+  Shard& shard = shards_[hash % kShards];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (bytes > shard.capacity) return;
+
+  std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it =
+      shard.index.find(hash);
+  if (it != shard.index.end()) {
+    shard.bytes -= it->second->bytes;
+    shard.entries.erase(it->second);
+    shard.index.erase(it);
+  }
+  Entry entry;
+  entry.hash = hash;
+  entry.scripts = scripts;
+  entry.channel = channel;
+  entry.msg.assign(msg, length);
+  entry.sends = sends;
+  entry.bytes = bytes;
+  shard.entries.push_front(entry);
+  shard.index[hash] = shard.entries.begin();
+  shard.bytes += bytes;
+  shard.Evict();
+}
+
+void MemoCache::Shard::Evict() {
+  while (bytes > capacity && !entries.empty()) {
+    bytes -= entries.back().bytes;
+    index.erase(entries.back().hash);
+    entries.pop_back();
+  }
+}
+
+void MemoCache::GetStatistics(memo_statistics* ms) {
+  ms->hits = 0;
+  ms->misses = 0;
+  ms->entries = 0;
+  ms->bytes = 0;
+  ms->capacity = 0;
+  for (size_t i = 0; i < kShards; i++) {
+    std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    ms->hits += shards_[i].hits;
+    ms->misses += shards_[i].misses;
+    ms->entries += shards_[i].entries.size();
+    ms->bytes += shards_[i].bytes;
+    ms->capacity += shards_[i].capacity;
+  }
+}
@@ -0,0 +1,38 @@
+package v8worker
+
+/*
+#include "binding.h"
+*/
+import "C"
+
+// MemoStatistics describes the cache of memoized calls. See
+// Options.Memoize.
+type MemoStatistics struct {
+	Hits    int
+	Misses  int
+	Entries int
+	// Bytes used, including keys and bookkeeping.
+	Bytes    int
+	Capacity int
+}
+
+// SetMemoCacheSize sets the bytes kept by the cache of memoized calls,
+// shared by every worker of the process. It defaults to 64 MB. Zero
+// disables the cache.
+func SetMemoCacheSize(bytes int) {
+	C.memo_set_capacity(C.size_t(bytes))
+}
+
+// MemoCacheStatistics returns the state of the cache of memoized calls of
+// this process. Workers running in a Host have their own cache there.
+func MemoCacheStatistics() MemoStatistics {
+	var ms C.memo_statistics
+	C.memo_get_statistics(&ms)
+	return MemoStatistics{
+		Hits:     int(ms.hits),
+		Misses:   int(ms.misses),
+		Entries:  int(ms.entries),
+		Bytes:    int(ms.bytes),
+		Capacity: int(ms.capacity),
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef V8WORKER_MEMO_H_
+#define V8WORKER_MEMO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "binding.h"
+
+// Results of $recv calls, shared by every worker of the process created with
+// Options.Memoize. The result of a call is the messages it passed to $send,
+// keyed by the scripts loaded into the worker, the entry point the message
+// came through and the message itself. The cache is split into shards, each
+// an LRU list with its share of the byte budget, so that workers on many
+// threads rarely wait on the same lock.
+class MemoCache {
+ public:
+  explicit MemoCache(size_t capacity);
+
+  // Bytes kept at most, keys and messages included. Shrinking evicts.
+  void SetCapacity(size_t capacity);
+
+  // Copies the messages recorded for the key into *sends. Returns false on
+  // a miss.
+  bool Get(uint64_t scripts, int channel, const char* msg, size_t length,
+           std::vector<std::string>* sends);
+  void Put(uint64_t scripts, int channel, const char* msg, size_t length,
+           const std::vector<std::string>& sends);
+
+  void GetStatistics(memo_statistics* ms);
+
+ private:
+  static const size_t kShards = 16;
+
+  struct Entry {
+    uint64_t hash;
+    uint64_t scripts;
+    int channel;
+    std::string msg;
+    std::vector<std::string> sends;
+    size_t bytes;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    // Most recently used first.
+    std::list<Entry> entries;
+    // Entries by hash. Distinct keys with the same hash replace each other.
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    size_t bytes;
+    size_t capacity;
+    size_t hits;
+    size_t misses;
+
+    Shard() : bytes(0), capacity(0), hits(0), misses(0) {}
+    void Evict();
+  };
+
+  static uint64_t Hash(uint64_t scripts, int channel, const char* msg,
+                       size_t length);
+
+  Shard shards_[kShards];
+};
+
+#endif  // V8WORKER_MEMO_H_
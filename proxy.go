@@ -0,0 +1,265 @@
+package v8worker
+
+/*
+#include <stdlib.h>
+#include "binding.h"
+*/
+import "C"
+import (
+	"errors"
+	"reflect"
+	"runtime"
+	"sort"
+	"strings"
+	"sync"
+	"unsafe"
+)
+
+// Proxy is a Go value that can be passed to javascript by reference with
+// SendProxy. See Worker.NewProxy.
+type Proxy struct {
+	id      int
+	isArray bool
+}
+
+// proxyEntry is a Go value referenced by a Proxy or by javascript objects.
+type proxyEntry struct {
+	value reflect.Value
+	refs  int
+}
+
+var (
+	proxiesLocker sync.Mutex
+	proxies       = make(map[int]*proxyEntry)
+	proxySequence int
+)
+
+// NewProxy prepares v, typically a pointer to a large struct, to be passed
+// to javascript with SendProxy without serializing it. Javascript sees an
+// object whose members are read from v when accessed, so members it does not
+// touch are never converted or copied. Structs expose their exported fields
+// under their json tag names, maps with string keys their entries, and
+// slices and arrays their elements and length, with Array.prototype for
+// methods like map and forEach. Nested values become proxies in turn, a new
+// one on each access. Members are read-only.
+//
+// v must not be modified while javascript may read it. Proxies are not
+// supported for workers running in a Host: SendProxy fails for them.
+func (w *Worker) NewProxy(v interface{}) *Proxy {
+	value := reflect.ValueOf(v)
+	kind := indirect(value).Kind()
+	p := &Proxy{
+		id:      newProxyEntry(value),
+		isArray: kind == reflect.Slice || kind == reflect.Array,
+	}
+	runtime.SetFinalizer(p, func(final_proxy *Proxy) {
+		final_proxy.Release()
+	})
+	return p
+}
+
+// Release drops the Go side reference to the proxied value. Objects already
+// passed to javascript keep it until they are garbage collected.
+func (p *Proxy) Release() {
+	if p.id != 0 {
+		releaseProxyEntry(p.id)
+		p.id = 0
+	}
+}
+
+// SendProxy passes the value of p to the $recv callback in js.
+func (w *Worker) SendProxy(p *Proxy) error {
+	w.touch()
+	if w.remote != nil {
+		return errRemote
+	}
+	if p.id == 0 {
+		return errors.New("proxy released")
+	}
+	// Owned by the javascript object from now on.
+	retainProxyEntry(p.id)
+	r := C.worker_send_proxy(w.cWorker, C.int(p.id), C.bool(p.isArray))
+	runtime.KeepAlive(p)
+	if r != 0 {
+		errStr := C.worker_last_exception(w.cWorker)
+		return errors.New(C.GoString(errStr))
+	}
+
+	return nil
+}
+
+func newProxyEntry(v reflect.Value) int {
+	proxiesLocker.Lock()
+	proxySequence++
+	id := proxySequence
+	proxies[id] = &proxyEntry{value: v, refs: 1}
+	proxiesLocker.Unlock()
+	return id
+}
+
+func retainProxyEntry(id int) {
+	proxiesLocker.Lock()
+	proxies[id].refs++
+	proxiesLocker.Unlock()
+}
+
+func releaseProxyEntry(id int) {
+	proxiesLocker.Lock()
+	if e := proxies[id]; e != nil {
+		e.refs--
+		if e.refs == 0 {
+			delete(proxies, id)
+		}
+	}
+	proxiesLocker.Unlock()
+}
+
+func proxyValue(id C.int) reflect.Value {
+	proxiesLocker.Lock()
+	e := proxies[int(id)]
+	proxiesLocker.Unlock()
+	if e == nil {
+		return reflect.Value{}
+	}
+	return indirect(e.value)
+}
+
+// proxyMember returns the member of v named by key, or by index if key is
+// nil. hidden is set for the length of slices, which is not enumerable.
+func proxyMember(v reflect.Value, key *C.char, keyLength C.int, index C.int) (member reflect.Value, hidden bool, ok bool) {
+	if key == nil {
+		if (v.Kind() == reflect.Slice || v.Kind() == reflect.Array) && int(index) < v.Len() {
+			return v.Index(int(index)), false, true
+		}
+		return reflect.Value{}, false, false
+	}
+
+	// Viewed in place: looking up string(name) in a Go map does not copy it.
+	name := (*[1 << 30]byte)(unsafe.Pointer(key))[:keyLength:keyLength]
+	switch v.Kind() {
+	case reflect.Struct:
+		plan := planOf(v.Type())
+		i, ok := plan.byName[string(name)]
+		if !ok {
+			return reflect.Value{}, false, false
+		}
+		member, ok = fieldByIndex(v, plan.fields[i].index)
+		return member, false, ok
+	case reflect.Map:
+		if v.Type().Key().Kind() != reflect.String {
+			return reflect.Value{}, false, false
+		}
+		member = v.MapIndex(reflect.ValueOf(string(name)).Convert(v.Type().Key()))
+		return member, false, member.IsValid()
+	case reflect.Slice, reflect.Array:
+		if string(name) == "length" {
+			return reflect.ValueOf(v.Len()), true, true
+		}
+	}
+	return reflect.Value{}, false, false
+}
+
+//export proxyGet
+func proxyGet(id C.int, key *C.char, keyLength C.int, index C.int, out *C.proxy_value) {
+	member, _, ok := proxyMember(proxyValue(id), key, keyLength, index)
+	if !ok {
+		out.kind = C.PROXY_UNDEFINED
+		return
+	}
+
+	v := indirect(member)
+	switch v.Kind() {
+	case reflect.Invalid:
+		out.kind = C.PROXY_NULL
+	case reflect.Bool:
+		out.kind = C.PROXY_BOOL
+		if v.Bool() {
+			out.number = 1
+		}
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+		out.kind = C.PROXY_NUMBER
+		out.number = C.double(v.Int())
+	case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+		out.kind = C.PROXY_NUMBER
+		out.number = C.double(v.Uint())
+	case reflect.Float32, reflect.Float64:
+		out.kind = C.PROXY_NUMBER
+		out.number = C.double(v.Float())
+	case reflect.String:
+		s := v.String()
+		out.kind = C.PROXY_STRING
+		out.string = C.CString(s)
+		out.length = C.int(len(s))
+	case reflect.Struct, reflect.Map:
+		if v.Kind() == reflect.Map && v.IsNil() {
+			out.kind = C.PROXY_NULL
+			return
+		}
+		out.kind = C.PROXY_OBJECT
+		out.proxy = C.int(newProxyEntry(v))
+	case reflect.Slice, reflect.Array:
+		if v.Kind() == reflect.Slice && v.IsNil() {
+			out.kind = C.PROXY_NULL
+			return
+		}
+		out.kind = C.PROXY_ARRAY
+		out.proxy = C.int(newProxyEntry(v))
+	default:
+		out.kind = C.PROXY_UNDEFINED
+	}
+}
+
+// proxyHas returns 0 if the member does not exist, 1 if it is enumerable and
+// 2 if it is not.
+//export proxyHas
+func proxyHas(id C.int, key *C.char, keyLength C.int, index C.int) C.int {
+	_, hidden, ok := proxyMember(proxyValue(id), key, keyLength, index)
+	switch {
+	case !ok:
+		return 0
+	case hidden:
+		return 2
+	}
+	return 1
+}
+
+// proxyKeys returns the number of indices if indexed is set, otherwise the
+// number of names, stored in *names separated by NULs.
+//export proxyKeys
+func proxyKeys(id C.int, indexed C.int, names **C.char) C.int {
+	*names = nil
+	v := proxyValue(id)
+	if indexed != 0 {
+		if v.Kind() == reflect.Slice || v.Kind() == reflect.Array {
+			return C.int(v.Len())
+		}
+		return 0
+	}
+
+	var keys []string
+	switch v.Kind() {
+	case reflect.Struct:
+		for _, f := range planOf(v.Type()).fields {
+			if _, ok := fieldByIndex(v, f.index); ok {
+				keys = append(keys, f.name)
+			}
+		}
+	case reflect.Map:
+		if v.Type().Key().Kind() == reflect.String {
+			for _, k := range v.MapKeys() {
+				keys = append(keys, k.String())
+			}
+			sort.Strings(keys)
+		}
+	}
+	if len(keys) == 0 {
+		return 0
+	}
+	*names = C.CString(strings.Join(keys, "\x00"))
+	return C.int(len(keys))
+}
+
+//export proxyRelease
+func proxyRelease(id C.int) {
+	releaseProxyEntry(int(id))
+}
@@ -0,0 +1,53 @@
+#include <thread>
+#include "reaper.h"
+
+Reaper::Reaper(size_t capacity)
+    : capacity_(capacity), running_(0), started_(false) {}
+
+bool Reaper::Post(const std::function<void()>& job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (jobs_.size() >= capacity_) return false;
+  if (!started_) {
+    // The thread lives as long as the process, like the V8 platform's own
+    // worker threads.
+    std::thread(&Reaper::Run, this).detach();
+    started_ = true;
+  }
+  jobs_.push_back(job);
+  ready_.notify_one();
+  return true;
+}
+
+size_t Reaper::Pending() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return jobs_.size() + running_;
+}
+
+void Reaper::BeforeFork() {
+  mutex_.lock();
+}
+
+void Reaper::AfterForkInParent() {
+  mutex_.unlock();
+}
+
+void Reaper::AfterForkInChild() {
+  jobs_.clear();
+  started_ = false;
+  running_ = 0;
+  mutex_.unlock();
+}
+
+void Reaper::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    ready_.wait(lock, [&] { return !jobs_.empty(); });
+    std::function<void()> job = jobs_.front();
+    jobs_.pop_front();
+    running_++;
+    lock.unlock();
+    job();
+    lock.lock();
+    running_--;
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef V8WORKER_REAPER_H_
+#define V8WORKER_REAPER_H_
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+// Runs teardown jobs on a background thread. Disposing an isolate with a
+// large heap takes tens of milliseconds, which should not be paid by
+// whichever thread drops the last reference to a worker. The queue is
+// bounded so that a burst of disposals cannot pile up unbounded memory
+// waiting to be freed; once it is full the caller runs the job itself.
+class Reaper {
+ public:
+  explicit Reaper(size_t capacity);
+
+  // Queues job, starting the thread on first use. Returns false if the
+  // queue is full, in which case the caller should run job inline.
+  bool Post(const std::function<void()>& job);
+
+  // Number of jobs queued or running.
+  size_t Pending();
+
+  // Fork handlers, see pthread_atfork. The queue is locked across fork so
+  // that the child gets it in a consistent state. The child drops the jobs
+  // of the parent, whose thread does not exist there, and starts its own
+  // on the next Post.
+  void BeforeFork();
+  void AfterForkInParent();
+  void AfterForkInChild();
+
+ private:
+  void Run();
+
+  size_t capacity_;
+  size_t running_;
+  bool started_;
+  std::deque<std::function<void()> > jobs_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+};
+
+#endif  // V8WORKER_REAPER_H_
@@ -0,0 +1,106 @@
+#include <string.h>
+#include "binding.h"
+#include "stream.h"
+
+ChunkQueue::ChunkQueue(v8::ArrayBuffer::Allocator* allocator, size_t capacity)
+    : allocator_(allocator),
+      capacity_(capacity),
+      queued_bytes_(0),
+      closed_(false),
+      cancelled_(false) {}
+
+ChunkQueue::~ChunkQueue() {
+  Cancel();
+}
+
+bool ChunkQueue::Push(const void* data, size_t length) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // A chunk larger than the whole capacity is still accepted once the queue
+  // is empty, otherwise it could never be delivered.
+  writable_.wait(lock, [&] {
+    return cancelled_ || queued_bytes_ == 0 ||
+           queued_bytes_ + length <= capacity_;
+  });
+  if (cancelled_ || closed_) return false;
+
+  Chunk chunk;
+  chunk.data = allocator_->AllocateUninitialized(length);
+  if (chunk.data == NULL) return false;
+  chunk.length = length;
+  memcpy(chunk.data, data, length);
+
+  chunks_.push_back(chunk);
+  queued_bytes_ += length;
+  readable_.notify_one();
+  return true;
+}
+
+void ChunkQueue::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = true;
+  readable_.notify_all();
+}
+
+bool ChunkQueue::Pop(Chunk* chunk) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  readable_.wait(lock, [&] {
+    return cancelled_ || closed_ || !chunks_.empty();
+  });
+  if (chunks_.empty()) return false;
+
+  *chunk = chunks_.front();
+  chunks_.pop_front();
+  queued_bytes_ -= chunk->length;
+  writable_.notify_all();
+  return true;
+}
+
+void ChunkQueue::Cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cancelled_ = true;
+  if (allocator_ != NULL) {
+    for (size_t i = 0; i < chunks_.size(); i++) Free(chunks_[i]);
+  }
+  chunks_.clear();
+  queued_bytes_ = 0;
+  readable_.notify_all();
+  writable_.notify_all();
+}
+
+void ChunkQueue::Detach() {
+  Cancel();
+  std::lock_guard<std::mutex> lock(mutex_);
+  allocator_ = NULL;
+}
+
+size_t Utf8CompleteLength(const char* s, size_t length) {
+  // A sequence is at most 4 bytes, so only the last 3 can be incomplete.
+  for (size_t i = 1; i <= 3 && i <= length; i++) {
+    unsigned char c = s[length - i];
+    if ((c & 0xC0) == 0x80) continue;  // continuation byte
+    if (c < 0x80) return length;
+    size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+    return need > i ? length - i : length;
+  }
+  return length;
+}
+
+extern "C" {
+
+int stream_write(stream* s, const void* data, size_t length) {
+  return s->queue.Push(data, length) ? 0 : 1;
+}
+
+void stream_close(stream* s) {
+  s->queue.Close();
+}
+
+void stream_release(stream* s) {
+  {
+    std::lock_guard<std::mutex> lock(s->owner->mutex);
+    s->owner->streams.erase(s);
+  }
+  delete s;
+}
+
+}
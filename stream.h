@@ -0,0 +1,85 @@
+#ifndef V8WORKER_STREAM_H_
+#define V8WORKER_STREAM_H_
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include "v8.h"
+
+// Bounded queue of byte chunks between a Go writer and a javascript reader.
+// Push blocks while more than capacity bytes are queued, so a producer can
+// never run ahead of the script by more than that. Chunks are allocated from
+// the worker's ArrayBuffer allocator and the reader takes ownership of them,
+// which lets it hand them to V8 as ArrayBuffers without another copy.
+class ChunkQueue {
+ public:
+  struct Chunk {
+    void* data;
+    size_t length;
+  };
+
+  ChunkQueue(v8::ArrayBuffer::Allocator* allocator, size_t capacity);
+  ~ChunkQueue();
+
+  // Copies data into a new chunk, blocking while the queue is full. Returns
+  // false if the reader has gone away.
+  bool Push(const void* data, size_t length);
+
+  // Marks the end of the stream. The reader sees it once the queue drains.
+  void Close();
+
+  // Blocks until a chunk is available. Returns false at the end of the
+  // stream. The caller owns the chunk and must release it with Free.
+  bool Pop(Chunk* chunk);
+
+  // Called when the reader has gone away: drops queued chunks and fails all
+  // pending and future pushes.
+  void Cancel();
+
+  // Cancels the queue and forgets the allocator, which goes away with the
+  // worker while the writer may still hold on to the queue.
+  void Detach();
+
+  void Free(const Chunk& chunk) { allocator_->Free(chunk.data, chunk.length); }
+
+ private:
+  v8::ArrayBuffer::Allocator* allocator_;
+  size_t capacity_;
+  size_t queued_bytes_;
+  bool closed_;
+  bool cancelled_;
+  std::deque<Chunk> chunks_;
+  std::mutex mutex_;
+  std::condition_variable readable_;
+  std::condition_variable writable_;
+};
+
+struct stream_s;
+
+// Streams of a worker not released yet, detached when it is disposed.
+// Shared with the streams, which may outlive the worker.
+struct StreamSet {
+  std::mutex mutex;
+  std::set<stream_s*> streams;
+};
+
+struct stream_s {
+  stream_s(v8::ArrayBuffer::Allocator* allocator, size_t capacity,
+           const std::shared_ptr<StreamSet>& owner)
+      : queue(allocator, capacity), owner(owner) {}
+
+  ChunkQueue queue;
+  std::shared_ptr<StreamSet> owner;
+  // Trailing bytes of an incomplete UTF-8 sequence left over by readString.
+  std::string carry;
+};
+
+// Returns the length of the longest prefix of s that does not end in the
+// middle of a UTF-8 sequence.
+size_t Utf8CompleteLength(const char* s, size_t length);
+
+#endif  // V8WORKER_STREAM_H_
@@ -0,0 +1,167 @@
+package v8worker
+
+import (
+	"container/list"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// SyncCache keeps the responses to $sendSync requests for a while, keyed by
+// the request string, so that identical lookups from many workers reach the
+// ReceiveSyncMessageCallback once per TTL. A request made while the same
+// one is already in flight, from any worker sharing the cache, waits for
+// that response rather than calling the callback again. Set
+// Options.SyncCache to use one; it only suits callbacks whose responses
+// depend on nothing but the request.
+type SyncCache struct {
+	ttl        time.Duration
+	maxEntries int
+
+	mu      sync.Mutex
+	entries map[string]*syncCacheEntry
+	// Answered entries, most recently used first. Requests in flight are
+	// only in entries.
+	lru *list.List
+
+	hits      int64
+	misses    int64
+	coalesced int64
+}
+
+type syncCacheEntry struct {
+	msg string
+	// Closed once response is set, or failed if the callback panicked.
+	done     chan struct{}
+	response string
+	failed   bool
+	expires  int64
+	// In lru once answered.
+	elem *list.Element
+}
+
+// SyncCacheStats counts the requests seen by a SyncCache.
+type SyncCacheStats struct {
+	// Requests answered from the cache.
+	Hits int64
+	// Requests passed to the callback.
+	Misses int64
+	// Requests that waited for an identical one in flight.
+	Coalesced int64
+	// Responses currently cached.
+	Entries int
+}
+
+// NewSyncCache creates a cache keeping each response for ttl, and at most
+// maxEntries responses, dropping the least recently used ones first. Zero
+// maxEntries means no limit. Expired responses are dropped as new ones come
+// in.
+func NewSyncCache(ttl time.Duration, maxEntries int) *SyncCache {
+	return &SyncCache{
+		ttl:        ttl,
+		maxEntries: maxEntries,
+		entries:    make(map[string]*syncCacheEntry),
+		lru:        list.New(),
+	}
+}
+
+// Stats returns the counts so far.
+func (c *SyncCache) Stats() SyncCacheStats {
+	c.mu.Lock()
+	n := len(c.entries)
+	c.mu.Unlock()
+	return SyncCacheStats{
+		Hits:      atomic.LoadInt64(&c.hits),
+		Misses:    atomic.LoadInt64(&c.misses),
+		Coalesced: atomic.LoadInt64(&c.coalesced),
+		Entries:   n,
+	}
+}
+
+// wrap returns fn answering through c, or fn itself if c is nil.
+func (c *SyncCache) wrap(fn ReceiveSyncMessageCallback) ReceiveSyncMessageCallback {
+	if c == nil {
+		return fn
+	}
+	return func(msg string) string {
+		return c.call(msg, fn)
+	}
+}
+
+func (c *SyncCache) call(msg string, fn ReceiveSyncMessageCallback) string {
+	for {
+		c.mu.Lock()
+		e, ok := c.entries[msg]
+		if ok {
+			select {
+			case <-e.done:
+				if time.Now().UnixNano() < e.expires {
+					c.lru.MoveToFront(e.elem)
+					c.mu.Unlock()
+					atomic.AddInt64(&c.hits, 1)
+					return e.response
+				}
+				c.remove(e)
+			default:
+				c.mu.Unlock()
+				atomic.AddInt64(&c.coalesced, 1)
+				<-e.done
+				if !e.failed {
+					return e.response
+				}
+				// The callback panicked in the other request; try again.
+				continue
+			}
+		}
+
+		c.makeRoom()
+		e = &syncCacheEntry{msg: msg, done: make(chan struct{})}
+		c.entries[msg] = e
+		c.mu.Unlock()
+		atomic.AddInt64(&c.misses, 1)
+		return c.fill(msg, e, fn)
+	}
+}
+
+// fill calls fn for the request of e. If fn panics, e is dropped so that the
+// requests waiting for it call fn themselves.
+func (c *SyncCache) fill(msg string, e *syncCacheEntry, fn ReceiveSyncMessageCallback) string {
+	e.failed = true
+	defer func() {
+		c.mu.Lock()
+		if c.entries[msg] == e {
+			if e.failed {
+				delete(c.entries, msg)
+			} else {
+				e.elem = c.lru.PushFront(e)
+			}
+		}
+		c.mu.Unlock()
+		close(e.done)
+	}()
+	e.response = fn(msg)
+	e.expires = time.Now().Add(c.ttl).UnixNano()
+	e.failed = false
+	return e.response
+}
+
+// remove drops an answered entry. c.mu must be held.
+func (c *SyncCache) remove(e *syncCacheEntry) {
+	c.lru.Remove(e.elem)
+	delete(c.entries, e.msg)
+}
+
+// makeRoom drops the least recently used responses while they are expired,
+// then while the cache is full. Requests in flight are kept. c.mu must be
+// held.
+func (c *SyncCache) makeRoom() {
+	now := time.Now().UnixNano()
+	for back := c.lru.Back(); back != nil; back = c.lru.Back() {
+		e := back.Value.(*syncCacheEntry)
+		full := c.maxEntries > 0 && len(c.entries) >= c.maxEntries
+		if !full && now < e.expires {
+			return
+		}
+		c.remove(e)
+	}
+}
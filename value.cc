@@ -0,0 +1,239 @@
+#include <string.h>
+#include "binding.h"
+#include "value.h"
+
+using namespace v8;
+
+namespace {
+
+// Deeper values are assumed to be cyclic.
+const int kMaxDepth = 100;
+
+class Reader {
+ public:
+  Reader(const char* data, size_t length)
+      : p_(reinterpret_cast<const unsigned char*>(data)),
+        end_(p_ + length) {}
+
+  bool done() const { return p_ == end_; }
+
+  bool Uint8(uint8_t* v) {
+    if (end_ - p_ < 1) return false;
+    *v = *p_++;
+    return true;
+  }
+
+  bool Uint32(uint32_t* v) {
+    if (end_ - p_ < 4) return false;
+    *v = p_[0] | p_[1] << 8 | p_[2] << 16 | (uint32_t)p_[3] << 24;
+    p_ += 4;
+    return true;
+  }
+
+  bool Double(double* v) {
+    uint32_t lo, hi;
+    if (!Uint32(&lo) || !Uint32(&hi)) return false;
+    uint64_t bits = (uint64_t)hi << 32 | lo;
+    memcpy(v, &bits, sizeof(*v));
+    return true;
+  }
+
+  // Points *data at the next length bytes.
+  bool Bytes(const char** data, uint32_t length) {
+    if ((size_t)(end_ - p_) < length) return false;
+    *data = reinterpret_cast<const char*>(p_);
+    p_ += length;
+    return true;
+  }
+
+ private:
+  const unsigned char* p_;
+  const unsigned char* end_;
+};
+
+void WriteUint8(std::string* out, uint8_t v) {
+  out->push_back(static_cast<char>(v));
+}
+
+void WriteUint32(std::string* out, uint32_t v) {
+  char b[4] = {(char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24)};
+  out->append(b, 4);
+}
+
+void WriteDouble(std::string* out, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  WriteUint32(out, (uint32_t)bits);
+  WriteUint32(out, (uint32_t)(bits >> 32));
+}
+
+void WriteString(std::string* out, Local<Value> v) {
+  String::Utf8Value str(v);
+  WriteUint32(out, str.length());
+  out->append(*str, str.length());
+}
+
+Local<String> NewString(Isolate* isolate, const char* data, uint32_t length) {
+  return String::NewFromUtf8(isolate, data, String::kNormalString, length);
+}
+
+Local<Value> Decode(Isolate* isolate, KeyTable* keys, Reader* r, int depth) {
+  uint8_t tag;
+  if (depth > kMaxDepth || !r->Uint8(&tag)) return Local<Value>();
+
+  uint32_t n;
+  const char* data;
+  switch (tag) {
+    case VALUE_UNDEFINED:
+      return Undefined(isolate);
+    case VALUE_NULL:
+      return Null(isolate);
+    case VALUE_TRUE:
+      return True(isolate);
+    case VALUE_FALSE:
+      return False(isolate);
+    case VALUE_NUMBER: {
+      double d;
+      if (!r->Double(&d)) break;
+      return Number::New(isolate, d);
+    }
+    case VALUE_STRING:
+      if (!r->Uint32(&n) || !r->Bytes(&data, n)) break;
+      return NewString(isolate, data, n);
+    case VALUE_BYTES: {
+      if (!r->Uint32(&n) || !r->Bytes(&data, n)) break;
+      Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, n);
+      if (n > 0) memcpy(buffer->GetContents().Data(), data, n);
+      return buffer;
+    }
+    case VALUE_ARRAY: {
+      if (!r->Uint32(&n)) break;
+      Local<Array> array = Array::New(isolate, n);
+      for (uint32_t i = 0; i < n; i++) {
+        Local<Value> v = Decode(isolate, keys, r, depth + 1);
+        if (v.IsEmpty()) return v;
+        array->Set(i, v);
+      }
+      return array;
+    }
+    case VALUE_OBJECT:
+    case VALUE_MAP: {
+      if (!r->Uint32(&n)) break;
+      Local<Object> obj = Object::New(isolate);
+      for (uint32_t i = 0; i < n; i++) {
+        Local<String> key;
+        uint32_t k;
+        if (!r->Uint32(&k)) return Local<Value>();
+        if (tag == VALUE_OBJECT) {
+          key = keys->Get(isolate, k);
+        } else if (r->Bytes(&data, k)) {
+          key = NewString(isolate, data, k);
+        }
+        if (key.IsEmpty()) return Local<Value>();
+        Local<Value> v = Decode(isolate, keys, r, depth + 1);
+        if (v.IsEmpty()) return v;
+        obj->Set(key, v);
+      }
+      return obj;
+    }
+  }
+  return Local<Value>();
+}
+
+bool Encode(Isolate* isolate, Local<Value> v, int depth, std::string* out,
+            std::string* error) {
+  if (v.IsEmpty()) return false;  // a getter threw
+  if (depth > kMaxDepth) {
+    *error = "value nested too deeply";
+    return false;
+  }
+
+  if (v->IsNull()) {
+    WriteUint8(out, VALUE_NULL);
+  } else if (v->IsBoolean()) {
+    WriteUint8(out, v->BooleanValue() ? VALUE_TRUE : VALUE_FALSE);
+  } else if (v->IsNumber()) {
+    WriteUint8(out, VALUE_NUMBER);
+    WriteDouble(out, v->NumberValue());
+  } else if (v->IsString()) {
+    WriteUint8(out, VALUE_STRING);
+    WriteString(out, v);
+  } else if (v->IsArrayBuffer()) {
+    ArrayBuffer::Contents contents = Local<ArrayBuffer>::Cast(v)->GetContents();
+    WriteUint8(out, VALUE_BYTES);
+    WriteUint32(out, contents.ByteLength());
+    out->append(static_cast<const char*>(contents.Data()), contents.ByteLength());
+  } else if (v->IsArrayBufferView()) {
+    Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(v);
+    size_t n = view->ByteLength();
+    WriteUint8(out, VALUE_BYTES);
+    WriteUint32(out, n);
+    size_t offset = out->size();
+    out->resize(offset + n);
+    if (n > 0) view->CopyContents(&(*out)[offset], n);
+  } else if (v->IsArray()) {
+    Local<Array> array = Local<Array>::Cast(v);
+    uint32_t n = array->Length();
+    WriteUint8(out, VALUE_ARRAY);
+    WriteUint32(out, n);
+    for (uint32_t i = 0; i < n; i++) {
+      if (!Encode(isolate, array->Get(i), depth + 1, out, error)) return false;
+    }
+  } else if (v->IsObject() && !v->IsFunction()) {
+    Local<Object> obj = Local<Object>::Cast(v);
+    Local<Array> names = obj->GetOwnPropertyNames();
+    if (names.IsEmpty()) return false;
+    uint32_t n = names->Length();
+    WriteUint8(out, VALUE_MAP);
+    WriteUint32(out, n);
+    for (uint32_t i = 0; i < n; i++) {
+      Local<Value> name = names->Get(i);
+      WriteString(out, name);
+      if (!Encode(isolate, obj->Get(name), depth + 1, out, error)) return false;
+    }
+  } else {
+    WriteUint8(out, VALUE_UNDEFINED);
+  }
+  return true;
+}
+
+}  // namespace
+
+KeyTable::~KeyTable() {
+  for (size_t i = 0; i < keys_.size(); i++) delete keys_[i];
+}
+
+bool KeyTable::Define(Isolate* isolate, const char* data, size_t length) {
+  Reader r(data, length);
+  while (!r.done()) {
+    uint32_t id, n;
+    const char* name;
+    if (!r.Uint32(&id) || !r.Uint32(&n) || !r.Bytes(&name, n)) return false;
+    if (id >= keys_.size()) keys_.resize(id + 1);
+    if (keys_[id] == NULL) keys_[id] = new Persistent<String>();
+    keys_[id]->Reset(isolate, String::NewFromUtf8(
+        isolate, name, String::kInternalizedString, n));
+  }
+  return true;
+}
+
+Local<String> KeyTable::Get(Isolate* isolate, uint32_t id) {
+  if (id >= keys_.size() || keys_[id] == NULL) return Local<String>();
+  return Local<String>::New(isolate, *keys_[id]);
+}
+
+Local<Value> DecodeValue(Isolate* isolate, KeyTable* keys, const char* tape,
+                         size_t length, std::string* error) {
+  Reader r(tape, length);
+  Local<Value> v = Decode(isolate, keys, &r, 0);
+  if (v.IsEmpty() || !r.done()) {
+    *error = "malformed value";
+    return Local<Value>();
+  }
+  return v;
+}
+
+bool EncodeValue(Isolate* isolate, Local<Value> value, std::string* tape,
+                 std::string* error) {
+  return Encode(isolate, value, 0, tape, error);
+}
@@ -0,0 +1,519 @@
+package v8worker
+
+/*
+#include <stdlib.h>
+#include "binding.h"
+*/
+import "C"
+import (
+	"encoding/binary"
+	"errors"
+	"math"
+	"reflect"
+	"strconv"
+	"unsafe"
+)
+
+// Values nested deeper than this are assumed to be cyclic, as in value.cc.
+const maxValueDepth = 100
+
+var errValueTooDeep = errors.New("value nested too deeply")
+
+// SendValue passes v to the $recv callback in js as a javascript value built
+// directly from it in a single call, instead of as JSON to be parsed. v is
+// converted the way encoding/json would: structs become objects with their
+// exported fields under their json tag names, maps with string or integer
+// keys objects, slices and arrays arrays, numbers numbers, and nil pointers,
+// maps and slices null. []byte becomes an ArrayBuffer. The field names of
+// each struct type are looked up once, and interned by the worker the first
+// time they are sent.
+func (w *Worker) SendValue(v interface{}) error {
+	w.touch()
+	if w.remote != nil {
+		return errRemote
+	}
+	w.internedKeysLocker.Lock()
+	e := valueEncoder{worker: w}
+	if err := e.encode(reflect.ValueOf(v), 0); err != nil {
+		e.abort()
+		w.internedKeysLocker.Unlock()
+		return err
+	}
+	keys, keysLength := bytesPointer(e.keys)
+	tape, tapeLength := bytesPointer(e.tape)
+
+	r := C.worker_send_value(w.cWorker, keys, keysLength, tape, tapeLength)
+	w.internedKeysLocker.Unlock()
+	if r != 0 {
+		errStr := C.worker_last_exception(w.cWorker)
+		return errors.New(C.GoString(errStr))
+	}
+
+	return nil
+}
+
+// SendSyncValue passes v, converted as by SendValue, to the $recvSync callback
+// in js and stores the value it returns in the value pointed to by result,
+// the way encoding/json's Unmarshal would. ArrayBuffers and typed arrays
+// decode into []byte.
+func (w *Worker) SendSyncValue(v interface{}, result interface{}) error {
+	w.touch()
+	if w.remote != nil {
+		return errRemote
+	}
+	out := reflect.ValueOf(result)
+	if out.Kind() != reflect.Ptr || out.IsNil() {
+		return errors.New("result must be a non-nil pointer")
+	}
+	w.internedKeysLocker.Lock()
+	e := valueEncoder{worker: w}
+	if err := e.encode(reflect.ValueOf(v), 0); err != nil {
+		e.abort()
+		w.internedKeysLocker.Unlock()
+		return err
+	}
+	keys, keysLength := bytesPointer(e.keys)
+	tape, tapeLength := bytesPointer(e.tape)
+
+	var cResult unsafe.Pointer
+	var cResultLength C.size_t
+	r := C.worker_send_sync_value(w.cWorker, keys, keysLength, tape, tapeLength, &cResult, &cResultLength)
+	w.internedKeysLocker.Unlock()
+	if r != 0 {
+		errStr := C.worker_last_exception(w.cWorker)
+		return errors.New(C.GoString(errStr))
+	}
+	defer C.free(cResult)
+
+	d := valueDecoder{}
+	if cResultLength > 0 {
+		d.tape = (*[1 << 30]byte)(cResult)[:cResultLength:cResultLength]
+	}
+	return d.decode(out.Elem(), 0)
+}
+
+func bytesPointer(b []byte) (unsafe.Pointer, C.size_t) {
+	if len(b) == 0 {
+		return nil, 0
+	}
+	return unsafe.Pointer(&b[0]), C.size_t(len(b))
+}
+
+// valueEncoder writes the tape of a Go value, see value.h. Struct field
+// names the worker has not interned yet are defined in keys.
+type valueEncoder struct {
+	worker *Worker
+	keys   []byte
+	keyIDs []int
+	tape   []byte
+}
+
+// abort forgets the keys defined so far, as they will not be sent.
+func (e *valueEncoder) abort() {
+	for _, id := range e.keyIDs {
+		e.worker.internedKeys[id] = false
+	}
+}
+
+func (e *valueEncoder) tag(t int) {
+	e.tape = append(e.tape, byte(t))
+}
+
+func (e *valueEncoder) uint32(n int) {
+	var b [4]byte
+	binary.LittleEndian.PutUint32(b[:], uint32(n))
+	e.tape = append(e.tape, b[:]...)
+}
+
+func (e *valueEncoder) bytes(s string) {
+	e.uint32(len(s))
+	e.tape = append(e.tape, s...)
+}
+
+func (e *valueEncoder) number(f float64) {
+	var b [8]byte
+	binary.LittleEndian.PutUint64(b[:], math.Float64bits(f))
+	e.tag(C.VALUE_NUMBER)
+	e.tape = append(e.tape, b[:]...)
+}
+
+func (e *valueEncoder) key(f *fieldPlan) {
+	w := e.worker
+	for len(w.internedKeys) <= f.key {
+		w.internedKeys = append(w.internedKeys, false)
+	}
+	if !w.internedKeys[f.key] {
+		var b [8]byte
+		binary.LittleEndian.PutUint32(b[:4], uint32(f.key))
+		binary.LittleEndian.PutUint32(b[4:], uint32(len(f.name)))
+		e.keys = append(append(e.keys, b[:]...), f.name...)
+		e.keyIDs = append(e.keyIDs, f.key)
+		w.internedKeys[f.key] = true
+	}
+	e.uint32(f.key)
+}
+
+func (e *valueEncoder) encode(v reflect.Value, depth int) error {
+	if depth > maxValueDepth {
+		return errValueTooDeep
+	}
+	switch v.Kind() {
+	case reflect.Invalid:
+		e.tag(C.VALUE_NULL)
+	case reflect.Ptr, reflect.Interface:
+		if v.IsNil() {
+			e.tag(C.VALUE_NULL)
+			return nil
+		}
+		return e.encode(v.Elem(), depth+1)
+	case reflect.Bool:
+		if v.Bool() {
+			e.tag(C.VALUE_TRUE)
+		} else {
+			e.tag(C.VALUE_FALSE)
+		}
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+		e.number(float64(v.Int()))
+	case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+		e.number(float64(v.Uint()))
+	case reflect.Float32, reflect.Float64:
+		e.number(v.Float())
+	case reflect.String:
+		e.tag(C.VALUE_STRING)
+		e.bytes(v.String())
+	case reflect.Struct:
+		plan := planOf(v.Type())
+		e.tag(C.VALUE_OBJECT)
+		// The count is patched once fields in nil embedded pointers are
+		// known to be left out.
+		countAt := len(e.tape)
+		e.uint32(0)
+		n := 0
+		for i := range plan.fields {
+			f, ok := fieldByIndex(v, plan.fields[i].index)
+			if !ok {
+				continue
+			}
+			e.key(&plan.fields[i])
+			if err := e.encode(f, depth+1); err != nil {
+				return err
+			}
+			n++
+		}
+		binary.LittleEndian.PutUint32(e.tape[countAt:], uint32(n))
+	case reflect.Map:
+		if v.IsNil() {
+			e.tag(C.VALUE_NULL)
+			return nil
+		}
+		e.tag(C.VALUE_MAP)
+		e.uint32(v.Len())
+		for _, k := range v.MapKeys() {
+			switch k.Kind() {
+			case reflect.String:
+				e.bytes(k.String())
+			case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+				e.bytes(strconv.FormatInt(k.Int(), 10))
+			case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+				e.bytes(strconv.FormatUint(k.Uint(), 10))
+			default:
+				return errors.New("unsupported map key type " + k.Type().String())
+			}
+			if err := e.encode(v.MapIndex(k), depth+1); err != nil {
+				return err
+			}
+		}
+	case reflect.Slice, reflect.Array:
+		if v.Kind() == reflect.Slice && v.IsNil() {
+			e.tag(C.VALUE_NULL)
+			return nil
+		}
+		if v.Kind() == reflect.Slice && v.Type().Elem().Kind() == reflect.Uint8 {
+			e.tag(C.VALUE_BYTES)
+			e.bytes(string(v.Bytes()))
+			return nil
+		}
+		e.tag(C.VALUE_ARRAY)
+		e.uint32(v.Len())
+		for i := 0; i < v.Len(); i++ {
+			if err := e.encode(v.Index(i), depth+1); err != nil {
+				return err
+			}
+		}
+	default:
+		return errors.New("unsupported type " + v.Type().String())
+	}
+	return nil
+}
+
+// valueDecoder reads the tape of a javascript value, see value.h.
+type valueDecoder struct {
+	tape []byte
+	pos  int
+}
+
+var errMalformedValue = errors.New("malformed value")
+
+func (d *valueDecoder) uint32() (int, error) {
+	if len(d.tape)-d.pos < 4 {
+		return 0, errMalformedValue
+	}
+	n := binary.LittleEndian.Uint32(d.tape[d.pos:])
+	d.pos += 4
+	return int(n), nil
+}
+
+func (d *valueDecoder) bytes() ([]byte, error) {
+	n, err := d.uint32()
+	if err != nil {
+		return nil, err
+	}
+	if len(d.tape)-d.pos < n {
+		return nil, errMalformedValue
+	}
+	b := d.tape[d.pos : d.pos+n]
+	d.pos += n
+	return b, nil
+}
+
+func (d *valueDecoder) number() (float64, error) {
+	if len(d.tape)-d.pos < 8 {
+		return 0, errMalformedValue
+	}
+	f := math.Float64frombits(binary.LittleEndian.Uint64(d.tape[d.pos:]))
+	d.pos += 8
+	return f, nil
+}
+
+// generic decodes a value the way encoding/json decodes into an empty
+// interface, with bytes as []byte.
+func (d *valueDecoder) generic(depth int) (interface{}, error) {
+	var v interface{}
+	err := d.decode(reflect.ValueOf(&v).Elem(), depth)
+	return v, err
+}
+
+func decodeError(what string, v reflect.Value) error {
+	return errors.New("cannot decode " + what + " into " + v.Type().String())
+}
+
+// decode stores the next value in v, which must be settable. Undefined and
+// null leave v unchanged unless it is a pointer, interface, map or slice,
+// which are set to nil.
+func (d *valueDecoder) decode(v reflect.Value, depth int) error {
+	if depth > maxValueDepth {
+		return errValueTooDeep
+	}
+	if d.pos >= len(d.tape) {
+		return errMalformedValue
+	}
+	tag := int(d.tape[d.pos])
+
+	if tag == C.VALUE_UNDEFINED || tag == C.VALUE_NULL {
+		d.pos++
+		switch v.Kind() {
+		case reflect.Ptr, reflect.Interface, reflect.Map, reflect.Slice:
+			v.Set(reflect.Zero(v.Type()))
+		}
+		return nil
+	}
+	if v.Kind() == reflect.Ptr {
+		if v.IsNil() {
+			v.Set(reflect.New(v.Type().Elem()))
+		}
+		return d.decode(v.Elem(), depth+1)
+	}
+	if v.Kind() == reflect.Interface && v.NumMethod() == 0 {
+		return d.decodeGeneric(v, tag, depth)
+	}
+
+	d.pos++
+	switch tag {
+	case C.VALUE_TRUE, C.VALUE_FALSE:
+		if v.Kind() != reflect.Bool {
+			return decodeError("boolean", v)
+		}
+		v.SetBool(tag == C.VALUE_TRUE)
+	case C.VALUE_NUMBER:
+		f, err := d.number()
+		if err != nil {
+			return err
+		}
+		switch v.Kind() {
+		case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+			v.SetInt(int64(f))
+		case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+			v.SetUint(uint64(f))
+		case reflect.Float32, reflect.Float64:
+			v.SetFloat(f)
+		default:
+			return decodeError("number", v)
+		}
+	case C.VALUE_STRING, C.VALUE_BYTES:
+		b, err := d.bytes()
+		if err != nil {
+			return err
+		}
+		switch {
+		case v.Kind() == reflect.String:
+			v.SetString(string(b))
+		case v.Kind() == reflect.Slice && v.Type().Elem().Kind() == reflect.Uint8 && tag == C.VALUE_BYTES:
+			v.SetBytes(append([]byte(nil), b...))
+		case tag == C.VALUE_STRING:
+			return decodeError("string", v)
+		default:
+			return decodeError("bytes", v)
+		}
+	case C.VALUE_ARRAY:
+		n, err := d.uint32()
+		if err != nil {
+			return err
+		}
+		switch v.Kind() {
+		case reflect.Slice:
+			v.Set(reflect.MakeSlice(v.Type(), n, n))
+		case reflect.Array:
+		default:
+			return decodeError("array", v)
+		}
+		for i := 0; i < n; i++ {
+			var err error
+			if i < v.Len() {
+				err = d.decode(v.Index(i), depth+1)
+			} else {
+				err = d.skip(depth + 1)
+			}
+			if err != nil {
+				return err
+			}
+		}
+	case C.VALUE_MAP:
+		n, err := d.uint32()
+		if err != nil {
+			return err
+		}
+		return d.decodeObject(v, n, depth)
+	default:
+		return errMalformedValue
+	}
+	return nil
+}
+
+func (d *valueDecoder) decodeObject(v reflect.Value, n int, depth int) error {
+	switch v.Kind() {
+	case reflect.Struct:
+		plan := planOf(v.Type())
+		for i := 0; i < n; i++ {
+			name, err := d.bytes()
+			if err != nil {
+				return err
+			}
+			j, ok := plan.byName[string(name)]
+			if !ok {
+				if err := d.skip(depth + 1); err != nil {
+					return err
+				}
+				continue
+			}
+			if err := d.decode(fieldByIndexAlloc(v, plan.fields[j].index), depth+1); err != nil {
+				return err
+			}
+		}
+	case reflect.Map:
+		t := v.Type()
+		if t.Key().Kind() != reflect.String {
+			return decodeError("object", v)
+		}
+		if v.IsNil() {
+			v.Set(reflect.MakeMap(t))
+		}
+		for i := 0; i < n; i++ {
+			name, err := d.bytes()
+			if err != nil {
+				return err
+			}
+			elem := reflect.New(t.Elem()).Elem()
+			if err := d.decode(elem, depth+1); err != nil {
+				return err
+			}
+			v.SetMapIndex(reflect.ValueOf(string(name)).Convert(t.Key()), elem)
+		}
+	default:
+		return decodeError("object", v)
+	}
+	return nil
+}
+
+func (d *valueDecoder) decodeGeneric(v reflect.Value, tag int, depth int) error {
+	switch tag {
+	case C.VALUE_ARRAY:
+		d.pos++
+		n, err := d.uint32()
+		if err != nil {
+			return err
+		}
+		out := make([]interface{}, n)
+		for i := range out {
+			if out[i], err = d.generic(depth + 1); err != nil {
+				return err
+			}
+		}
+		v.Set(reflect.ValueOf(out))
+	case C.VALUE_MAP:
+		d.pos++
+		n, err := d.uint32()
+		if err != nil {
+			return err
+		}
+		out := make(map[string]interface{}, n)
+		for i := 0; i < n; i++ {
+			name, err := d.bytes()
+			if err != nil {
+				return err
+			}
+			if out[string(name)], err = d.generic(depth + 1); err != nil {
+				return err
+			}
+		}
+		v.Set(reflect.ValueOf(out))
+	default:
+		var out reflect.Value
+		switch tag {
+		case C.VALUE_TRUE, C.VALUE_FALSE:
+			out = reflect.New(reflect.TypeOf(false)).Elem()
+		case C.VALUE_NUMBER:
+			out = reflect.New(reflect.TypeOf(float64(0))).Elem()
+		case C.VALUE_STRING:
+			out = reflect.New(reflect.TypeOf("")).Elem()
+		case C.VALUE_BYTES:
+			out = reflect.New(reflect.TypeOf([]byte(nil))).Elem()
+		default:
+			return errMalformedValue
+		}
+		if err := d.decode(out, depth); err != nil {
+			return err
+		}
+		v.Set(out)
+	}
+	return nil
+}
+
+// skip steps over the next value.
+func (d *valueDecoder) skip(depth int) error {
+	var v interface{}
+	return d.decode(reflect.ValueOf(&v).Elem(), depth)
+}
+
+// fieldByIndexAlloc is like fieldByIndex but allocates nil embedded pointers.
+func fieldByIndexAlloc(v reflect.Value, index []int) reflect.Value {
+	for i, x := range index {
+		if i > 0 && v.Kind() == reflect.Ptr {
+			if v.IsNil() {
+				v.Set(reflect.New(v.Type().Elem()))
+			}
+			v = v.Elem()
+		}
+		v = v.Field(x)
+	}
+	return v
+}
@@ -0,0 +1,53 @@
+#ifndef V8WORKER_VALUE_H_
+#define V8WORKER_VALUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "v8.h"
+
+// Plain values travel between Go and javascript as a tape: a flat buffer of
+// VALUE_* tags from binding.h, each followed by its payload. Integers are
+// 32-bit and numbers 64-bit IEEE 754, both little-endian.
+//
+//   VALUE_NUMBER  double
+//   VALUE_STRING  length, UTF-8 bytes
+//   VALUE_BYTES   length, bytes (an ArrayBuffer in javascript)
+//   VALUE_ARRAY   count, count values
+//   VALUE_OBJECT  count, count times a key id and a value
+//   VALUE_MAP     count, count times a key as length and UTF-8 bytes, and a value
+//
+// Key ids stand for the field names of Go structs. The Go side defines each
+// one for a worker once, in a key section of (id, length, UTF-8 bytes)
+// entries passed along with the tape, and the worker keeps it as an
+// internalized string from then on.
+
+// Internalized strings of the key ids a worker has been sent.
+class KeyTable {
+ public:
+  ~KeyTable();
+
+  // Defines the keys in a key section. Returns false if it is malformed.
+  bool Define(v8::Isolate* isolate, const char* data, size_t length);
+
+  // Returns an empty handle for an undefined id.
+  v8::Local<v8::String> Get(v8::Isolate* isolate, uint32_t id);
+
+ private:
+  std::vector<v8::Persistent<v8::String>*> keys_;
+};
+
+// Builds the javascript value encoded in tape. Returns an empty handle and
+// sets *error if the tape is malformed.
+v8::Local<v8::Value> DecodeValue(v8::Isolate* isolate, KeyTable* keys,
+                                 const char* tape, size_t length,
+                                 std::string* error);
+
+// Appends the encoding of value to *tape. Functions and symbols become
+// undefined. Returns false and sets *error if value is nested too deeply,
+// most likely because it is cyclic, or a getter threw.
+bool EncodeValue(v8::Isolate* isolate, v8::Local<v8::Value> value,
+                 std::string* tape, std::string* error);
+
+#endif  // V8WORKER_VALUE_H_
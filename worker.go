@@ -8,10 +8,18 @@ package v8worker
 */
 import "C"
 import (
+	"bytes"
+	"compress/flate"
 	"errors"
+	"io"
+	"io/ioutil"
+	"math"
+	"os"
 	"runtime"
 	"strconv"
 	"sync"
+	"sync/atomic"
+	"time"
 	"unsafe"
 )
 
@@ -35,13 +43,112 @@ type ReceiveSyncMessageCallback func(msg string) string
 
 // This is a golang wrapper around a single V8 Isolate.
 type Worker struct {
-	cWorker *C.worker
+	// Unix time in nanoseconds of the last message sent to the worker.
+	// Accessed atomically, first in the struct to be 64-bit aligned.
+	lastActive int64
+
+	cWorker  *C.worker
+	id       int
+	cOptions C.worker_options
+	// Held for writing while cWorker or remote change, by Dispose,
+	// Hibernate and Restore, and for reading by the calls other goroutines
+	// make, such as a Governor's, so that they never reach a disposed
+	// isolate.
+	cWorkerLocker sync.RWMutex
+	// The host running the worker if it is out of process. See Host.
+	remote    *Host
+	codeCache *CodeCache
+	fileRoot  string
+	cache     *Cache
+	// See Options.MaxDecompressedSize.
+	maxDecompressedSize int
+
+	// Scripts loaded so far, kept if the worker is hibernatable so that it
+	// can be rebuilt. See Hibernate.
+	hibernatable    bool
+	scripts         []loadedScript
+	hibernationPath string
+
+	// Struct field names interned by the isolate, by key id. Held from
+	// encoding a value until the isolate has it. See SendValue.
+	internedKeysLocker sync.Mutex
+	internedKeys       []bool
 }
 
 // This is a wrapper for worker callbacks
 type callbacks struct {
 	cb     ReceiveMessageCallback
 	syncCB ReceiveSyncMessageCallback
+	// Signalled when $readFile calls are done. See ReadsReady.
+	reads chan struct{}
+}
+
+// Stream is a bounded queue of byte chunks flowing from Go into a worker. See
+// NewStream and SendStream.
+type Stream struct {
+	worker  *Worker
+	cStream *C.stream
+}
+
+// HugePageMode selects how a worker's large array buffers are backed.
+type HugePageMode int
+
+const (
+	// HugePagesOff uses regular pages.
+	HugePagesOff HugePageMode = C.HUGE_PAGES_OFF
+	// HugePagesTransparent aligns buffers of 2 MB and more to huge page
+	// boundaries and advises the kernel to back them with transparent huge
+	// pages.
+	HugePagesTransparent HugePageMode = C.HUGE_PAGES_TRANSPARENT
+	// HugePagesExplicit takes buffers of 2 MB and more from the hugetlb pool
+	// reserved in /proc/sys/vm/nr_hugepages, falling back to transparent huge
+	// pages when it is exhausted.
+	HugePagesExplicit HugePageMode = C.HUGE_PAGES_EXPLICIT
+)
+
+// Options configures a worker created with NewWithOptions.
+type Options struct {
+	HugePages HugePageMode
+	// Hibernatable keeps the scripts loaded into the worker so that it can
+	// be hibernated. See Worker.Hibernate.
+	Hibernatable bool
+	// MaxHeapSizeMB limits the old generation of the worker's heap. Zero
+	// uses V8's default. See Governor.HeapLimitMB.
+	MaxHeapSizeMB int
+	// CodeCache shares compiled scripts with other workers. Not used by
+	// workers running in a Host.
+	CodeCache *CodeCache
+	// Codecs installs the TextEncoder, TextDecoder, atob and btoa globals,
+	// and $base64 and $hex objects whose encode takes an ArrayBuffer or a
+	// view of one and returns a string, and whose decode does the reverse,
+	// returning a Uint8Array. They run natively, with SIMD on x86 CPUs that
+	// support SSSE3.
+	Codecs bool
+	// FileRoot installs $readFile(path, {offset, length}), which reads the
+	// file at path under FileRoot on a pool of I/O threads into a new
+	// ArrayBuffer and returns a promise of it. Paths leading outside of
+	// FileRoot are refused. The promise settles, and the callbacks waiting
+	// on it run, the next time the worker is sent a message or SettleReads
+	// is called, on that goroutine. ReadsReady tells when reads are done.
+	// Not used by workers running in a Host.
+	FileRoot string
+	// SyncCache answers repeated $sendSync requests without calling the
+	// ReceiveSyncMessageCallback, and may be shared by many workers.
+	SyncCache *SyncCache
+	// Memoize treats the scripts as pure functions of the messages sent
+	// with Send: the messages a $recv call passes to $send are kept and
+	// replayed for the same message to any worker with the same scripts,
+	// without running javascript. Calls that fail, or that use $sendSync,
+	// $readFile, $cache, streams or proxies, are not kept. See
+	// SetMemoCacheSize.
+	Memoize bool
+	// Cache installs $cache, backed by an off-heap cache that may be shared
+	// with other workers. Not used by workers running in a Host.
+	Cache *Cache
+	// MaxDecompressedSize is the largest message SendCompressed and
+	// SendCompressedBuffer decompress, in bytes, so that a small corrupt or
+	// hostile message cannot expand without bound. Defaults to 256 MB.
+	MaxDecompressedSize int
 }
 
 // ScriptOrigin represents V8 class – see http://v8.paulfryzel.com/docs/master/classv8_1_1_script_origin.html
@@ -68,6 +175,20 @@ type HeapStatistics struct {
 	DoesZapGarbage          int
 }
 
+// HugePageStatistics reports how much memory ended up backed by huge pages.
+type HugePageStatistics struct {
+	// Bytes of the worker's array buffers in hugetlb pages.
+	ExplicitBytes int
+	// Bytes of the worker's array buffers advised for transparent huge pages.
+	// The kernel may not have backed all of them.
+	TransparentBytes int
+	// Anonymous memory of the whole process backed by transparent huge
+	// pages, including the V8 heaps if the system enables them everywhere.
+	ProcessAnonHugeBytes int
+	// hugetlb memory of the whole process.
+	ProcessHugetlbBytes int
+}
+
 // Version return the V8 version E.G. "4.3.59"
 func Version() string {
 	return C.GoString(C.worker_version())
@@ -82,6 +203,21 @@ func recvCb(msg_s *C.char, workerId int) {
 	fn(msg)
 }
 
+// Called on an I/O thread, so it only wakes up whoever settles the reads.
+//export readsReadyCb
+func readsReadyCb(workerId int) {
+	callbacksMapLocker.RLock()
+	c := callbacksMap[workerId]
+	callbacksMapLocker.RUnlock()
+	if c == nil {
+		return
+	}
+	select {
+	case c.reads <- struct{}{}:
+	default:
+	}
+}
+
 //export recvSyncCb
 func recvSyncCb(msg_s *C.char, workerId int) *C.char {
 	msg := C.GoString(msg_s)
@@ -95,37 +231,167 @@ func recvSyncCb(msg_s *C.char, workerId int) *C.char {
 // New creates a new worker, which corresponds to a V8 isolate. A single threaded
 // standalone execution context.
 func New(cb ReceiveMessageCallback, syncCB ReceiveSyncMessageCallback) *Worker {
-	id := nextWorkerId()
+	return NewWithOptions(cb, syncCB, nil)
+}
 
-	cbWrapper := &callbacks{
-		cb:     cb,
-		syncCB: syncCB,
+// NewWithOptions creates a new worker configured by opts. A nil opts is the
+// same as New.
+func NewWithOptions(cb ReceiveMessageCallback, syncCB ReceiveSyncMessageCallback, opts *Options) *Worker {
+	if opts == nil {
+		opts = new(Options)
 	}
-	callbacksMapLocker.Lock()
-	callbacksMap[id] = cbWrapper
-	callbacksMapLocker.Unlock()
+	id := registerCallbacks(cb, opts.SyncCache.wrap(syncCB))
 
 	initV8Once.Do(func() {
 		C.v8_init()
 	})
 
-	worker := &Worker{}
-	worker.cWorker = C.worker_new(C.int(id))
+	cOptions := newCOptions(opts)
+	maxDecompressedSize := opts.MaxDecompressedSize
+	if maxDecompressedSize <= 0 {
+		maxDecompressedSize = defaultMaxDecompressedSize
+	}
+
+	worker := &Worker{
+		lastActive:   time.Now().UnixNano(),
+		id:           id,
+		cOptions:     cOptions,
+		hibernatable: opts.Hibernatable,
+		codeCache:    opts.CodeCache,
+		fileRoot:     opts.FileRoot,
+		cache:        opts.Cache,
+
+		maxDecompressedSize: maxDecompressedSize,
+	}
+	worker.newCWorker()
 	runtime.SetFinalizer(worker, func(final_worker *Worker) {
-		C.worker_dispose(final_worker.cWorker)
-		callbacksMapLocker.Lock()
-		delete(callbacksMap, id)
-		callbacksMapLocker.Unlock()
+		final_worker.Dispose()
 	})
 	return worker
 }
 
+// newCWorker creates the isolate of w from its options.
+func (w *Worker) newCWorker() {
+	w.cWorker = C.worker_new(C.int(w.id), &w.cOptions)
+	if w.fileRoot != "" {
+		cRoot := C.CString(w.fileRoot)
+		C.worker_enable_read_file(w.cWorker, cRoot)
+		C.free(unsafe.Pointer(cRoot))
+	}
+	if w.cache != nil {
+		C.worker_set_cache(w.cWorker, w.cache.cCache)
+	}
+}
+
+// registerCallbacks assigns an id to a new worker and routes the messages
+// from its isolate to cb and syncCB.
+func registerCallbacks(cb ReceiveMessageCallback, syncCB ReceiveSyncMessageCallback) int {
+	id := nextWorkerId()
+	cbWrapper := &callbacks{
+		cb:     cb,
+		syncCB: syncCB,
+		reads:  make(chan struct{}, 1),
+	}
+	callbacksMapLocker.Lock()
+	callbacksMap[id] = cbWrapper
+	callbacksMapLocker.Unlock()
+	return id
+}
+
+func newCOptions(opts *Options) C.worker_options {
+	var codecs, memoize C.int
+	if opts.Codecs {
+		codecs = 1
+	}
+	if opts.Memoize {
+		memoize = 1
+	}
+	return C.worker_options{
+		huge_pages:         C.int(opts.HugePages),
+		max_old_space_size: C.int(opts.MaxHeapSizeMB),
+		codecs:             codecs,
+		memoize:            memoize,
+	}
+}
+
+// Dispose releases the worker's isolate. The teardown runs on a background
+// thread, so Dispose returns immediately even for large heaps. The worker
+// must not be used afterwards. Workers that are not disposed are released
+// once unreachable.
+func (w *Worker) Dispose() {
+	w.cWorkerLocker.Lock()
+	if w.remote != nil {
+		w.remote.dispose(w.id)
+		w.remote = nil
+	}
+	if w.cWorker != nil {
+		C.worker_dispose(w.cWorker)
+		w.cWorker = nil
+	}
+	w.cWorkerLocker.Unlock()
+	if w.hibernationPath != "" {
+		os.Remove(w.hibernationPath)
+		w.hibernationPath = ""
+	}
+	callbacksMapLocker.Lock()
+	delete(callbacksMap, w.id)
+	callbacksMapLocker.Unlock()
+}
+
+// ReadsReady returns a channel receiving a value when $readFile calls of the
+// worker are done, after which SettleReads, or any message sent to the
+// worker, settles their promises. See Options.FileRoot.
+func (w *Worker) ReadsReady() <-chan struct{} {
+	callbacksMapLocker.RLock()
+	defer callbacksMapLocker.RUnlock()
+	return callbacksMap[w.id].reads
+}
+
+// SettleReads settles the promises of the $readFile calls done so far and
+// runs the callbacks waiting on them. It returns the number of reads
+// settled.
+func (w *Worker) SettleReads() int {
+	if w.remote != nil || w.cWorker == nil {
+		return 0
+	}
+	w.touch()
+	return int(C.worker_settle_reads(w.cWorker))
+}
+
+// DisposePending returns the number of workers waiting to be torn down.
+func DisposePending() int {
+	return int(C.worker_dispose_pending())
+}
+
 // Optional notification that the embedder is idle.
 // http://v8.paulfryzel.com/docs/master/classv8_1_1_isolate.html#aba794ed25d4fa8780b3a07c66a5e5d4a
 func (w *Worker) IdleNotificationDeadline(deadLineInSeconds float64) bool {
+	if w.remote != nil {
+		return false
+	}
 	return bool(C.worker_idle_notification_deadline(w.cWorker, C.double(deadLineInSeconds)))
 }
 
+// IdleNotification lets V8 use up to idleTime from now for garbage collection.
+// It returns true if there is no more garbage to collect.
+func (w *Worker) IdleNotification(idleTime time.Duration) bool {
+	w.cWorkerLocker.RLock()
+	defer w.cWorkerLocker.RUnlock()
+	if w.remote != nil || w.cWorker == nil {
+		return false
+	}
+	return bool(C.worker_idle_notification(w.cWorker, C.double(idleTime.Seconds())))
+}
+
+// LastActive returns when a message was last sent to the worker.
+func (w *Worker) LastActive() time.Time {
+	return time.Unix(0, atomic.LoadInt64(&w.lastActive))
+}
+
+func (w *Worker) touch() {
+	atomic.StoreInt64(&w.lastActive, time.Now().UnixNano())
+}
+
 // Load loads and executes a javascript file with the filename specified by
 // scriptName and the contents of the file specified by the param code.
 func (w *Worker) Load(scriptName string, code string) error {
@@ -133,9 +399,16 @@ func (w *Worker) Load(scriptName string, code string) error {
 }
 
 // GetHeapStatistics returns statistics about the V8 isolate heap memory usage
+// and is empty for a disposed or hibernated worker.
 func (w *Worker) GetHeapStatistics() *HeapStatistics {
 	hs := C.struct_heap_statistics_s{}
-	C.worker_get_heap_statistics(w.cWorker, &hs)
+	w.cWorkerLocker.RLock()
+	if w.remote != nil {
+		w.remote.heapStatistics(w.id, &hs)
+	} else if w.cWorker != nil {
+		C.worker_get_heap_statistics(w.cWorker, &hs)
+	}
+	w.cWorkerLocker.RUnlock()
 	return &HeapStatistics{
 		TotalHeapSize:           int(hs.total_heap_size),
 		TotalHeapSizeExecutable: int(hs.total_heap_size_executable),
@@ -148,17 +421,83 @@ func (w *Worker) GetHeapStatistics() *HeapStatistics {
 	}
 }
 
+// GetHugePageStatistics returns how much of the worker's array buffer memory,
+// and of the whole process, is backed by huge pages. Only the process-wide
+// fields are filled in while the worker is hibernated or disposed.
+func (w *Worker) GetHugePageStatistics() *HugePageStatistics {
+	hs := C.struct_huge_page_statistics_s{}
+	w.cWorkerLocker.RLock()
+	if w.cWorker != nil {
+		C.worker_get_huge_page_statistics(w.cWorker, &hs)
+	} else if w.remote == nil {
+		C.get_process_huge_page_statistics(&hs)
+	}
+	w.cWorkerLocker.RUnlock()
+	return &HugePageStatistics{
+		ExplicitBytes:        int(hs.explicit_bytes),
+		TransparentBytes:     int(hs.transparent_bytes),
+		ProcessAnonHugeBytes: int(hs.process_anon_huge_bytes),
+		ProcessHugetlbBytes:  int(hs.process_hugetlb_bytes),
+	}
+}
+
+// CPUTime returns the CPU time the worker has spent loading scripts, in its
+// $recv and $recvSync callbacks and in the callbacks of its $readFile
+// promises. Not measured for workers running in a
+// Host. Zero while the worker is hibernated or disposed, and counted again
+// from zero after Restore.
+func (w *Worker) CPUTime() time.Duration {
+	if w.remote != nil {
+		return 0
+	}
+	w.cWorkerLocker.RLock()
+	defer w.cWorkerLocker.RUnlock()
+	if w.cWorker == nil {
+		return 0
+	}
+	return time.Duration(C.worker_cpu_time(w.cWorker))
+}
+
 // LoadWithOptions loads and executes a javascript file with the ScriptOrigin specified by
 // origin and the contents of the file specified by the param code.
 func (w *Worker) LoadWithOptions(origin *ScriptOrigin, code string) error {
-	cCode := C.CString(code)
-
 	if origin == nil {
 		origin = new(ScriptOrigin)
 	}
 	if origin.ScriptName == "" {
 		origin.ScriptName = nextScriptName()
 	}
+
+	var err error
+	if w.codeCache != nil && w.remote == nil {
+		err = w.codeCache.load(w, origin, code)
+	} else {
+		err = w.load(origin, code, nil)
+	}
+	if err != nil {
+		return err
+	}
+	if w.hibernatable {
+		w.scripts = append(w.scripts, loadedScript{origin: *origin, code: code})
+	}
+	return nil
+}
+
+// load compiles and runs code. A code cache from produceCodeCache lets V8
+// skip compiling it.
+func (w *Worker) load(origin *ScriptOrigin, code string, cache []byte) error {
+	_, _, err := w.loadCached(origin, code, cache, false)
+	return err
+}
+
+// loadCached is like load, also reporting whether V8 rejected cache. With
+// produce and no cache, it returns V8's code cache for the script, taken
+// from the compilation that runs it.
+func (w *Worker) loadCached(origin *ScriptOrigin, code string, cache []byte, produce bool) (produced []byte, rejected bool, err error) {
+	if w.remote != nil {
+		return nil, false, w.remote.load(w.id, origin, code)
+	}
+	cCode := C.CString(code)
 	cScriptName := C.CString(origin.ScriptName)
 	cLineOffset := C.int(origin.LineOffset)
 	cColumnOffset := C.int(origin.ColumnOffset)
@@ -172,23 +511,66 @@ func (w *Worker) LoadWithOptions(origin *ScriptOrigin, code string) error {
 	defer C.free(unsafe.Pointer(cCode))
 	defer C.free(unsafe.Pointer(cSourceMapURL))
 
-	r := C.worker_load(w.cWorker, cCode, cScriptName, cLineOffset, cColumnOffset, cIsSharedCrossOrigin, cScriptId, cIsEmbedderDebugScript, cSourceMapURL, cIsOpaque)
+	cCache := C.code_cache{produce: C.bool(produce)}
+	if len(cache) > 0 {
+		// Copied, as cgo does not let the struct passed to C point to Go
+		// memory.
+		cCache.data = C.CBytes(cache)
+		cCache.length = C.int(len(cache))
+		defer C.free(cCache.data)
+	}
+
+	r := C.worker_load(w.cWorker, cCode, cScriptName, cLineOffset, cColumnOffset, cIsSharedCrossOrigin, cScriptId, cIsEmbedderDebugScript, cSourceMapURL, cIsOpaque, &cCache)
+	if cCache.produced != nil {
+		produced = C.GoBytes(cCache.produced, cCache.produced_length)
+		C.free(cCache.produced)
+	}
+	rejected = bool(cCache.rejected)
 	if r != 0 {
 		errStr := C.worker_last_exception(w.cWorker)
-		return errors.New(C.GoString(errStr))
+		return produced, rejected, errors.New(C.GoString(errStr))
 	}
-	return nil
+	return produced, rejected, nil
+}
+
+// produceCodeCache compiles code without running it and returns V8's code
+// cache for it, or nil.
+func (w *Worker) produceCodeCache(scriptName string, code string) []byte {
+	cCode := C.CString(code)
+	cScriptName := C.CString(scriptName)
+	defer C.free(unsafe.Pointer(cCode))
+	defer C.free(unsafe.Pointer(cScriptName))
+
+	var length C.int
+	data := C.worker_produce_code_cache(w.cWorker, cCode, cScriptName, &length)
+	if data == nil {
+		return nil
+	}
+	defer C.free(data)
+	return C.GoBytes(data, length)
 }
 
 // LowMemoryNotification for optional notification that the system is running low on memory.
 // V8 uses these notifications to attempt to free memory.
 // http://v8.paulfryzel.com/docs/master/classv8_1_1_isolate.html#aaf446f4877e4707a93d2c406fffd9fd6
 func (w *Worker) LowMemoryNotification() {
-	C.worker_low_memory_notification(w.cWorker)
+	w.cWorkerLocker.RLock()
+	defer w.cWorkerLocker.RUnlock()
+	if w.remote != nil {
+		w.remote.lowMemoryNotification(w.id)
+		return
+	}
+	if w.cWorker != nil {
+		C.worker_low_memory_notification(w.cWorker)
+	}
 }
 
 // Send sends a message to a worker. The $recv callback in js will be called.
 func (w *Worker) Send(msg string) error {
+	w.touch()
+	if w.remote != nil {
+		return w.remote.send(w.id, []byte(msg))
+	}
 	msg_s := C.CString(string(msg))
 	defer C.free(unsafe.Pointer(msg_s))
 
@@ -201,9 +583,207 @@ func (w *Worker) Send(msg string) error {
 	return nil
 }
 
+// Largest total size of the messages passed to SendMessages at once, as
+// they are handed over with 32-bit offsets.
+const maxMessagesBytes = math.MaxInt32
+
+// SendMessages passes msgs to the $recv callback one after the other, like
+// calling Send for each but entering the worker only once. It stops at the
+// first error and returns the number of messages handled before it. The
+// messages must total at most 2 GB.
+func (w *Worker) SendMessages(msgs []string) (int, error) {
+	if w.remote != nil {
+		for i, msg := range msgs {
+			if err := w.Send(msg); err != nil {
+				return i, err
+			}
+		}
+		return len(msgs), nil
+	}
+	w.touch()
+	if len(msgs) == 0 {
+		return 0, nil
+	}
+
+	total := 0
+	for _, msg := range msgs {
+		if total += len(msg); total > maxMessagesBytes {
+			return 0, errors.New("messages larger than 2 GB")
+		}
+	}
+	data := make([]byte, 0, total)
+	ends := make([]int32, len(msgs))
+	for i, msg := range msgs {
+		data = append(data, msg...)
+		ends[i] = int32(len(data))
+	}
+	var cData *C.char
+	if len(data) > 0 {
+		cData = (*C.char)(unsafe.Pointer(&data[0]))
+	}
+	var sent C.int
+	r := C.worker_send_messages(w.cWorker, cData, (*C.int32_t)(unsafe.Pointer(&ends[0])), C.int(len(msgs)), &sent)
+	if r != 0 {
+		errStr := C.worker_last_exception(w.cWorker)
+		return int(sent), errors.New(C.GoString(errStr))
+	}
+	return len(msgs), nil
+}
+
+// Default for Options.MaxDecompressedSize.
+const defaultMaxDecompressedSize = 256 << 20
+
+var errDecompressedTooLarge = errors.New("decompressed message too large")
+
+// Compress deflates msg into the raw DEFLATE (RFC 1951) format accepted by
+// SendCompressed and SendCompressedBuffer.
+func Compress(msg []byte) ([]byte, error) {
+	var buf bytes.Buffer
+	zw, err := flate.NewWriter(&buf, flate.DefaultCompression)
+	if err != nil {
+		return nil, err
+	}
+	if _, err := zw.Write(msg); err != nil {
+		return nil, err
+	}
+	if err := zw.Close(); err != nil {
+		return nil, err
+	}
+	return buf.Bytes(), nil
+}
+
+// SendCompressed sends a raw DEFLATE compressed message to a worker. The $recv
+// callback in js will be called with the decompressed string. Decompression
+// happens inside the binding directly into the string's memory, so the
+// uncompressed message is never materialized on the Go side. sizeHint is the
+// uncompressed size if known, or 0, and must not be negative. The binding
+// allocates exactly that much up front. Non-ASCII messages are still copied
+// into the V8 heap as they are decoded from UTF-8. Messages decompressing to
+// more than Options.MaxDecompressedSize fail.
+func (w *Worker) SendCompressed(compressed []byte, sizeHint int) error {
+	return w.sendCompressed(compressed, sizeHint, false)
+}
+
+// SendCompressedBuffer is like SendCompressed but the $recv callback in js
+// will be called with an ArrayBuffer holding the decompressed bytes.
+func (w *Worker) SendCompressedBuffer(compressed []byte, sizeHint int) error {
+	return w.sendCompressed(compressed, sizeHint, true)
+}
+
+func (w *Worker) sendCompressed(compressed []byte, sizeHint int, asBuffer bool) error {
+	if sizeHint < 0 {
+		return errors.New("negative size hint")
+	}
+	if sizeHint > w.maxDecompressedSize {
+		return errDecompressedTooLarge
+	}
+	w.touch()
+	if w.remote != nil {
+		if asBuffer {
+			return errRemote
+		}
+		r := io.LimitReader(flate.NewReader(bytes.NewReader(compressed)), int64(w.maxDecompressedSize)+1)
+		msg, err := ioutil.ReadAll(r)
+		if err != nil {
+			return err
+		}
+		if len(msg) > w.maxDecompressedSize {
+			return errDecompressedTooLarge
+		}
+		return w.remote.send(w.id, msg)
+	}
+	var data unsafe.Pointer
+	if len(compressed) > 0 {
+		data = unsafe.Pointer(&compressed[0])
+	}
+
+	r := C.worker_send_compressed(w.cWorker, data, C.size_t(len(compressed)), C.size_t(sizeHint), C.size_t(w.maxDecompressedSize), C.bool(asBuffer))
+	if r != 0 {
+		errStr := C.worker_last_exception(w.cWorker)
+		return errors.New(C.GoString(errStr))
+	}
+
+	return nil
+}
+
+// NewStream creates a stream that can be passed to javascript with SendStream.
+// At most capacity bytes are buffered, Write blocks while the buffer is full,
+// so arbitrarily large inputs can be processed with constant memory.
+//
+// Streams are not supported for workers running in a Host: the stream's
+// Write and Close and SendStream fail for them.
+func (w *Worker) NewStream(capacity int) *Stream {
+	if w.remote != nil {
+		return &Stream{worker: w}
+	}
+	s := &Stream{
+		worker:  w,
+		cStream: C.worker_stream_new(w.cWorker, C.size_t(capacity)),
+	}
+	runtime.SetFinalizer(s, func(final_stream *Stream) {
+		C.stream_release(final_stream.cStream)
+	})
+	return s
+}
+
+// Write queues a copy of p as a single chunk. It blocks while the stream is
+// full and fails once javascript has stopped reading or the worker is
+// disposed.
+func (s *Stream) Write(p []byte) (int, error) {
+	if s.cStream == nil {
+		return 0, errRemote
+	}
+	if len(p) == 0 {
+		return 0, nil
+	}
+	r := C.stream_write(s.cStream, unsafe.Pointer(&p[0]), C.size_t(len(p)))
+	// The finalizer must not release the stream while the write blocks.
+	runtime.KeepAlive(s)
+	if r != 0 {
+		return 0, errors.New("stream reader is gone")
+	}
+	return len(p), nil
+}
+
+// Close marks the end of the stream. javascript sees it after reading all
+// chunks written before.
+func (s *Stream) Close() error {
+	if s.cStream == nil {
+		return errRemote
+	}
+	C.stream_close(s.cStream)
+	runtime.KeepAlive(s)
+	return nil
+}
+
+// SendStream passes a stream object to the $recv callback in js. The object
+// has read() and readString() methods, returning the next chunk as an
+// ArrayBuffer or string, or null at the end of the stream, and is iterable
+// with for-of. Reads block until the Go side writes, so the stream must be
+// written from another goroutine. It is only readable until the callback
+// returns.
+func (w *Worker) SendStream(s *Stream) error {
+	w.touch()
+	if w.remote != nil || s.cStream == nil {
+		return errRemote
+	}
+	r := C.worker_send_stream(w.cWorker, s.cStream)
+	runtime.KeepAlive(s)
+	if r != 0 {
+		errStr := C.worker_last_exception(w.cWorker)
+		return errors.New(C.GoString(errStr))
+	}
+
+	return nil
+}
+
 // SendSync sends a message to a worker. The $recvSync callback in js will be called.
 // That callback will return a string which is passed to golang and used as the return value of SendSync.
 func (w *Worker) SendSync(msg string) string {
+	w.touch()
+	if w.remote != nil {
+		return w.remote.sendSync(w.id, msg)
+	}
 	msg_s := C.CString(string(msg))
 	defer C.free(unsafe.Pointer(msg_s))
 
@@ -213,6 +793,10 @@ func (w *Worker) SendSync(msg string) string {
 
 // TerminateExecution terminates execution of javascript
 func (w *Worker) TerminateExecution() {
+	if w.remote != nil {
+		w.remote.terminate(w.id)
+		return
+	}
 	C.worker_terminate_execution(w.cWorker)
 }
 
@@ -1,9 +1,19 @@
 package v8worker
 
 import (
+	"bytes"
+	"errors"
 	"fmt"
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"reflect"
 	"runtime"
+	"strconv"
 	"strings"
+	"sync"
+	"sync/atomic"
 	"testing"
 	"time"
 )
@@ -184,6 +194,30 @@ func TestWorkerDeletion(t *testing.T) {
 	}
 }
 
+func TestWorkerDispose(t *testing.T) {
+	for i := 0; i < 8; i++ {
+		worker := New(func(msg string) {}, DiscardSendSync)
+		err := worker.Load("big.js", `
+			var keep = [];
+			for (var i = 0; i < 1e6; i++) keep.push({ i: i });
+		`)
+		if err != nil {
+			t.Fatal(err)
+		}
+		start := time.Now()
+		worker.Dispose()
+		t.Logf("dispose took %v", time.Since(start))
+		worker.Dispose()
+	}
+
+	for i := 0; DisposePending() > 0; i++ {
+		if i == 100 {
+			t.Fatal("workers not disposed", DisposePending())
+		}
+		time.Sleep(50 * time.Millisecond)
+	}
+}
+
 // Test breaking script execution
 func TestWorkerBreaking(t *testing.T) {
 	worker := New(func(msg string) {
@@ -266,3 +300,1518 @@ func TestGetHeapStatistics(t *testing.T) {
 	statistics = worker.GetHeapStatistics()
 	fmt.Println("Used 3: ", statistics.UsedHeapSize)
 }
+
+func TestSendCompressed(t *testing.T) {
+	var caught []string
+	worker := New(func(msg string) {
+		caught = append(caught, msg)
+	}, DiscardSendSync)
+	code := `
+	$recv(function(msg) {
+		if (typeof msg === "string") {
+			var doc = JSON.parse(msg);
+			$send("string:" + doc.items.length + ":" + doc.name);
+		} else {
+			$send("buffer:" + msg.byteLength);
+		}
+	});
+`
+	err := worker.Load("code.js", code)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	items := make([]string, 10000)
+	for i := range items {
+		items[i] = `"item` + strconv.Itoa(i) + `"`
+	}
+	ascii := `{"name":"caf\u00e9","items":[` + strings.Join(items, ",") + `]}`
+	unicode := `{"name":"café ☕","items":[` + strings.Join(items, ",") + `]}`
+
+	for _, doc := range []string{ascii, unicode} {
+		compressed, err := Compress([]byte(doc))
+		if err != nil {
+			t.Fatal(err)
+		}
+		if err := worker.SendCompressed(compressed, len(doc)); err != nil {
+			t.Fatal(err)
+		}
+		if err := worker.SendCompressed(compressed, 0); err != nil {
+			t.Fatal(err)
+		}
+		if err := worker.SendCompressedBuffer(compressed, len(doc)); err != nil {
+			t.Fatal(err)
+		}
+		if err := worker.SendCompressed(compressed[:len(compressed)/2], 0); err == nil {
+			t.Fatal("Expected error for truncated message")
+		}
+		if err := worker.SendCompressed(compressed, -1); err == nil {
+			t.Fatal("Expected error for negative size hint")
+		}
+	}
+
+	// A message expanding past MaxDecompressedSize fails instead of growing
+	// without bound.
+	limited := NewWithOptions(func(msg string) {}, DiscardSendSync, &Options{MaxDecompressedSize: 1 << 20})
+	defer limited.Dispose()
+	if err := limited.Load("code.js", code); err != nil {
+		t.Fatal(err)
+	}
+	bomb, err := Compress(make([]byte, 4<<20))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := limited.SendCompressedBuffer(bomb, 0); err == nil {
+		t.Fatal("Expected error for message over MaxDecompressedSize")
+	}
+	if err := limited.SendCompressedBuffer(bomb, 4<<20); err == nil {
+		t.Fatal("Expected error for size hint over MaxDecompressedSize")
+	}
+
+	want := []string{
+		"string:10000:café",
+		"string:10000:café",
+		"buffer:" + strconv.Itoa(len(ascii)),
+		"string:10000:café ☕",
+		"string:10000:café ☕",
+		"buffer:" + strconv.Itoa(len(unicode)),
+	}
+	if strings.Join(caught, "|") != strings.Join(want, "|") {
+		t.Fatalf("got %q want %q", caught, want)
+	}
+}
+
+func TestSendStream(t *testing.T) {
+	var caught []string
+	worker := New(func(msg string) {
+		caught = append(caught, msg)
+	}, DiscardSendSync)
+	code := `
+	var mode = "lines";
+	$recv(function(stream) {
+		if (mode === "lines") {
+			var lines = 0, tail = "", chunk;
+			while ((chunk = stream.readString()) !== null) {
+				var parts = (tail + chunk).split("\n");
+				tail = parts.pop();
+				lines += parts.length;
+			}
+			$send("lines:" + lines + ":" + tail);
+			mode = "bytes";
+		} else {
+			var bytes = 0;
+			for (var buf of stream) {
+				bytes += buf.byteLength;
+				if (bytes >= 1024) break;
+			}
+			$send("bytes:" + bytes);
+		}
+	});
+`
+	err := worker.Load("code.js", code)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// Lines with a multi-byte character are split at odd offsets so chunks
+	// end in the middle of UTF-8 sequences.
+	stream := worker.NewStream(64)
+	go func() {
+		data := []byte(strings.Repeat("é line\n", 1000) + "last")
+		for len(data) > 0 {
+			n := 7
+			if n > len(data) {
+				n = len(data)
+			}
+			if _, err := stream.Write(data[:n]); err != nil {
+				t.Error(err)
+			}
+			data = data[n:]
+		}
+		stream.Close()
+	}()
+	if err := worker.SendStream(stream); err != nil {
+		t.Fatal(err)
+	}
+
+	// The script stops reading early; the writer must be released.
+	stream = worker.NewStream(256)
+	done := make(chan error)
+	go func() {
+		chunk := make([]byte, 128)
+		for {
+			if _, err := stream.Write(chunk); err != nil {
+				done <- err
+				return
+			}
+		}
+	}()
+	if err := worker.SendStream(stream); err != nil {
+		t.Fatal(err)
+	}
+	if err := <-done; err == nil {
+		t.Fatal("Expected error writing to an abandoned stream")
+	}
+
+	want := []string{"lines:1000:last", "bytes:1024"}
+	if strings.Join(caught, "|") != strings.Join(want, "|") {
+		t.Fatalf("got %q want %q", caught, want)
+	}
+
+	// A stream outlives its worker: writes fail once it is disposed, and
+	// the chunks queued before are not freed twice.
+	stream = worker.NewStream(256)
+	go func() {
+		chunk := make([]byte, 128)
+		for {
+			if _, err := stream.Write(chunk); err != nil {
+				done <- err
+				return
+			}
+		}
+	}()
+	worker.Dispose()
+	if err := <-done; err == nil {
+		t.Fatal("Expected error writing to the stream of a disposed worker")
+	}
+	stream = nil
+	runtime.GC()
+}
+
+type proxyAddress struct {
+	City string `json:"city"`
+}
+
+type proxyBase struct {
+	ID int `json:"id"`
+}
+
+type proxyUser struct {
+	proxyBase
+	Name    string            `json:"name"`
+	Admin   bool              `json:"admin"`
+	Address *proxyAddress     `json:"address"`
+	Manager *proxyUser        `json:"manager"`
+	Tags    []string          `json:"tags"`
+	Labels  map[string]string `json:"labels"`
+	Secret  string            `json:"-"`
+	hidden  int
+}
+
+func TestSendProxy(t *testing.T) {
+	var caught []string
+	worker := New(func(msg string) {
+		caught = append(caught, msg)
+	}, DiscardSendSync)
+	code := `
+	$recv(function(user) {
+		$send([
+			user.id, user.name, user.admin, user.address.city, user.manager,
+			user.tags.length, user.tags.map(function(t) { return t.toUpperCase(); }).join(","),
+			user.labels.team, typeof user.Secret, typeof user.nope,
+			Object.keys(user).join(","), JSON.stringify(user.address)
+		].join("|"));
+	});
+`
+	if err := worker.Load("code.js", code); err != nil {
+		t.Fatal(err)
+	}
+
+	user := &proxyUser{
+		proxyBase: proxyBase{ID: 7},
+		Name:      "ann",
+		Admin:     true,
+		Address:   &proxyAddress{City: "Oslo"},
+		Tags:      []string{"a", "b"},
+		Labels:    map[string]string{"team": "core"},
+		Secret:    "s",
+	}
+	proxy := worker.NewProxy(user)
+	if err := worker.SendProxy(proxy); err != nil {
+		t.Fatal(err)
+	}
+	proxy.Release()
+	if err := worker.SendProxy(proxy); err == nil {
+		t.Fatal("Expected error sending a released proxy")
+	}
+
+	want := "7|ann|true|Oslo||2|A,B|core|undefined|undefined|" +
+		"name,admin,address,manager,tags,labels,id|{\"city\":\"Oslo\"}"
+	if len(caught) != 1 || caught[0] != want {
+		t.Fatalf("got %q want %q", caught, want)
+	}
+}
+
+func TestSendValue(t *testing.T) {
+	var caught []string
+	worker := New(func(msg string) {
+		caught = append(caught, msg)
+	}, DiscardSendSync)
+	code := `
+	$recv(function(v) {
+		$send(JSON.stringify(v));
+	});
+	$recvSync(function(v) {
+		return {
+			name: v.name.toUpperCase(),
+			admin: !v.admin,
+			address: {city: v.address.city + "!"},
+			tags: v.tags.concat(["c"]),
+			labels: {team: v.labels.team, size: "3"},
+			unknown: [1, 2, 3]
+		};
+	});
+`
+	if err := worker.Load("code.js", code); err != nil {
+		t.Fatal(err)
+	}
+
+	user := &proxyUser{
+		proxyBase: proxyBase{ID: 7},
+		Name:      "ann",
+		Admin:     true,
+		Address:   &proxyAddress{City: "Oslo"},
+		Tags:      []string{"a", "b"},
+		Labels:    map[string]string{"team": "core"},
+		Secret:    "s",
+	}
+	// Twice, the second time with the field names already interned.
+	for i := 0; i < 2; i++ {
+		if err := worker.SendValue(user); err != nil {
+			t.Fatal(err)
+		}
+	}
+	want := `{"name":"ann","admin":true,"address":{"city":"Oslo"},"manager":null,` +
+		`"tags":["a","b"],"labels":{"team":"core"},"id":7}`
+	if len(caught) != 2 || caught[0] != want || caught[1] != want {
+		t.Fatalf("got %q want %q", caught, want)
+	}
+
+	var result proxyUser
+	if err := worker.SendSyncValue(user, &result); err != nil {
+		t.Fatal(err)
+	}
+	if result.Name != "ANN" || result.Admin || result.Address == nil ||
+		result.Address.City != "Oslo!" || strings.Join(result.Tags, ",") != "a,b,c" ||
+		result.Labels["team"] != "core" || result.Labels["size"] != "3" {
+		t.Fatalf("unexpected result %+v", result)
+	}
+
+	var generic map[string]interface{}
+	if err := worker.SendSyncValue(user, &generic); err != nil {
+		t.Fatal(err)
+	}
+	if unknown, ok := generic["unknown"].([]interface{}); !ok || len(unknown) != 3 || unknown[2] != float64(3) {
+		t.Fatalf("unexpected result %v", generic)
+	}
+
+	if err := worker.SendValue(make(chan int)); err == nil {
+		t.Fatal("Expected error sending a channel")
+	}
+}
+
+func TestSendRecordBatch(t *testing.T) {
+	var caught []string
+	worker := New(func(msg string) {
+		caught = append(caught, msg)
+	}, DiscardSendSync)
+	code := `
+	$recv(function(batch) {
+		var price = batch.columns.price, qty = batch.columns.qty;
+		var city = batch.columns.city, cities = batch.dictionaries.city;
+		var total = 0, oslo = 0;
+		for (var i = 0; i < batch.length; i++) {
+			total += price[i] * qty[i];
+			if (cities[city[i]] === "Oslo") oslo++;
+		}
+		$send([batch.length, price instanceof Float64Array, qty instanceof Int32Array,
+			batch.columns.id[batch.length - 1], total, oslo, cities.join(",")].join("|"));
+	});
+`
+	if err := worker.Load("code.js", code); err != nil {
+		t.Fatal(err)
+	}
+
+	n := 10000
+	ids := make([]int64, n)
+	prices := make([]float64, n)
+	qtys := make([]int32, n)
+	cities := make([]string, n)
+	for i := 0; i < n; i++ {
+		ids[i] = int64(i) + 1<<40
+		prices[i] = 0.5
+		qtys[i] = int32(i % 4)
+		cities[i] = []string{"Oslo", "Bergen", "Oslo", "Tromsø"}[i%4]
+	}
+	batch := NewRecordBatch(n)
+	batch.AddInt64("id", ids)
+	batch.AddFloat64("price", prices)
+	batch.AddInt32("qty", qtys)
+	batch.AddStrings("city", cities)
+	if err := worker.SendRecordBatch(batch); err != nil {
+		t.Fatal(err)
+	}
+
+	want := "10000|true|true|" + strconv.Itoa(n-1+1<<40) + "|7500|5000|Oslo,Bergen,Tromsø"
+	if len(caught) != 1 || caught[0] != want {
+		t.Fatalf("got %q want %q", caught, want)
+	}
+}
+
+func TestWorkerGroup(t *testing.T) {
+	var mu sync.Mutex
+	counts := make(map[string]string)
+	factory := func(shard int) (*Worker, error) {
+		w := New(func(msg string) {
+			parts := strings.SplitN(msg, "=", 2)
+			mu.Lock()
+			counts[parts[0]] = strconv.Itoa(shard) + ":" + parts[1]
+			mu.Unlock()
+		}, DiscardSendSync)
+		err := w.Load("group.js", `
+			var seen = {};
+			$recv(function(key) {
+				seen[key] = (seen[key] || 0) + 1;
+				$send(key + "=" + seen[key]);
+			});
+		`)
+		return w, err
+	}
+
+	group, err := NewWorkerGroup(4, factory)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer group.Close()
+
+	keys := make([]string, 200)
+	for i := range keys {
+		keys[i] = "key" + strconv.Itoa(i)
+	}
+	for round := 0; round < 3; round++ {
+		for _, key := range keys {
+			if err := group.Send(key, key); err != nil {
+				t.Fatal(err)
+			}
+		}
+	}
+	// Every key has always been routed to the same worker.
+	for _, key := range keys {
+		want := strconv.Itoa(group.ShardFor(key)) + ":3"
+		if counts[key] != want {
+			t.Fatalf("key %s: got %s want %s", key, counts[key], want)
+		}
+	}
+
+	owners := make(map[string]int)
+	for _, key := range keys {
+		owners[key] = group.ShardFor(key)
+	}
+	if err := group.Recycle(owners[keys[0]]); err != nil {
+		t.Fatal(err)
+	}
+	if err := group.Resize(5); err != nil {
+		t.Fatal(err)
+	}
+	moved := 0
+	for _, key := range keys {
+		if s := group.ShardFor(key); s != owners[key] {
+			if s != 4 {
+				t.Fatalf("key %s moved between existing shards", key)
+			}
+			moved++
+		}
+	}
+	if moved == 0 || moved > len(keys)/2 {
+		t.Fatal("bad number of moved keys", moved)
+	}
+
+	if err := group.Resize(4); err != nil {
+		t.Fatal(err)
+	}
+	for _, key := range keys {
+		if group.ShardFor(key) != owners[key] {
+			t.Fatalf("key %s did not move back", key)
+		}
+	}
+
+	// Messages keep flowing while Resize builds the new workers.
+	building := make(chan struct{})
+	release := make(chan struct{})
+	slow, err := NewWorkerGroup(1, func(shard int) (*Worker, error) {
+		if shard > 0 {
+			close(building)
+			<-release
+		}
+		return factory(shard)
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer slow.Close()
+	resized := make(chan error)
+	go func() { resized <- slow.Resize(2) }()
+	<-building
+	if err := slow.Send("key", "key"); err != nil {
+		t.Fatal(err)
+	}
+	close(release)
+	if err := <-resized; err != nil {
+		t.Fatal(err)
+	}
+	if slow.Size() != 2 {
+		t.Fatal("bad size", slow.Size())
+	}
+}
+
+func TestWorkerGroupReload(t *testing.T) {
+	factory := func(version string) WorkerFactory {
+		return func(shard int) (*Worker, error) {
+			w := New(func(msg string) {}, DiscardSendSync)
+			err := w.Load("reload.js", `$recvSync(function(msg) { return "`+version+`"; });`)
+			return w, err
+		}
+	}
+	group, err := NewWorkerGroup(2, factory("v1"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer group.Close()
+
+	// Messages keep being answered while the group reloads.
+	stop := make(chan struct{})
+	answered := make(chan []string)
+	go func() {
+		var got []string
+		for i := 0; ; i++ {
+			select {
+			case <-stop:
+				answered <- got
+				return
+			default:
+			}
+			got = append(got, group.SendSync("key"+strconv.Itoa(i), ""))
+		}
+	}()
+	stats, err := group.Reload(factory("v2"))
+	close(stop)
+	got := <-answered
+	if err != nil {
+		t.Fatal(err)
+	}
+	if stats.Generation != 2 || group.Generation() != 2 {
+		t.Fatalf("unexpected generation %+v", stats)
+	}
+	// No message is answered by the old workers after the new ones.
+	for i := 1; i < len(got); i++ {
+		if got[i] != "v1" && got[i] != "v2" || got[i-1] == "v2" && got[i] == "v1" {
+			t.Fatalf("unexpected answers %v", got)
+		}
+	}
+	for i := 0; i < 10; i++ {
+		if res := group.SendSync("key"+strconv.Itoa(i), ""); res != "v2" {
+			t.Fatalf("got %q want v2", res)
+		}
+	}
+
+	if _, err := group.Reload(func(shard int) (*Worker, error) {
+		return nil, errors.New("broken bundle")
+	}); err == nil {
+		t.Fatal("expected an error")
+	}
+	if res := group.SendSync("key", ""); res != "v2" || group.Generation() != 2 {
+		t.Fatalf("failed reload replaced workers: got %q", res)
+	}
+}
+
+func TestWorkerGroupPriority(t *testing.T) {
+	group, err := NewWorkerGroup(1, func(shard int) (*Worker, error) {
+		w := New(func(msg string) {}, DiscardSendSync)
+		return w, w.Load("priority.js", `$recvSync(function(msg) { return "pong"; });`)
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer group.Close()
+	s := group.current().shards[0]
+
+	// Holds the shard busy while the other jobs queue up.
+	started := make(chan struct{})
+	release := make(chan struct{})
+	s.enqueue(PriorityNormal, func() {
+		close(started)
+		<-release
+	})
+	<-started
+	var order []string
+	queue := func(p Priority, name string) <-chan struct{} {
+		return s.enqueue(p, func() { order = append(order, name) })
+	}
+	queue(PriorityLow, "low")
+	queue(PriorityNormal, "normal")
+	for i := 0; i < 2*starvationLimit; i++ {
+		queue(PriorityHigh, "high"+strconv.Itoa(i))
+	}
+	barrier := s.barrier(func() { order = append(order, "barrier") })
+	done := queue(PriorityHigh, "after")
+	close(release)
+	<-done
+	<-barrier
+
+	// Each waiting lane gets its turn after starvationLimit jobs of higher
+	// ones, and nothing passes the barrier.
+	want := []string{}
+	for i := 0; i < starvationLimit; i++ {
+		want = append(want, "high"+strconv.Itoa(i))
+	}
+	want = append(want, "normal", "low")
+	for i := starvationLimit; i < 2*starvationLimit; i++ {
+		want = append(want, "high"+strconv.Itoa(i))
+	}
+	want = append(want, "barrier", "after")
+	if !reflect.DeepEqual(order, want) {
+		t.Fatalf("got %v want %v", order, want)
+	}
+
+	// Once shardQueueCapacity jobs wait, the next caller blocks until the
+	// shard takes one.
+	started = make(chan struct{})
+	release = make(chan struct{})
+	s.enqueue(PriorityNormal, func() {
+		close(started)
+		<-release
+	})
+	<-started
+	for i := 0; i < shardQueueCapacity; i++ {
+		queue(PriorityLow, "fill")
+	}
+	queued := make(chan struct{})
+	go func() {
+		<-queue(PriorityHigh, "over")
+		close(queued)
+	}()
+	select {
+	case <-queued:
+		t.Fatal("queued past the shard's capacity")
+	case <-time.After(50 * time.Millisecond):
+	}
+	close(release)
+	<-queued
+
+	if res := group.SendSyncWithPriority("key", "ping", PriorityHigh); res != "pong" {
+		t.Fatalf("unexpected result %q", res)
+	}
+}
+
+// Compares a script scanning a large array buffer on the NUMA node its
+// worker was created on with the same scan from another node. On machines
+// with a single node only the local variant runs.
+func benchmarkNUMAPlacement(b *testing.B, remote bool) {
+	nodes := nodeCPUs()
+	if remote && len(nodes) < 2 {
+		b.Skip("needs at least two NUMA nodes")
+	}
+
+	const size = 64 << 20
+	done := make(chan struct{})
+	go func() {
+		// Locked and never unlocked: the pinned thread exits with the
+		// goroutine.
+		runtime.LockOSThread()
+		defer close(done)
+
+		pinThread(nodes[0][0])
+		worker := New(func(msg string) {}, DiscardSendSync)
+		err := worker.Load("scan.js", `
+			var buf = new Float64Array(`+strconv.Itoa(size/8)+`);
+			$recv(function(msg) {
+				var sum = 0;
+				for (var i = 0; i < buf.length; i++) sum += buf[i];
+				buf[0] = sum;
+			});
+		`)
+		if err != nil {
+			b.Error(err)
+			return
+		}
+		if remote {
+			pinThread(nodes[len(nodes)-1][0])
+		}
+
+		b.SetBytes(size)
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			if err := worker.Send("scan"); err != nil {
+				b.Error(err)
+				return
+			}
+		}
+	}()
+	<-done
+}
+
+func BenchmarkNUMALocal(b *testing.B)  { benchmarkNUMAPlacement(b, false) }
+func BenchmarkNUMARemote(b *testing.B) { benchmarkNUMAPlacement(b, true) }
+
+func TestHugePages(t *testing.T) {
+	for _, mode := range []HugePageMode{HugePagesOff, HugePagesTransparent, HugePagesExplicit} {
+		worker := NewWithOptions(func(msg string) {}, DiscardSendSync, &Options{HugePages: mode})
+		err := worker.Load("huge.js", `
+			var buffers = [];
+			for (var i = 0; i < 4; i++) {
+				var buf = new Uint8Array(3 << 20);
+				buf[buf.length - 1] = i;
+				buffers.push(buf);
+			}
+			var small = new Uint8Array(1024);
+		`)
+		if err != nil {
+			t.Fatal(err)
+		}
+		hs := worker.GetHugePageStatistics()
+		t.Logf("huge pages %v %+v", mode, *hs)
+		huge := hs.ExplicitBytes + hs.TransparentBytes
+		if mode == HugePagesOff && huge != 0 {
+			t.Fatal("huge pages used while off", huge)
+		}
+		// Buffers are rounded up to whole 2 MB pages.
+		if mode != HugePagesOff && huge != 4*(4<<20) {
+			t.Fatal("bad huge page bytes", huge)
+		}
+
+		worker.Dispose()
+		hs = worker.GetHugePageStatistics()
+		if hs.ExplicitBytes+hs.TransparentBytes != 0 {
+			t.Fatalf("disposed worker reports %+v", *hs)
+		}
+	}
+}
+
+func TestCodeCache(t *testing.T) {
+	dir, err := ioutil.TempDir("", "v8worker")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	code := `
+		function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+		$recv(function(msg) { $send(String(fib(Number(msg)))); });
+	`
+	run := func(cache *CodeCache) {
+		var recvMsg string
+		worker := NewWithOptions(func(msg string) { recvMsg = msg }, DiscardSendSync, &Options{CodeCache: cache})
+		defer worker.Dispose()
+		if err := worker.Load("fib.js", code); err != nil {
+			t.Error(err)
+			return
+		}
+		worker.Send("10")
+		if recvMsg != "55" {
+			t.Errorf("got %q want 55", recvMsg)
+		}
+	}
+
+	cache, err := NewCodeCache(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	run(cache)
+	run(cache)
+	if stats := cache.Stats(); stats.Hits != 1 || stats.Misses != 1 {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+
+	// A new cache, as after a restart, finds the compiled script on disk.
+	files, _ := filepath.Glob(filepath.Join(dir, "*.v8cache"))
+	if len(files) != 1 {
+		t.Fatalf("expected one cache file, got %v", files)
+	}
+	cache, err = NewCodeCache(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	run(cache)
+	if stats := cache.Stats(); stats.Hits != 1 || stats.Misses != 0 {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+
+	// Workers loading a new script at once compile it once.
+	code += "\n// v2"
+	cache, err = NewCodeCache("")
+	if err != nil {
+		t.Fatal(err)
+	}
+	var wg sync.WaitGroup
+	for i := 0; i < 4; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			run(cache)
+		}()
+	}
+	wg.Wait()
+	if stats := cache.Stats(); stats.Hits != 3 || stats.Misses != 1 {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+
+	// A code cache V8 rejects is dropped and replaced by the next load.
+	code += "\n// v3"
+	path := filepath.Join(dir, codeCacheKey(code)+".v8cache")
+	if err := ioutil.WriteFile(path, []byte("not a code cache"), 0600); err != nil {
+		t.Fatal(err)
+	}
+	cache, err = NewCodeCache(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	run(cache)
+	run(cache)
+	run(cache)
+	if stats := cache.Stats(); stats.Hits != 1 || stats.Misses != 2 || stats.Rejected != 1 {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+
+	// Rejecting a stale code cache keeps the one another worker wrote since.
+	if err := ioutil.WriteFile(path, []byte("fresh code cache"), 0600); err != nil {
+		t.Fatal(err)
+	}
+	cache.reject(codeCacheKey(code), []byte("not a code cache"))
+	if _, err := os.Stat(path); err != nil {
+		t.Fatal("fresh code cache removed:", err)
+	}
+}
+
+func TestCodecs(t *testing.T) {
+	var recvMsg string
+	worker := NewWithOptions(func(msg string) { recvMsg = msg }, DiscardSendSync, &Options{Codecs: true})
+	defer worker.Dispose()
+	err := worker.Load("codecs.js", `
+		var bytes = new TextEncoder().encode("héllo wörld, héllo wörld");
+		var results = [
+			bytes.length,
+			new TextDecoder().decode(bytes.subarray(7)),
+			btoa("hello"),
+			atob(" aGVs\nbG8= "),
+			$base64.encode(bytes.buffer),
+			new TextDecoder().decode($base64.decode($base64.encode(bytes))),
+			$hex.encode(new Uint8Array([0, 15, 16, 255])),
+			$hex.decode("00ff").length,
+		];
+		try { atob("a"); } catch (e) { results.push("atob threw"); }
+		try { btoa("Ā"); } catch (e) { results.push("btoa threw"); }
+		$send(JSON.stringify(results));
+	`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	want := `[28,"wörld, héllo wörld","aGVsbG8=","hello","aMOpbGxvIHfDtnJsZCwgaMOpbGxvIHfDtnJsZA==","héllo wörld, héllo wörld","000f10ff",2,"atob threw","btoa threw"]`
+	if recvMsg != want {
+		t.Fatalf("got %s want %s", recvMsg, want)
+	}
+}
+
+func TestHash(t *testing.T) {
+	var recvMsg string
+	worker := New(func(msg string) { recvMsg = msg }, DiscardSendSync)
+	defer worker.Dispose()
+	err := worker.Load("hash.js", `
+		var bytes = new Uint8Array([0, 104, 101, 108, 108, 111, 32, 119, 111, 114, 108, 100]);
+		$send(JSON.stringify([
+			$hash.xxh64("hello world"),
+			$hash.xxh64(bytes.subarray(1), 42),
+			$hash.xxh3(bytes.buffer.slice(1)),
+			$hash.xxh3(new Uint8Array([0, 1, 2])),
+			$hash.sha256("hello world"),
+			$hash.crc32c("hello world"),
+			$hash.crc32c(" world", $hash.crc32c("hello")),
+		]));
+	`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	want := `["45ab6734b21e6968","69c2b68f9d9352a1","d447b1ea40e6988b","5f4299fc161c9cbb",` +
+		`"b94d27b9934d3e08a52e52d7da7dabfac484efe37a5380ee9088f7ace2efcde9",3381945770,3381945770]`
+	if recvMsg != want {
+		t.Fatalf("got %s want %s", recvMsg, want)
+	}
+}
+
+func TestReadFile(t *testing.T) {
+	dir, err := ioutil.TempDir("", "v8worker")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	if err := ioutil.WriteFile(filepath.Join(dir, "a.txt"), []byte("hello world"), 0600); err != nil {
+		t.Fatal(err)
+	}
+
+	msgs := make(chan string, 5)
+	worker := NewWithOptions(func(msg string) { msgs <- msg }, DiscardSendSync, &Options{FileRoot: dir})
+	defer worker.Dispose()
+	err = worker.Load("readfile.js", `
+		function text(buffer) {
+			return String.fromCharCode.apply(null, new Uint8Array(buffer));
+		}
+		$readFile("a.txt").then(function(b) { $send("all " + text(b)); });
+		$readFile("a.txt", {offset: 6, length: 3}).then(function(b) { $send("part " + text(b)); });
+		$readFile("../a.txt").catch(function(e) { $send("outside " + e.message); });
+		$readFile("../missing.txt").catch(function(e) { $send("outside " + e.message); });
+		$readFile("missing.txt").catch(function(e) { $send("inside " + e.message); });
+	`)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// Callbacks only run on the goroutine settling the reads.
+	got := make(map[string]bool)
+	for len(got) < 5 {
+		select {
+		case <-worker.ReadsReady():
+			worker.SettleReads()
+		case msg := <-msgs:
+			got[msg] = true
+		case <-time.After(5 * time.Second):
+			t.Fatalf("timed out, got %v", got)
+		}
+	}
+	for _, want := range []string{
+		"all hello world",
+		"part wor",
+		"outside ../a.txt: Permission denied",
+		"outside ../missing.txt: Permission denied",
+		"inside missing.txt: No such file or directory",
+	} {
+		if !got[want] {
+			t.Fatalf("missing %q in %v", want, got)
+		}
+	}
+}
+
+func TestSyncCache(t *testing.T) {
+	var calls int32
+	release := make(chan struct{})
+	lookup := func(msg string) string {
+		atomic.AddInt32(&calls, 1)
+		<-release
+		return msg + " value"
+	}
+	cache := NewSyncCache(time.Minute, 10)
+
+	const n = 4
+	var wg sync.WaitGroup
+	results := make(chan string, n)
+	for i := 0; i < n; i++ {
+		worker := NewWithOptions(func(msg string) { results <- msg }, lookup, &Options{SyncCache: cache})
+		defer worker.Dispose()
+		if err := worker.Load("lookup.js", `$recv(function(msg) { $send($sendSync(msg)); });`); err != nil {
+			t.Fatal(err)
+		}
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			worker.Send("config")
+		}()
+	}
+	// Let every worker reach the cache before the first lookup returns.
+	for cache.Stats().Misses+cache.Stats().Coalesced < n {
+		time.Sleep(time.Millisecond)
+	}
+	close(release)
+	wg.Wait()
+
+	for i := 0; i < n; i++ {
+		if msg := <-results; msg != "config value" {
+			t.Fatalf("got %q", msg)
+		}
+	}
+	if calls != 1 {
+		t.Fatalf("callback called %d times", calls)
+	}
+	if stats := cache.Stats(); stats.Misses != 1 || stats.Coalesced != n-1 || stats.Entries != 1 {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+	if got := cache.wrap(lookup)("config"); got != "config value" || cache.Stats().Hits != 1 {
+		t.Fatalf("got %q, stats %+v", got, cache.Stats())
+	}
+
+	// A full cache drops the least recently used response.
+	cache = NewSyncCache(time.Minute, 2)
+	call := cache.wrap(lookup)
+	call("a")
+	call("b")
+	call("a")
+	call("c")
+	calls = 0
+	call("a")
+	call("b")
+	if calls != 1 {
+		t.Fatalf("expected only b to be dropped, %d calls", calls)
+	}
+
+	// Expired responses are dropped without a limit too.
+	cache = NewSyncCache(time.Millisecond, 0)
+	call = cache.wrap(lookup)
+	call("a")
+	call("b")
+	time.Sleep(2 * time.Millisecond)
+	call("c")
+	if n := cache.Stats().Entries; n != 1 {
+		t.Fatalf("expected expired responses to be dropped, %d left", n)
+	}
+}
+
+func TestMemoize(t *testing.T) {
+	code := `
+		var calls = 0;
+		$recv(function(msg) {
+			if (msg == "calls") {
+				$send(String(calls));
+				return;
+			}
+			calls++;
+			$send(msg.toUpperCase());
+			$send(msg + "!");
+		});
+	`
+	var received []string
+	newWorker := func() *Worker {
+		worker := NewWithOptions(func(msg string) { received = append(received, msg) }, DiscardSendSync, &Options{Memoize: true})
+		if err := worker.Load("memo.js", code); err != nil {
+			t.Fatal(err)
+		}
+		return worker
+	}
+	worker1 := newWorker()
+	defer worker1.Dispose()
+	worker2 := newWorker()
+	defer worker2.Dispose()
+
+	before := MemoCacheStatistics()
+	worker1.Send("abc")
+	worker2.Send("abc")
+	worker2.Send("calls")
+	if want := []string{"ABC", "abc!", "ABC", "abc!", "0"}; !reflect.DeepEqual(received, want) {
+		t.Fatalf("got %v want %v", received, want)
+	}
+	after := MemoCacheStatistics()
+	if after.Hits-before.Hits != 1 || after.Misses-before.Misses != 2 {
+		t.Fatalf("unexpected statistics %+v, before %+v", after, before)
+	}
+
+	// Calls reading files depend on more than their message.
+	reader := NewWithOptions(func(msg string) {}, DiscardSendSync, &Options{Memoize: true, FileRoot: os.TempDir()})
+	defer reader.Dispose()
+	if err := reader.Load("memo-read.js", `$recv(function(msg) { $readFile(msg); });`); err != nil {
+		t.Fatal(err)
+	}
+	before = MemoCacheStatistics()
+	reader.Send("missing.txt")
+	reader.Send("missing.txt")
+	if after := MemoCacheStatistics(); after.Hits != before.Hits || after.Entries != before.Entries {
+		t.Fatalf("impure call memoized: %+v, before %+v", after, before)
+	}
+}
+
+func TestCache(t *testing.T) {
+	cache := NewCache(1 << 20)
+	var recvMsg string
+	newWorker := func() *Worker {
+		worker := NewWithOptions(func(msg string) { recvMsg = msg }, DiscardSendSync, &Options{Cache: cache})
+		if err := worker.Load("cache.js", `$recv(function(code) { $send(String(eval(code))); });`); err != nil {
+			t.Fatal(err)
+		}
+		return worker
+	}
+	eval := func(w *Worker, code, want string) {
+		if err := w.Send(code); err != nil {
+			t.Fatal(err)
+		}
+		if recvMsg != want {
+			t.Fatalf("%s: got %q want %q", code, recvMsg, want)
+		}
+	}
+
+	worker1 := newWorker()
+	eval(worker1, `$cache.set("greeting", "héllo")`, "true")
+	eval(worker1, `$cache.set("long", new Array(1001).join("x"))`, "true")
+	eval(worker1, `$cache.set("bytes", new Uint8Array([1, 2, 3]).subarray(1))`, "true")
+	eval(worker1, `$cache.set("huge", new ArrayBuffer(2 << 20))`, "false")
+	worker1.Dispose()
+
+	// The entries outlive the worker that stored them.
+	worker2 := newWorker()
+	defer worker2.Dispose()
+	eval(worker2, `$cache.get("greeting")`, "héllo")
+	eval(worker2, `$cache.get("long").length`, "1000")
+	eval(worker2, `Array.prototype.join.call(new Uint8Array($cache.get("bytes")))`, "2,3")
+	eval(worker2, `$cache.get("missing")`, "undefined")
+	eval(worker2, `$cache.delete("greeting") + " " + $cache.has("greeting")`, "true false")
+
+	if stats := cache.Stats(); stats.Entries != 2 || stats.Hits != 3 || stats.Misses != 1 {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+
+	// Memoized calls must not replay stale reads of the cache.
+	memoized := NewWithOptions(func(msg string) { recvMsg = msg }, DiscardSendSync, &Options{Cache: cache, Memoize: true})
+	defer memoized.Dispose()
+	if err := memoized.Load("cache-memo.js", `$recv(function(code) { $send(String(eval(code))); });`); err != nil {
+		t.Fatal(err)
+	}
+	eval(memoized, `$cache.get("long").length`, "1000")
+	eval(worker2, `$cache.set("long", "x")`, "true")
+	eval(memoized, `$cache.get("long").length`, "1")
+}
+
+func TestInternedSources(t *testing.T) {
+	code := "var interned = " + strconv.Quote(strings.Repeat("interned source ", 256)) + ";"
+	sources, bytes := InternedSourceStatistics()
+	for i := 0; i < 3; i++ {
+		worker := New(func(msg string) {}, DiscardSendSync)
+		defer worker.Dispose()
+		if err := worker.Load("interned.js", code); err != nil {
+			t.Fatal(err)
+		}
+	}
+	s, b := InternedSourceStatistics()
+	if s-sources != 1 || b-bytes != len(code) {
+		t.Fatalf("got %d sources of %d bytes, before %d of %d", s, b, sources, bytes)
+	}
+}
+
+func TestCPUScheduler(t *testing.T) {
+	worker := New(func(msg string) {}, DiscardSendSync)
+	defer worker.Dispose()
+	err := worker.Load("busy.js", `
+		$recv(function(msg) {
+			var end = Date.now() + Number(msg);
+			while (Date.now() < end) {}
+		});
+	`)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	s := NewCPUScheduler(&CPUSchedulerOptions{Period: 200 * time.Millisecond})
+	tenant := s.Tenant("busy", &TenantOptions{Quota: time.Millisecond})
+	send := func(w *Worker) {
+		if err := w.Send("10"); err != nil {
+			t.Fatal(err)
+		}
+	}
+	before := worker.CPUTime()
+	tenant.Run(worker, send)
+	if used := worker.CPUTime() - before; used < 5*time.Millisecond {
+		t.Fatalf("worker used %v", used)
+	}
+	if stats := tenant.Stats(); stats.ThrottledRuns != 0 || stats.CPUTime < 5*time.Millisecond {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+	// Over its quota, the tenant waits for the next period.
+	tenant.Run(worker, send)
+	if stats := tenant.Stats(); stats.ThrottledRuns != 1 || stats.Throttled <= 0 {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+
+	s.Remove(tenant)
+	tenant.Run(worker, send)
+	if stats := tenant.Stats(); stats.ThrottledRuns != 1 {
+		t.Fatalf("removed tenant throttled: %+v", stats)
+	}
+
+	// Disposing the worker from fn charges nothing more.
+	charged := tenant.Stats().CPUTime
+	tenant.Run(worker, func(w *Worker) { w.Dispose() })
+	if worker.CPUTime() != 0 || tenant.Stats().CPUTime != charged {
+		t.Fatalf("disposed worker charged %v", tenant.Stats().CPUTime-charged)
+	}
+}
+
+func TestBatcher(t *testing.T) {
+	var received []string
+	worker := New(func(msg string) { received = append(received, msg) }, DiscardSendSync)
+	defer worker.Dispose()
+	err := worker.Load("batcher.js", `
+		var count = 0;
+		$recv(function(msg) {
+			if (msg == "throw") throw new Error("bad message");
+			if (msg == "count") $send(String(count));
+			count++;
+		});
+	`)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	sent, err := worker.SendMessages([]string{"a", "throw", "b"})
+	if sent != 1 || err == nil {
+		t.Fatalf("got %d, %v", sent, err)
+	}
+
+	var failed []string
+	b := NewBatcher(worker, &BatcherOptions{
+		TargetP99: 50 * time.Millisecond,
+		OnError:   func(msg string, err error) { failed = append(failed, msg) },
+	})
+	for i := 0; i < 2000; i++ {
+		msg := strconv.Itoa(i)
+		if i == 1000 {
+			msg = "throw"
+		}
+		b.Send(msg)
+	}
+	b.Send("count")
+	b.Close()
+	if b.Send("late") {
+		t.Fatal("closed batcher accepted a message")
+	}
+
+	if want := []string{"2000"}; !reflect.DeepEqual(received, want) || !reflect.DeepEqual(failed, []string{"throw"}) {
+		t.Fatalf("got %v and errors for %v", received, failed)
+	}
+	stats := b.Stats()
+	if stats.Messages != 2001 || stats.Batches > stats.Messages || stats.BatchSize < 1 || stats.QueueDepth != 0 {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+
+	// Send blocks while MaxQueue messages wait.
+	blocked := make(chan struct{})
+	release := make(chan struct{})
+	b = NewBatcher(worker, &BatcherOptions{
+		MaxBatch: 1,
+		MaxQueue: 4,
+		OnError: func(msg string, err error) {
+			close(blocked)
+			<-release
+		},
+	})
+	b.Send("throw")
+	<-blocked
+	for i := 0; i < 4; i++ {
+		b.Send("queued")
+	}
+	queued := make(chan struct{})
+	go func() {
+		b.Send("over")
+		close(queued)
+	}()
+	select {
+	case <-queued:
+		t.Fatal("queued past MaxQueue")
+	case <-time.After(50 * time.Millisecond):
+	}
+	close(release)
+	<-queued
+	b.Close()
+}
+
+func TestHibernate(t *testing.T) {
+	dir, err := ioutil.TempDir("", "v8worker")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	var recvMsg string
+	worker := NewWithOptions(func(msg string) { recvMsg = msg }, DiscardSendSync, &Options{Hibernatable: true})
+	err = worker.Load("counter.js", `
+		var count = 0;
+		$hibernation(function() {
+			return { count: count };
+		}, function(state) {
+			count = state.count;
+		});
+		$recv(function(msg) {
+			count++;
+			$send(msg + count);
+		});
+	`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	worker.Send("a")
+	worker.Send("b")
+
+	path := filepath.Join(dir, "counter.hib")
+	if err := worker.Hibernate(path); err != nil {
+		t.Fatal(err)
+	}
+	if !worker.Hibernated() {
+		t.Fatal("worker not hibernated")
+	}
+	if err := worker.Restore(); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := os.Stat(path); !os.IsNotExist(err) {
+		t.Fatal("hibernation file left behind")
+	}
+
+	worker.Send("c")
+	if recvMsg != "c3" {
+		t.Fatal("state not restored", recvMsg)
+	}
+
+	h := NewHibernator(dir, 1)
+	for _, key := range []string{"x", "y"} {
+		w := NewWithOptions(func(msg string) { recvMsg = msg }, DiscardSendSync, &Options{Hibernatable: true})
+		if err := w.Load("echo.js", `$recv(function(msg) { $send(msg); });`); err != nil {
+			t.Fatal(err)
+		}
+		h.Add(key, w)
+	}
+	if !h.Remove("x").Hibernated() {
+		t.Fatal("least recently used worker not hibernated")
+	}
+	err = h.Do("y", func(w *Worker) error { return w.Send("y") })
+	if err != nil || recvMsg != "y" {
+		t.Fatal("bad hibernator send", err, recvMsg)
+	}
+}
+
+// A bootstrap with much code to compile and some state to build, loaded
+// fresh or restored from hibernation. Restore skips the compilation but
+// runs the scripts again, so the difference is the compilation time only.
+func hibernationBenchmarkBootstrap() string {
+	var code bytes.Buffer
+	for i := 0; i < 2000; i++ {
+		fmt.Fprintf(&code, "function f%d(a, b) { var s = 0; for (var i = a; i < b; i++) s += i * %d; return s; }\n", i, i)
+	}
+	code.WriteString(`
+		var table = {};
+		for (var i = 0; i < 1e4; i++) table["k" + i] = i;
+		$hibernation(function() { return {}; }, function(state) {});
+		$recv(function(msg) { $send(String(table[msg])); });
+	`)
+	return code.String()
+}
+
+func BenchmarkLoad(b *testing.B) {
+	code := hibernationBenchmarkBootstrap()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		worker := New(func(msg string) {}, DiscardSendSync)
+		if err := worker.Load("bootstrap.js", code); err != nil {
+			b.Fatal(err)
+		}
+		worker.Dispose()
+	}
+}
+
+func BenchmarkRestore(b *testing.B) {
+	dir, err := ioutil.TempDir("", "v8worker")
+	if err != nil {
+		b.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	worker := NewWithOptions(func(msg string) {}, DiscardSendSync, &Options{Hibernatable: true})
+	defer worker.Dispose()
+	if err := worker.Load("bootstrap.js", hibernationBenchmarkBootstrap()); err != nil {
+		b.Fatal(err)
+	}
+	path := filepath.Join(dir, "bootstrap.hib")
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		b.StopTimer()
+		if err := worker.Hibernate(path); err != nil {
+			b.Fatal(err)
+		}
+		b.StartTimer()
+		if err := worker.Restore(); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func TestGovernor(t *testing.T) {
+	var usage int64
+	reported := make(map[*Worker]int)
+	g := NewGovernor(&GovernorOptions{
+		Interval:  time.Millisecond,
+		Usage:     func() (int64, int64) { return usage, 100 },
+		OverLimit: func(w *Worker) { reported[w]++ },
+	})
+
+	var workers []*Worker
+	for i := 0; i < 4; i++ {
+		worker := New(func(msg string) {}, DiscardSendSync)
+		err := worker.Load("garbage.js", `
+			var keep = [];
+			for (var i = 0; i < 1e5; i++) keep.push({ i: i });
+			$recv(function(msg) { keep = null; });
+		`)
+		if err != nil {
+			t.Fatal(err)
+		}
+		worker.Send("drop")
+		workers = append(workers, worker)
+		g.Add(worker)
+	}
+	time.Sleep(2 * time.Millisecond)
+
+	for _, c := range []struct {
+		usage int64
+		level PressureLevel
+	}{{10, PressureNone}, {75, PressureModerate}, {85, PressureHigh}, {95, PressureCritical}} {
+		usage = c.usage
+		if level := g.Check(); level != c.level {
+			t.Fatal("bad pressure level", c.usage, level)
+		}
+	}
+
+	// Pressure that lasts neither cuts the limit again before
+	// heapLimitCutInterval checks nor reports the same workers twice. A
+	// disposed worker is skipped.
+	workers[0].Dispose()
+	for i := 1; i < heapLimitCutInterval; i++ {
+		g.Check()
+	}
+	stats := g.Stats()
+	if stats.IdleNotifications == 0 || stats.LowMemoryNotices == 0 || stats.HeapLimitReductions != 1 {
+		t.Fatal("bad governor stats", stats)
+	}
+	for w, n := range reported {
+		if n != 1 {
+			t.Fatal("worker reported more than once", w, n)
+		}
+	}
+	limit := g.HeapLimitMB()
+	if limit < 16 {
+		t.Fatal("heap limit below minimum", limit)
+	}
+	opts := g.ApplyOptions(nil)
+	if opts.MaxHeapSizeMB != limit {
+		t.Fatal("heap limit not applied", opts.MaxHeapSizeMB)
+	}
+	worker := NewWithOptions(func(msg string) {}, DiscardSendSync, opts)
+	if err := worker.Load("small.js", `var x = 1;`); err != nil {
+		t.Fatal(err)
+	}
+
+	usage = 10
+	g.Check()
+	if g.HeapLimitMB() <= limit {
+		t.Fatal("heap limit not relaxed", g.HeapLimitMB())
+	}
+}
+
+func TestHost(t *testing.T) {
+	if _, err := exec.LookPath("v8worker-host"); err != nil {
+		t.Skip("v8worker-host not built, run make host")
+	}
+	host, err := StartHost(&HostOptions{RingSize: 4096})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer host.Close()
+
+	recv := make(chan string, 1)
+	worker, err := host.New(func(msg string) { recv <- msg }, func(msg string) string {
+		return "go:" + msg
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	err = worker.Load("host.js", `
+		$recv(function(msg) { $send($sendSync(msg).length + ""); });
+		$recvSync(function(msg) { return msg.toUpperCase(); });
+	`)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// Larger than the ring, so split on the way.
+	big := strings.Repeat("x", 10000)
+	if err := worker.Send(big); err != nil {
+		t.Fatal(err)
+	}
+	if msg := <-recv; msg != "10003" {
+		t.Fatal("bad message from host", msg)
+	}
+	if res := worker.SendSync("abc"); res != "ABC" {
+		t.Fatal("bad sync response from host", res)
+	}
+	if err := worker.Load("bad.js", `throw new Error("boom")`); err == nil || !strings.Contains(err.Error(), "boom") {
+		t.Fatal("expected exception from host", err)
+	}
+	origin := &ScriptOrigin{ScriptName: "options.js", LineOffset: 3, ColumnOffset: 2}
+	if err := worker.LoadWithOptions(origin, `throw new Error("Error")`); err == nil || !strings.Contains(err.Error(), "options.js:4:9") {
+		t.Fatal("script origin not passed to host", err)
+	}
+	stream := worker.NewStream(64)
+	if _, err := stream.Write([]byte("x")); err != errRemote {
+		t.Fatal("expected stream to fail in host", err)
+	}
+	if err := worker.SendStream(stream); err != errRemote {
+		t.Fatal("expected stream to fail in host", err)
+	}
+
+	if err := worker.Load("loop.js", `$recv(function(msg) { while (true) {} });`); err != nil {
+		t.Fatal(err)
+	}
+	go func() {
+		time.Sleep(100 * time.Millisecond)
+		worker.TerminateExecution()
+	}()
+	if err := worker.Send("spin"); err == nil {
+		t.Fatal("expected terminated script to fail")
+	}
+	if worker.GetHeapStatistics().UsedHeapSize == 0 {
+		t.Fatal("no heap statistics from host")
+	}
+	worker.Dispose()
+}
+
+func TestZygote(t *testing.T) {
+	if _, err := exec.LookPath("v8worker-host"); err != nil {
+		t.Skip("v8worker-host not built, run make host")
+	}
+	zygote, err := StartZygote(&ZygoteOptions{
+		ScriptName: "bootstrap.js",
+		Code: `
+			var table = [];
+			for (var i = 0; i < 1e5; i++) table.push(i * i);
+			var count = 0;
+			$recv(function(msg) {
+				if (msg == "random") return $send(String(Math.random()));
+				count++;
+				$send(msg + ":" + table[+msg] + ":" + count);
+			});
+		`,
+		Warmup: []string{"1", "2", "3"},
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer zygote.Close()
+
+	randoms := map[string]bool{}
+	for i := 0; i < 3; i++ {
+		recv := make(chan string, 1)
+		start := time.Now()
+		worker, err := zygote.Fork(func(msg string) { recv <- msg }, DiscardSendSync)
+		if err != nil {
+			t.Fatal(err)
+		}
+		t.Logf("fork took %v", time.Since(start))
+		if err := worker.Send("12"); err != nil {
+			t.Fatal(err)
+		}
+		// Each fork starts from the warmed template, which handled three
+		// messages.
+		if msg := <-recv; msg != "12:144:4" {
+			t.Fatal("bad message from forked worker", msg)
+		}
+		// But draws its own random numbers.
+		if err := worker.Send("random"); err != nil {
+			t.Fatal(err)
+		}
+		random := <-recv
+		if randoms[random] {
+			t.Fatal("forked workers share Math.random", random)
+		}
+		randoms[random] = true
+		worker.Dispose()
+	}
+}
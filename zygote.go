@@ -0,0 +1,116 @@
+package v8worker
+
+/*
+#include "ipc.h"
+*/
+import "C"
+import (
+	"errors"
+	"runtime"
+	"strconv"
+	"time"
+)
+
+// ZygoteOptions configures a Zygote.
+type ZygoteOptions struct {
+	HostOptions
+	// Options of the template worker, and so of every forked worker.
+	Options *Options
+	// The bootstrap script loaded into the template worker.
+	ScriptName string
+	Code       string
+	// Messages sent to the template worker after loading, to warm up the
+	// JIT on representative input. What the worker sends back is dropped.
+	Warmup []string
+}
+
+// Zygote is a host process holding a template worker that has loaded a
+// bootstrap script and warmed up. Fork copies the whole process with fork(),
+// so a new worker starts with the template's compiled code and heap instead
+// of building them from scratch, and shares every page it does not modify
+// with the zygote and with its siblings.
+//
+// Each forked worker runs alone in its own host process, which exits when the
+// worker is disposed or the zygote is closed. V8 runs without its background
+// compiler and garbage collector threads in the zygote and its children, as
+// threads do not survive fork.
+//
+// Math.random is reseeded in each forked worker, so siblings draw different
+// numbers, though functions holding the template's Math.random keep its
+// sequence. The string hash seed cannot be changed once V8 creates an
+// isolate, so every forked worker shares the template's: a script that can
+// provoke hash collisions in one of them can in all of them.
+type Zygote struct {
+	host     *Host
+	template *Worker
+	ringSize int
+}
+
+// StartZygote starts a zygote process and prepares its template worker.
+func StartZygote(opts *ZygoteOptions) (*Zygote, error) {
+	if opts == nil {
+		opts = new(ZygoteOptions)
+	}
+	host, err := startHost(&opts.HostOptions, "--zygote")
+	if err != nil {
+		return nil, err
+	}
+	discard := func(msg string) {}
+	template, err := host.NewWithOptions(discard, DiscardSendSync, opts.Options)
+	if err == nil {
+		err = template.Load(opts.ScriptName, opts.Code)
+	}
+	for i := 0; err == nil && i < len(opts.Warmup); i++ {
+		err = template.Send(opts.Warmup[i])
+	}
+	if err != nil {
+		host.Close()
+		return nil, err
+	}
+
+	return &Zygote{
+		host:     host,
+		template: template,
+		ringSize: hostRingSize(&opts.HostOptions),
+	}, nil
+}
+
+// Fork creates a worker in a new process forked from the zygote. The worker
+// has the template's state, and messages from it go to cb and syncCB.
+func (z *Zygote) Fork(cb ReceiveMessageCallback, syncCB ReceiveSyncMessageCallback) (*Worker, error) {
+	mem, shmPath, err := createSharedMemory(int(C.ipc_shm_size(C.uint32_t(z.ringSize))))
+	if err != nil {
+		return nil, err
+	}
+	h := newHost(mem, shmPath, z.ringSize, true)
+
+	id := registerCallbacks(cb, syncCB)
+	payload := []byte(strconv.Itoa(id) + "\x00" + shmPath)
+	res, err := z.host.call(C.IPC_FORK, z.template.id, payload)
+	if err == nil {
+		h.pid, err = strconv.Atoi(string(res))
+	}
+	if err != nil {
+		h.exit(errors.New("fork failed: " + err.Error()))
+		callbacksMapLocker.Lock()
+		delete(callbacksMap, id)
+		callbacksMapLocker.Unlock()
+		return nil, err
+	}
+
+	worker := &Worker{
+		lastActive: time.Now().UnixNano(),
+		id:         id,
+		cOptions:   z.template.cOptions,
+		remote:     h,
+	}
+	runtime.SetFinalizer(worker, func(final_worker *Worker) {
+		final_worker.Dispose()
+	})
+	return worker, nil
+}
+
+// Close stops the zygote and the workers forked from it.
+func (z *Zygote) Close() error {
+	return z.host.Close()
+}